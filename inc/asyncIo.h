@@ -0,0 +1,372 @@
+#ifndef __ASYNCIO_H__
+#define __ASYNCIO_H__
+
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+
+#include "endpoint.h"
+#include "bufferPool.h"
+
+class clientSocket;
+
+// Coroutine networking. Requests in flight sit in an epoll reactor instead of
+// a blocked thread; a couple of reactor threads resume whatever got ready.
+//
+//   Async::Lease lease;
+//   if (co_await lease.open(peer)) size = co_await Async::meta(lease.conn(), "f.bin");
+//   Async::RangeResult r = co_await Async::range(conn, "f.bin", 0, 4, size, buf, onChunk);
+//   bool ok = Async::syncWait(download(...));      // from plain code
+//
+// Tasks are lazy: nothing runs until they are awaited, start()ed or syncWait()ed.
+// Reference parameters are fine as long as the caller awaits right away.
+// Blocking work doesn't belong on the reactor or the download pool: hand it
+// to offload(), or co_await resumeOn(home) to go back to the syncWait() caller.
+namespace Async {
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+template <typename T> class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> cont;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // hand control straight back to whoever awaited us
+    struct Final {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            std::coroutine_handle<> c = h.promise().cont;
+            return c ? c : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    Final final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { std::terminate(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+    T result() { return std::move(*value); }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {}
+};
+
+} // namespace detail
+
+template <typename T>
+class Task {
+public:
+    typedef detail::Promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    explicit Task(Handle h) : h_(h) {}
+    Task(Task&& o) noexcept : h_(std::exchange(o.h_, Handle())) {}
+    Task& operator=(Task&& o) noexcept {
+        if (this != &o) {
+            if (h_) h_.destroy();
+            h_ = std::exchange(o.h_, Handle());
+        }
+        return *this;
+    }
+    ~Task() { if (h_) h_.destroy(); }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+        h_.promise().cont = cont;
+        return h_;
+    }
+    T await_resume() { return h_.promise().result(); }
+
+private:
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    Handle h_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+}
+
+// fire-and-forget frame, frees itself when done
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return Detached(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <typename T>
+Detached runDetached(Task<T> task, std::function<void(T)> done) {
+    T v = co_await task;
+    if (done) done(std::move(v));
+}
+
+inline Detached runDetached(Task<void> task, std::function<void()> done) {
+    co_await task;
+    if (done) done();
+}
+
+} // namespace detail
+
+// The thread blocked in a syncWait(). Coroutines it runs can hop back onto it
+// with co_await resumeOn(home), e.g. for disk work after the network part.
+class Home {
+public:
+    Home();
+    ~Home();
+
+    static Home* current();         // this thread's, nullptr outside syncWait()
+
+    void post(std::coroutine_handle<> h);
+    void finish();
+    void run();                     // resumes what is posted until finish()
+
+private:
+    Home(const Home&) = delete;
+    Home& operator=(const Home&) = delete;
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<std::coroutine_handle<> > queue_;
+    bool finished_;
+    Home* outer_;                   // a syncWait() further up this thread
+};
+
+struct ResumeOn {
+    Home* home;
+    bool await_ready() const noexcept { return !home || home == Home::current(); }
+    void await_suspend(std::coroutine_handle<> h) { home->post(h); }
+    void await_resume() noexcept {}
+};
+// co_await resumeOn(home): carry on on home's thread (no-op if null or there)
+inline ResumeOn resumeOn(Home* home) { return ResumeOn{ home }; }
+
+// Run fn on a thread kept for blocking calls (connects, synchronous round
+// trips), so the caller's thread can return right away
+void offload(std::function<void()> fn);
+
+// co_await whenAll(std::move(tasks)): runs them side by side and carries on
+// once every one finished, back on the awaiting thread if it is in a
+// syncWait() (else on whichever thread finished last)
+Task<void> whenAll(std::vector<Task<void> > tasks);
+
+// Run a task on its own; done() gets the result on whichever thread finished it
+template <typename T>
+void start(Task<T> task, std::function<void(T)> done) {
+    detail::runDetached(std::move(task), std::move(done));
+}
+
+inline void start(Task<void> task, std::function<void()> done = std::function<void()>()) {
+    detail::runDetached(std::move(task), std::move(done));
+}
+
+// Block the calling thread until the task is done. Meanwhile the thread runs
+// whatever the task sends back with resumeOn(Home::current()).
+template <typename T>
+T syncWait(Task<T> task) {
+    Home home;
+    std::optional<T> out;
+    start(std::move(task), std::function<void(T)>([&](T v) {
+        out = std::move(v);
+        home.finish();
+    }));
+    home.run();
+    return std::move(*out);
+}
+
+inline void syncWait(Task<void> task) {
+    Home home;
+    start(std::move(task), [&]() { home.finish(); });
+    home.run();
+}
+
+// epoll loop shared by every coroutine in the process
+class Reactor {
+public:
+    static Reactor& instance();
+
+    // co_await reactor.ready(fd, EPOLLIN, deadline): true once fd is ready,
+    // false if the deadline passed first
+    class Ready {
+    public:
+        Ready(Reactor& r, int fd, uint32_t events, Deadline deadline)
+            : r_(r), fd_(fd), events_(events), deadline_(deadline), timedOut_(false) {}
+
+        bool await_ready() const noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const noexcept { return !timedOut_; }
+
+    private:
+        friend class Reactor;
+        Reactor& r_;
+        int fd_;
+        uint32_t events_;
+        Deadline deadline_;
+        bool timedOut_;
+        std::coroutine_handle<> h_;
+    };
+
+    Ready ready(int fd, uint32_t events, Deadline deadline) { return Ready(*this, fd, events, deadline); }
+
+private:
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    struct Waiting {
+        Ready* w;
+        std::multimap<Deadline, uint64_t>::iterator timer;
+    };
+
+    void loop();
+
+    int epfd_;
+    std::mutex mu_;
+    std::map<uint64_t, Waiting> waiting_;
+    std::multimap<Deadline, uint64_t> timers_;
+    uint64_t nextId_;
+    std::atomic<bool> stopping_;
+    std::vector<std::thread> threads_;
+};
+
+// Buffered protocol I/O on a connected socket we don't own (e.g. a pooled
+// connection). Reads may run ahead within one reply; drained() says whether
+// anything past the last thing we parsed is still buffered.
+class Conn {
+public:
+    explicit Conn(int fd = -1, int timeoutMs = 5000);
+
+    Task<bool> sendAll(std::string data);
+    Task<bool> readLine(std::string& line);          // without the \n (\r stripped too)
+    Task<bool> readExact(char* out, size_t n);
+    // the next n bytes into a pipe, spliced in the kernel (whatever we read
+    // ahead already is written in); the pipe needs room for all of them
+    Task<bool> spliceExact(int pipeWr, size_t n);
+
+    // bytes someone else already read off this fd, parsed first
+    void unread(const std::string& bytes);
+
+    bool drained() const { return pos_ == end_ && !broken_; }
+    int fd() const       { return fd_; }
+
+private:
+    Task<bool> fill();
+    bool room(size_t n);
+    Deadline deadline() const;
+
+    int fd_;
+    int timeoutMs_;
+    BufferPool::Buffer buf_;     // read ahead: [pos_, end_) not parsed yet
+    size_t pos_;
+    size_t end_;
+    bool broken_;                // no buffer for what was unread: reads fail
+};
+
+// Non-blocking connect on the reactor; fd or -1. A peer that refuses or times
+// out counts against its breaker (PeerHealth)
+Task<int> connectTo(Endpoint peer, int timeoutMs = 5000);
+
+// A ConnectionPool connection without blocking a thread: an idle one if the
+// pool has one, else connected on the reactor. done(true) puts it back for the
+// next request, provided nothing is left unread; done(false) closes it
+class Lease {
+public:
+    Lease();
+    ~Lease();
+
+    Task<bool> open(Endpoint peer);
+    void done(bool clean);
+
+    Conn& conn()                 { return conn_; }
+    const Endpoint& peer() const { return peer_; }
+
+private:
+    Lease(const Lease&) = delete;
+    Lease& operator=(const Lease&) = delete;
+
+    std::unique_ptr<clientSocket> cs_;
+    Endpoint peer_;
+    bool leased_ = false;        // the pool's already (an idle one), else adopted at done()
+    Conn conn_;
+};
+
+// META <file>: the size, -1 if the peer doesn't have it, -2 if conn is no
+// good any more
+Task<long long> meta(Conn& conn, std::string filename);
+// one reply line to META, for callers that pipeline them: as above
+long long metaReply(const std::string& line);
+// META+ <file>: the same, but a file of up to maxInline bytes comes back whole
+// into data (inlined = true). -3: the peer doesn't know META+; conn is still
+// fine for meta()
+Task<long long> metaPlus(Conn& conn, std::string filename, long long maxInline,
+                         std::string& data, bool& inlined);
+
+struct Listing {
+    bool ok = false;             // the whole reply came in
+    std::vector<std::string> files;
+};
+// LIST: what the peer offers
+Task<Listing> list(Conn& conn);
+
+struct RangeResult {
+    int received = 0;   // chunks delivered to onChunk
+    int code = 0;       // 0 ok, 1 temp, 2 not found, 3 range/bad, 4 not have,
+                        // 5 busy (the rest of the run was read past, conn is usable)
+};
+// Payloads of at least minBytes go into pipeWr instead of memory; onChunk then
+// gets data == nullptr and must have emptied the pipe before the next reply
+struct SpliceTo {
+    int pipeWr = -1;
+    size_t minBytes = 0;
+};
+
+// GET chunks [first, first + count) pipelined on conn. Chunk first + i lands at
+// into + i * chunkSize (the caller's buffer, count * chunkSize bytes), then
+// onChunk(index, data, n) runs for it; returning false stops early
+Task<RangeResult> range(Conn& conn, std::string filename, long long first, int count, int chunkSize,
+                        char* into, std::function<bool(long long, const char*, size_t)> onChunk,
+                        SpliceTo splice = SpliceTo());
+
+} // namespace Async
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __BUFFERPOOL_H__
+#define __BUFFERPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Page-aligned I/O buffers for the chunk paths (GET replies, lane receive
+// buffers, merges, stream feeds), recycled instead of going back to malloc
+// for every request. Sizes are rounded up to a power-of-two class from 4 KiB
+// to 4 MiB. Each thread keeps a few buffers of each class to itself, within a
+// small share of the cap for all threads together; past that they go to a
+// shared free list per class.
+//
+// Everything taken from the system counts against one hard cap. A get() that
+// would go past it first releases the shared and its own cached buffers, then
+// waits up to waitMs for someone to hand one back, then returns an empty Buffer.
+class BufferPool {
+public:
+    // who holds the bytes, for usage()
+    enum Owner { SERVER = 0, DOWNLOAD, DISK, DELTA, OWNERS };
+
+    static const size_t PAGE = 4096;
+    static const size_t HUGE_PAGE = 2 * 1024 * 1024;
+    static const long long DEFAULT_CAP = 256LL * 1024 * 1024;
+
+    // what get() hands out; goes back to the pool when destroyed
+    class Buffer {
+    public:
+        Buffer() {}
+        Buffer(Buffer&& o) noexcept { take(o); }
+        Buffer& operator=(Buffer&& o) noexcept;
+        ~Buffer() { release(); }
+
+        char* data() const { return p_; }
+        size_t size() const { return n_; }          // as asked for
+        explicit operator bool() const { return p_ != nullptr; }
+
+        void release();                             // back to the pool now
+
+    private:
+        friend class BufferPool;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        void take(Buffer& o);
+
+        char* p_ = nullptr;
+        size_t n_ = 0;
+        int cls_ = -1;              // size class, CLASSES = too big to pool
+        Owner owner_ = SERVER;
+    };
+
+    struct Usage {
+        long long inUse = 0;        // bytes handed out right now
+        long long peak = 0;
+        long long gets = 0;
+        long long fresh = 0;        // gets that had to go to the system
+        long long denied = 0;       // gets that hit the cap
+    };
+
+    static BufferPool& instance();
+
+    Buffer get(size_t bytes, Owner who, int waitMs = 0);
+
+    void setCap(long long bytes);   // 0 = no cap; DEFAULT_CAP until set
+    long long cap() const { return cap_.load(); }
+    // classes of 2 MiB and up come from MAP_HUGETLB where the system has
+    // huge pages set aside, else transparent huge pages are asked for
+    void setHugePages(bool on) { huge_.store(on); }
+
+    Usage usage(Owner who) const;
+    long long held() const { return held_.load(); }  // from the system: in use + cached
+    static const char* name(Owner who);
+
+private:
+    BufferPool() {}
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    static const int CLASSES = 11;                   // 4 KiB << 0..10
+
+    struct Counters {
+        std::atomic<long long> inUse{0};
+        std::atomic<long long> peak{0};
+        std::atomic<long long> gets{0};
+        std::atomic<long long> fresh{0};
+        std::atomic<long long> denied{0};
+    };
+
+    struct FreeList {
+        std::mutex mu;
+        std::vector<char*> bufs;
+    };
+
+    struct ThreadCache;
+    static ThreadCache& cache();
+
+    static int classOf(size_t bytes);
+    static size_t classBytes(int cls) { return PAGE << cls; }
+    static size_t bytesOf(int cls, size_t n);        // what a buffer really holds
+    static size_t cacheSlots(int cls);
+
+    char* popFree(int cls);
+    char* fresh(size_t bytes);
+    void dispose(char* p, size_t bytes);
+    bool reserve(size_t bytes);                      // room under the cap
+    void trim();                                     // cached buffers back to the system
+    bool keepLocal(int cls);                         // put() may keep it in this thread's cache
+    void put(char* p, int cls, size_t n, Owner who);
+
+    std::atomic<long long> cap_{DEFAULT_CAP};
+    std::atomic<bool> huge_{false};
+    std::atomic<long long> held_{0};
+    std::atomic<long long> cached_{0};               // in the thread caches, all threads
+    Counters counters_[OWNERS];
+    FreeList free_[CLASSES];
+
+    std::mutex waitMu_;
+    std::condition_variable waitCv_;
+    std::atomic<int> waiters_{0};
+};
+
+#endif
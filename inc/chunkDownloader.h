@@ -2,10 +2,21 @@
 #define __CHUNKDOWNLOADER_H__
 
 #include "../inc/clientsocket.h"
+#include "../inc/asyncIo.h"
+#include "../inc/endpoint.h"
 #include <string>
 #include <vector>
 #include <atomic>
+#include <mutex>
+#include <map>
+#include <memory>
 
+class JobControl;
+class ChunkStore;
+class PartialFiles;
+class DownloadSink;
+class ChunkSet;
+struct CdcChunk;
 
 enum class FetchCode {
     OK = 0,
@@ -15,27 +26,120 @@ enum class FetchCode {
 };
 
 
+// Counters of one worker against one seeder. Each sits on its own cache line,
+// so workers bumping their counters never bounce a line between cores.
+struct alignas(64) ProgressSlot {
+    enum { FREE = 0, CLAIMING, READY };
+    std::atomic<int> state{FREE};       // worker and peer are set once READY
+    int worker = -1;
+    Endpoint peer;
+
+    std::atomic<long long> bytes{0};
+    std::atomic<long long> chunks{0};
+    std::atomic<int> errors{0};
+
+    void add(long long n, long long count = 1) {
+        bytes.fetch_add(n, std::memory_order_relaxed);
+        chunks.fetch_add(count, std::memory_order_relaxed);
+    }
+    void fail() { errors.fetch_add(1, std::memory_order_relaxed); }
+};
+
+// per seeder totals for the status screen (no peer = reused from a local copy)
+struct SeederTally {
+    Endpoint peer;
+    long long bytes = 0;
+    long long chunks = 0;
+    int errors = 0;
+};
+
 struct DownloadProgress {
+    static const int MAX_SLOTS = 64;    // per block; more blocks as needed
+
+    DownloadProgress() {}
+    ~DownloadProgress();
+
     std::atomic<long long> totalBytes{0};
-    std::atomic<long long> doneBytes{0};
-    std::atomic<int> totalChunks{0};
-    std::atomic<int> doneChunks{0};
+    std::atomic<long long> totalChunks{0};
+
+    // streaming: bytes [0, readyBytes) of the .part file are final and readable
+    std::atomic<long long> readyBytes{0};
 
     std::atomic<bool> active{false};
     std::atomic<bool> pending{false};  
     std::atomic<bool> success{false};
     std::atomic<bool> failed{false};
 
-    void reset() {
-        totalBytes.store(0);
-        doneBytes.store(0);
-        totalChunks.store(0);
-        doneChunks.store(0);
-        active.store(false);
-        pending.store(false);   
-        success.store(false);
-        failed.store(false);
-    }
+    // this worker's slot for this seeder, claimed on first use; worker -1 is
+    // for roll-ups. No locks: callers on the hot path cache the pointer.
+    ProgressSlot* slot(int worker, const Endpoint& seeder);
+
+    // add to a slot's counters
+    void put(int worker, const Endpoint& seeder, long long bytes, long long chunks, int errors = 0);
+    // overwrite them (roll-ups, from one thread only)
+    void set(int worker, const Endpoint& seeder, long long bytes, long long chunks, int errors = 0);
+
+    long long doneBytes() const;
+    long long doneChunks() const;
+    std::vector<SeederTally> bySeeder() const;
+
+    // only while nobody is writing (before the workers start)
+    void reset();
+
+private:
+    DownloadProgress(const DownloadProgress&) = delete;
+    DownloadProgress& operator=(const DownloadProgress&) = delete;
+
+    // slots never move once handed out: a full block gets another chained on
+    struct SlotBlock {
+        ProgressSlot slots[MAX_SLOTS];
+        std::atomic<SlotBlock*> next{nullptr};
+    };
+
+    SlotBlock slots_;
+};
+
+// One file of a batch job
+struct BatchItem {
+    std::string filename;
+    std::vector<Endpoint> seeders;
+    long long size = -1;          // filled in by the plan
+};
+
+struct BatchProgress {
+    std::atomic<int> totalFiles{0};
+    std::atomic<int> doneFiles{0};
+    std::atomic<int> failedFiles{0};
+    std::atomic<int> skippedFiles{0};   // already here, same size
+};
+
+struct DownloadOptions {
+    // fetch in order into a single "<name>.part" (renamed when done) and
+    // publish the readable prefix in DownloadProgress::readyBytes
+    bool streaming = false;
+    // streaming only: the in-order bytes also go here (an FdSink on a pipe or
+    // FIFO, say) as they become ready; the file still lands as usual. Ended
+    // once the download is over, whichever way
+    DownloadSink* streamTo = nullptr;
+    // size already known (batch plan): skip the META round trip
+    long long knownSize = -1;
+    // big payloads go socket -> pipe -> file with splice(), never through our
+    // buffers; small ones, or a filesystem that can't, use the buffered path
+    bool zeroCopy = true;
+    // whole-file seeders send each lane's range as paced UDP datagrams
+    // (UDPGET, see udpTransfer.h); peers that can't fall back to GET. Not
+    // used for streaming or with partial seeders; under a bandwidth cap each
+    // range is paid for up front.
+    bool udp = false;
+    // relay chain (CHAIN, see seedServer.cpp): pull in order from the peer
+    // that joined before us instead of from the seeders, while the next one
+    // pulls from us the same way. self = where the others reach us.
+    bool chain = false;
+    Endpoint self;
+    // the bytes go here instead of bin/ports/<port>/ (downloadSink.h): nothing
+    // touches local disk, is seeded meanwhile or shared with other jobs. An
+    // ordered() sink makes the download sequential; streamTo and chain don't apply.
+    DownloadSink* sink = nullptr;
 };
 
 class ChunkDownloader {
@@ -43,33 +147,123 @@ public:
     ChunkDownloader(int chunkSize, int startPort, int endPort);
 
     bool download(const std::string& filename,
-                  const std::vector<int>& seeders,
+                  const std::vector<Endpoint>& seeders,
                   int myPort);
 
     bool download(const std::string& filename,
-                  const std::vector<int>& seeders,
+                  const std::vector<Endpoint>& seeders,
                   int myPort,
                   DownloadProgress* prog);
 
+    // runs on the shared scheduler; ctl pauses/cancels/prioritises the job
+    bool download(const std::string& filename,
+                  const std::vector<Endpoint>& seeders,
+                  int myPort,
+                  DownloadProgress* prog,
+                  JobControl& ctl);
+
+    // A file that is already coming in (another job, a batch) isn't fetched
+    // twice: later calls share that transfer, show its progress in prog and
+    // get its result. If its job is cancelled, one of them takes over.
+    bool download(const std::string& filename,
+                  const std::vector<Endpoint>& seeders,
+                  int myPort,
+                  DownloadProgress* prog,
+                  JobControl& ctl,
+                  const DownloadOptions& opts);
+
+    // The same as a coroutine. Lanes run on the shared scheduler and their
+    // requests wait on the reactor, so no thread sits in recv; download()
+    // just waits for this. Resumes on a scheduler thread once the lanes are done.
+    Async::Task<bool> downloadAsync(std::string filename,
+                                    std::vector<Endpoint> seeders,
+                                    int myPort,
+                                    DownloadProgress* prog,
+                                    JobControl& ctl,
+                                    DownloadOptions opts);
+
     bool probeSize(const std::string& filename,
-                   const std::vector<int>& seeders,
+                   const std::vector<Endpoint>& seeders,
                    long long& outSize);
 
+    // Many files as one job: sizes for all of them are probed in one pipelined
+    // pass per seeder, then files run smallest first, a few at a time, over
+    // the shared connection pool. prog is the total across all files.
+    bool downloadBatch(std::vector<BatchItem> items,
+                       int myPort,
+                       DownloadProgress* prog,
+                       JobControl& ctl,
+                       BatchProgress* batch);
+
+    // rsync-style update of an existing local copy: send block signatures,
+    // get back copy/literal instructions. false = fall back to download()
+    bool syncDelta(const std::string& filename,
+                   const std::vector<Endpoint>& seeders,
+                   int myPort,
+                   DownloadProgress* prog,
+                   JobControl& ctl);
+
+    // local chunks matching the seeder's HASHES are copied instead of fetched
+    void setChunkStore(ChunkStore* store) { store_ = store; }
+
+    // serve what we already have of a download to other peers meanwhile
+    void setPartialFiles(PartialFiles* partials) { partials_ = partials; }
+
 private:
-    bool fetchMeta(const std::string& filename, int seederPort, long long& outSize);
-    bool fetchChunk(const std::string& filename,
-                    clientSocket& cs,
-                    int chunkIndex,
-                    char* outBuf,
-                    size_t& outN,
-                    int* outCode);
+    struct Lane;
+    struct Inflight;
+
+    int follow(Inflight& f, DownloadProgress* prog, JobControl& ctl,
+               DownloadSink* to = nullptr, const std::string& outPath = std::string(), long long* fed = nullptr);
+    std::shared_ptr<Inflight> leadInflight(const std::string& outPath, DownloadProgress* prog,
+                                           std::shared_ptr<Inflight>& other);
+    std::shared_ptr<Inflight> findInflight(const std::string& outPath);
+    void endInflight(const std::string& outPath, const std::shared_ptr<Inflight>& lead,
+                     bool ok, bool again, DownloadProgress* prog);
+
+    // META+: small files come back whole (inlined), no download needed
+    Async::Task<bool> probeInline(std::string filename, std::vector<Endpoint> seeders,
+                                  long long& outSize, std::string& data, bool& inlined, Endpoint& from);
+    void planSizes(std::vector<BatchItem>& items);
+    // BUNDLE: plan[mine] from one seeder in one round trip, written into
+    // place; got[i] set for each file that arrived
+    void bundleFrom(const Endpoint& seeder, const std::vector<BatchItem>& plan, const std::vector<size_t>& mine,
+                    int myPort, std::vector<DownloadProgress>& parts, std::vector<char>& got);
+    bool fetchHashes(const std::string& filename, const Endpoint& seeder, std::vector<CdcChunk>& out);
+    bool fetchHave(clientSocket& cs, const std::string& filename, long long totalChunks,
+                   bool& full, ChunkSet& have);
+    bool joinChain(const std::string& filename, const std::vector<Endpoint>& seeders,
+                   const Endpoint& self, const Endpoint& lost, Endpoint& head, Endpoint& upstream);
+    void leaveChain(const std::string& filename, const Endpoint& head, const Endpoint& self);
+    int  deltaFrom(const std::string& filename, const Endpoint& seeder, const std::string& localPath,
+                   int blockSize, const std::string& request,
+                   DownloadProgress* prog, JobControl& ctl);
 
 
     std::string portDirectory(int port) const;
 
+    // per-seeder chunk latency, shared by all jobs (used to decide hedging)
+    void recordLatency(const Endpoint& seeder, double ms);
+    double hedgeThresholdMs(const Endpoint& seeder);
+
+    struct LatencyWindow {
+        std::vector<double> samples;
+        size_t next = 0;
+    };
+
+    std::mutex latMu_;
+    std::map<Endpoint, LatencyWindow> latency_;
+
+    // download() calls in progress by output path: a second one for the same
+    // file waits for the first instead of racing it over the same part files
+    std::mutex inflightMu_;
+    std::map<std::string, std::shared_ptr<Inflight> > inflight_;
+
     int chunkSize_;
     int startPort_;
     int endPort_;
+    ChunkStore* store_;
+    PartialFiles* partials_;
 
 };
 
@@ -0,0 +1,67 @@
+#ifndef __CHUNKSET_H__
+#define __CHUNKSET_H__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Chunk indexes kept as runs [first, end) instead of a byte or bit per chunk.
+// Chunks land mostly next to each other, so a download of hundreds of millions
+// of chunks is tracked in a few runs per stripe. Stripes of SPAN chunks share
+// SHARDS locks round robin, so lanes working different parts of a file don't
+// wait on each other. Calls on one chunk are atomic; over a range they take
+// the stripes one at a time. O(log runs) a stripe.
+class ChunkSet {
+public:
+    ChunkSet() {}
+
+    bool add(long long c);                        // true if it wasn't in yet
+    void add(long long first, long long end);
+    bool remove(long long c);                     // true if it was in
+    void remove(long long first, long long end);
+    bool has(long long c) const;
+
+    // first chunk in [from, end) that is / isn't in the set, end if none
+    long long nextIn(long long from, long long end) const;
+    long long nextOut(long long from, long long end) const;
+    // last chunk in [from, end) that isn't in the set, from - 1 if none
+    long long prevOut(long long from, long long end) const;
+
+    // the runs within [from, end), clipped to it
+    std::vector<std::pair<long long, long long> > runsIn(long long from, long long end) const;
+
+    // HAVE bitmap of chunks [0, n), bit 7 of byte 0 = chunk 0
+    std::string bitmap(long long n) const;
+    void addBitmap(const std::string& bits, long long n);
+
+private:
+    ChunkSet(const ChunkSet&) = delete;
+    ChunkSet& operator=(const ChunkSet&) = delete;
+
+    static const int SHARDS = 16;
+    static const long long SPAN = 1LL << 14;       // chunks per stripe
+
+    typedef std::map<long long, long long> Runs;   // first -> end, never touching or crossing a stripe
+
+    struct Shard {
+        mutable std::mutex mu;
+        Runs runs;
+    };
+
+    static long long stripeEnd(long long c) { return (c / SPAN + 1) * SPAN; }
+    const Shard& shardOf(long long c) const { return shards_[(c / SPAN) % SHARDS]; }
+    Shard& shardOf(long long c) { return shards_[(c / SPAN) % SHARDS]; }
+
+    // within one stripe, shard locked
+    static Runs::const_iterator runOf(const Runs& runs, long long c);  // the run holding c, or end()
+    static void addRun(Runs& runs, long long first, long long end);
+    static void removeRun(Runs& runs, long long first, long long end);
+    // first run starting at or after c, in any stripe; LLONG_MAX if none
+    long long nextStart(long long c) const;
+
+    Shard shards_[SHARDS];
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __CHUNKSTORE_H__
+#define __CHUNKSTORE_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// One content-defined chunk of a file
+struct CdcChunk {
+    long long offset;
+    long long length;
+    std::string hash;      // sha256 hex
+};
+
+// Content-addressed index over the files in our port directory. Chunk
+// boundaries come from a rolling gear hash, so an insert or a rotated log
+// only changes the chunks around the edit. The bytes stay in the files
+// themselves; the index just remembers where each hash lives.
+class ChunkStore {
+public:
+    ChunkStore();
+    ~ChunkStore();
+
+    void setDirectory(const std::string& dir);
+
+    // cut a buffer / file into content-defined chunks
+    static std::vector<CdcChunk> split(const char* data, size_t len);
+    static bool splitFile(const std::string& path, std::vector<CdcChunk>& out);
+
+    // chunk list of a local file (cached until it changes)
+    bool manifest(const std::string& name, std::vector<CdcChunk>& out);
+
+    // copy a chunk with this hash out of any local file (verified on read)
+    bool read(const std::string& hash, long long length, std::string& out);
+
+    // (re)index one file, e.g. right after it finished downloading
+    void addFile(const std::string& name);
+
+    // pick up files added/changed/removed since the last look
+    void refresh();
+
+    // refresh() on a background thread every intervalMs, starting now
+    void startRefresh(int intervalMs);
+    void stopRefresh();
+
+private:
+    struct Location {
+        std::string name;
+        long long offset;
+        long long length;
+    };
+
+    struct FileIndex {
+        long long size;
+        long long mtime;
+        std::vector<CdcChunk> chunks;
+    };
+
+    bool index(const std::string& dir, const std::string& name,
+               long long size, long long mtime, FileIndex& fi);
+    bool current(const std::string& name, long long size, long long mtime, std::vector<CdcChunk>* out);
+    std::string directory();
+    void installLocked(const std::string& name, const FileIndex& fi);
+    void forgetLocked(const std::string& name);
+    void refreshLoop(int intervalMs);
+
+    // only guards the maps; file reads and hashing happen outside it
+    std::mutex mu_;
+    std::string dir_;
+    std::map<std::string, FileIndex> files_;
+    std::unordered_map<std::string, Location> byHash_;
+
+    std::mutex refreshMu_;
+    std::condition_variable refreshCv_;
+    std::thread refresher_;
+    bool stopRefresh_ = false;
+};
+
+#endif
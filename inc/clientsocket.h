@@ -4,6 +4,8 @@
 #include <string>
 #include <arpa/inet.h>
 #include <stddef.h> 
+#include "netIO.h"
+#include "endpoint.h"
 
 class clientSocket {
 public:
@@ -11,6 +13,8 @@ public:
     ~clientSocket();
 
     bool connectServer(const std::string& ip, int port);
+    bool connectServer(const Endpoint& peer);
+    bool adopt(int fd);   // take over an already connected socket
 
    
     bool sendData(const std::string& data);
@@ -26,10 +30,18 @@ public:
     
 
     void closeConn();
+    int  fd() const { return client_fd; }
+
+    // bytes read off the socket but not handed out yet
+    size_t buffered() const { return in_.buffered(); }
+    std::string takeBuffered() { return in_.take(); }
 
 private:
+    void applyOptions();
+
     int client_fd;
-    struct sockaddr_in serv_addr;
+    NetIo::Reader in_;
+    struct sockaddr_storage serv_addr;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,86 @@
+#ifndef __CONNECTIONPOOL_H__
+#define __CONNECTIONPOOL_H__
+
+#include "../inc/clientsocket.h"
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <memory>
+#include <chrono>
+#include <condition_variable>
+
+// Process-wide pool of persistent connections, keyed by seeder endpoint.
+// Scanner, META probes and download workers all lease from here so a peer
+// is only handshaked once per burst of work.
+class ConnectionPool {
+public:
+    static ConnectionPool& instance();
+
+    // Idle (health-checked) connection if there is one, else a new one while
+    // under the per-peer cap. Waits a bit for a release when the cap is hit.
+    std::unique_ptr<clientSocket> acquire(const Endpoint& peer);
+    // only an idle one: never connects or waits (Async::Lease connects itself)
+    std::unique_ptr<clientSocket> idle(const Endpoint& peer);
+    void release(const Endpoint& peer, std::unique_ptr<clientSocket> cs, bool reuse);
+
+    // Park a connection opened elsewhere (e.g. by the scanner) as idle.
+    void adopt(const Endpoint& peer, std::unique_ptr<clientSocket> cs);
+
+    // Connect to every peer in parallel and park the results as idle.
+    // Returns the peers that answered, fastest first.
+    std::vector<Endpoint> warm(const std::vector<Endpoint>& peers);
+
+    void closeAll();
+
+private:
+    ConnectionPool();
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    struct Idle {
+        std::unique_ptr<clientSocket> cs;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    struct Peer {
+        std::deque<Idle> idle;
+        int open = 0;            // idle + leased
+    };
+
+    static bool healthy(const clientSocket& cs);
+    void reapLoop();
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::map<Endpoint, Peer> peers_;
+    std::thread reaper_;
+    bool stopping_;
+};
+
+// RAII lease on a pooled connection. Goes back to the pool on release() or
+// destruction; discard() when the stream state is unknown (failed request).
+class PooledConnection {
+public:
+    PooledConnection() {}
+    ~PooledConnection() { release(); }
+
+    bool open(const Endpoint& peer);
+    void release();
+    void discard();
+
+    bool valid() const { return cs_ != nullptr; }
+    const Endpoint& peer() const { return peer_; }
+    clientSocket& sock() { return *cs_; }
+
+private:
+    PooledConnection(const PooledConnection&) = delete;
+    PooledConnection& operator=(const PooledConnection&) = delete;
+
+    std::unique_ptr<clientSocket> cs_;
+    Endpoint peer_;
+};
+
+#endif
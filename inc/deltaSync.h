@@ -0,0 +1,44 @@
+#ifndef __DELTASYNC_H__
+#define __DELTASYNC_H__
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// rsync-style delta: the side with the old copy sends block signatures, the
+// side with the new copy answers with copy-block / literal-data instructions.
+namespace DeltaSync {
+
+    struct BlockSig {
+        uint32_t weak;          // rolling checksum
+        std::string strong;     // truncated sha256 hex
+    };
+
+    // copy == true:  reuse `count` old blocks starting at `block`
+    // copy == false: `len` literal bytes at `data`
+    struct Op {
+        bool copy;
+        long long block;
+        long long count;
+        const char* data;
+        size_t len;
+    };
+
+    int blockSizeFor(long long fileSize);
+
+    uint32_t weakSum(const char* p, size_t len);
+    std::string strongSum(const char* p, size_t len);
+
+    // signatures of the full blocks of a file (a short tail block is left out)
+    bool signature(const std::string& path, int blockSize, std::vector<BlockSig>& out);
+
+    // walk `data` against the old blocks and emit ops in order; emit returning
+    // false stops the walk (e.g. the peer went away)
+    bool generate(const char* data, size_t len, int blockSize,
+                  const std::vector<BlockSig>& sigs,
+                  const std::function<bool(const Op&)>& emit);
+}
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef __DOWNLOADSCHEDULER_H__
+#define __DOWNLOADSCHEDULER_H__
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <coroutine>
+
+#include "../inc/rateLimiter.h"
+
+// Cooperative control of one job, shared by the UI and the tasks doing the work.
+// Tasks check it between slices; cancel also interrupts requests in flight.
+class JobControl {
+public:
+    enum State { RUNNING = 0, PAUSED, CANCELLED };
+
+    explicit JobControl(int priority = 0, int weight = 1);
+
+    void pause();
+    void resume();
+    void cancel();
+
+    State state() const          { return (State)state_.load(); }
+    bool paused() const          { return state_.load() == PAUSED; }
+    bool stopRequested() const   { return state_.load() == CANCELLED; }
+
+    int  priority() const        { return priority_.load(); }
+    void setPriority(int p);
+    int  weight() const          { return weight_.load(); }
+    void setWeight(int w);
+
+    // per-job bandwidth cap (0 = none), on top of RateLimiter::global()
+    RateLimiter& limiter()       { return limiter_; }
+
+private:
+    std::atomic<int> state_;
+    std::atomic<int> priority_;
+    std::atomic<int> weight_;
+    RateLimiter limiter_;
+};
+
+// One resumable unit of a job (e.g. a seeder lane). step() does a bounded slice
+// of work on a pool thread and says when it wants to run again. BLOCKED means
+// a request is in flight on the reactor; whoever completes it calls
+// DownloadScheduler::poke() and the task runs again.
+class SchedTask {
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    enum Result { MORE = 0, WAIT, PARKED, BLOCKED, FINISHED };
+
+    virtual ~SchedTask() {}
+
+    // bytesOut: payload moved this slice (charged to the job's fair share)
+    // wakeAt:   when to run again if the result is WAIT
+    virtual Result step(long long& bytesOut, TimePoint& wakeAt) = 0;
+
+    // Called from another thread on cancel: drop sockets / unblock I/O now.
+    virtual void interrupt() {}
+};
+
+// Process-wide worker pool shared by every download. Higher priority jobs
+// run first; within a priority, jobs get pool time in proportion to weight
+// (stride scheduling on bytes moved).
+class DownloadScheduler {
+    struct Job;
+
+public:
+    static DownloadScheduler& instance();
+
+    // co_await runAsync(ctl, tasks): resumes (on a pool thread) once every
+    // task has finished
+    class Run {
+    public:
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> h);
+        void await_resume() noexcept {}
+
+    private:
+        friend class DownloadScheduler;
+        Run(DownloadScheduler& s, JobControl& ctl, const std::vector<SchedTask*>& tasks);
+
+        DownloadScheduler& s_;
+        std::unique_ptr<Job> job_;
+    };
+
+    Run runAsync(JobControl& ctl, const std::vector<SchedTask*>& tasks);
+
+    // Run the job's tasks on the pool; returns once every task has finished.
+    void run(JobControl& ctl, const std::vector<SchedTask*>& tasks);
+
+    // a BLOCKED task's request completed
+    void poke(SchedTask* task);
+
+    void wake();
+
+private:
+    DownloadScheduler();
+    ~DownloadScheduler();
+    DownloadScheduler(const DownloadScheduler&) = delete;
+    DownloadScheduler& operator=(const DownloadScheduler&) = delete;
+
+    struct LaneSlot {
+        SchedTask* task;
+        bool running;
+        bool parked;
+        bool blocked;
+        bool poked;        // completed while step() was still running
+        bool finished;
+        SchedTask::TimePoint wakeAt;
+    };
+
+    struct Job {
+        JobControl* ctl;
+        std::vector<LaneSlot> lanes;
+        size_t live;
+        size_t nextLane;
+        double pass;
+        bool idle;
+        bool interrupted;
+        std::coroutine_handle<> waiter;
+    };
+
+    bool pickLocked(Job*& job, size_t& lane, SchedTask::TimePoint& nextWake);
+    void interruptCancelledLocked();
+    void workerLoop();
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::list<Job*> jobs_;
+    std::vector<std::thread> threads_;
+    double vtime_;
+    bool stopping_;
+};
+
+#endif
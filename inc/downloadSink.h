@@ -0,0 +1,75 @@
+#ifndef __DOWNLOADSINK_H__
+#define __DOWNLOADSINK_H__
+
+#include <string>
+#include <utility>
+
+// Where the bytes of a download go when they shouldn't land in
+// bin/ports/<port>/ (DownloadOptions::sink). The downloader calls begin()
+// once the size is known, write() for every chunk from a feeder thread of its
+// own, and end() exactly once, even if it never got as far as begin(). Never
+// two of them at the same time, so a sink needs no locking of its own.
+class DownloadSink {
+public:
+    virtual ~DownloadSink() {}
+
+    // size of the whole file; false = don't download
+    virtual bool begin(long long size) = 0;
+    // n bytes at offset; in file order, each byte once, if ordered()
+    virtual bool write(long long offset, const char* data, size_t n) = 0;
+    // every byte went in (ok), or the download failed or was cancelled
+    virtual bool end(bool ok) = 0;
+
+    // wants its bytes in order: the download runs sequentially and holds
+    // chunks that overtake a slower one until the gap closes
+    virtual bool ordered() const { return false; }
+};
+
+// Any path on disk: written as "<path>.part", renamed in when complete
+class FileSink : public DownloadSink {
+public:
+    explicit FileSink(const std::string& path) : path_(path) {}
+    ~FileSink();
+
+    bool begin(long long size) override;
+    bool write(long long offset, const char* data, size_t n) override;
+    bool end(bool ok) override;
+
+private:
+    std::string path_;
+    int fd_ = -1;
+};
+
+// The whole file in memory; data() is complete once end(true) returned
+class MemorySink : public DownloadSink {
+public:
+    bool begin(long long size) override;
+    bool write(long long offset, const char* data, size_t n) override;
+    bool end(bool ok) override;
+
+    const std::string& data() const { return data_; }
+    std::string take() { return std::move(data_); }
+
+private:
+    std::string data_;
+};
+
+// In order to a pipe, FIFO or socket while the download runs. A reader that
+// goes away fails the download. The fd is closed by end() unless told not to.
+class FdSink : public DownloadSink {
+public:
+    explicit FdSink(int fd, bool closeAtEnd = true) : fd_(fd), close_(closeAtEnd) {}
+    ~FdSink();
+
+    bool begin(long long size) override;
+    bool write(long long offset, const char* data, size_t n) override;
+    bool end(bool ok) override;
+    bool ordered() const override { return true; }
+
+private:
+    int fd_;
+    bool close_;
+    long long sent_ = 0;
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __ENDPOINT_H__
+#define __ENDPOINT_H__
+
+#include <string>
+#include <functional>
+#include <sys/socket.h>
+
+// A peer: numeric IPv4/IPv6 address + port. An empty host means "every
+// address of this machine" (how we listen unless SEED_HOST pins one).
+struct Endpoint {
+    std::string host;
+    int port = -1;
+
+    Endpoint() {}
+    Endpoint(const std::string& host, int port) : host(host), port(port) {}
+
+    bool valid() const { return port > 0 && port <= 65535; }
+    bool anyAddress() const { return host.empty(); }
+
+    // "127.0.0.2:9000", "[::1]:9000", "*:9000"
+    std::string str() const;
+
+    // "host:port", "[v6]:port" or a bare "port" (on defaultHost); the host
+    // must be a numeric address
+    static bool parse(const std::string& text, Endpoint& out,
+                      const std::string& defaultHost = "127.0.0.1");
+    static bool validHost(const std::string& host);
+
+    // where to connect; an any-address endpoint is reached over loopback
+    bool toSockaddr(sockaddr_storage& out, socklen_t& len) const;
+
+    // is other this very endpoint, counting any-address as all our addresses
+    bool covers(const Endpoint& other) const;
+
+    bool operator==(const Endpoint& o) const { return port == o.port && host == o.host; }
+    bool operator!=(const Endpoint& o) const { return !(*this == o); }
+    bool operator<(const Endpoint& o) const  { return host != o.host ? host < o.host : port < o.port; }
+};
+
+// one of this machine's addresses (loopback included)
+bool isLocalAddress(const std::string& host);
+
+namespace std {
+template <> struct hash<Endpoint> {
+    size_t operator()(const Endpoint& e) const { return hash<string>()(e.host) * 31u + (size_t)e.port; }
+};
+}
+
+#endif
@@ -3,28 +3,89 @@
 
 #include <string>
 #include <vector>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include "endpoint.h"
 
+class PeerTable;
 
 struct FileEntry {
     std::string filename;
-    std::vector<int> seeders;
+    std::vector<Endpoint> seeders;
 };
 
+// Called as each peer's LIST reply lands (already merged into the catalog)
+typedef std::function<void(const Endpoint& peer, const std::vector<std::string>& names)> ScanProgressFn;
+
 class FileScanner {
 public:
     FileScanner(int startPort, int endPort);
+    ~FileScanner();
+
+    // Scan now, fold the replies into the catalog and return it
+    std::vector<FileEntry> scanOtherPorts(const Endpoint& self,
+                                          const ScanProgressFn& onPeer = ScanProgressFn());
+
+    // Cached catalog (sorted by filename), usable before any scan finishes
+    std::vector<FileEntry> catalog() const;
+    long long catalogAgeSec() const;     // -1 if never refreshed this session
+
+    // Scan the peers in this table (learned through PEERS gossip) instead of
+    // sweeping the whole port range
+    void setPeerTable(PeerTable* peers) { peers_ = peers; }
+
+    // hosts whose first ports are tried while we know no one (default 127.0.0.1)
+    void setSweepHosts(const std::vector<std::string>& hosts) { sweepHosts_ = hosts; }
+
+    // Snapshot on disk + background refresh every TTL (with jitter)
+    bool loadSnapshot(const Endpoint& self);
+    void startRefresh(const Endpoint& self);
+    void stopRefresh();
 
-    std::vector<FileEntry> scanOtherPorts(int myPort) const;
     bool existsLocal(int myPort, const std::string& filename) const;
     bool existsLocal(int myPort, const std::string& filename, long long expectedSize) const;
     long long localSize(int myPort, const std::string& filename) const;
 
 private:
+    typedef std::function<void(const Endpoint& peer, const std::vector<std::string>& names,
+                               const std::vector<Endpoint>& learned)> ListingFn;
+
+    std::vector<Endpoint> scanTargets(const Endpoint& self) const;
+    std::vector<Endpoint> scanPeers(const std::vector<Endpoint>& targets, const Endpoint& self,
+                                    const ListingFn& onListing) const;
+    size_t scanRound(const Endpoint& self, const ScanProgressFn& onPeer);
+    void applyListing(const Endpoint& peer, const std::vector<std::string>& names);
+    bool saveSnapshot(int myPort) const;
+    std::string snapshotPath(int myPort) const;
+    void refreshLoop(Endpoint self);
+
     std::string portDirectory(int port) const;
     bool isRegularFile(const std::string& path) const;
 
     int startPort_;
     int endPort_;
+    PeerTable* peers_;
+    std::vector<std::string> sweepHosts_;
+
+    // catalog: filename -> entry, plus what each peer last advertised so a
+    // refresh only touches the names that changed
+    mutable std::mutex catMu_;
+    std::unordered_map<std::string, FileEntry> files_;
+    std::unordered_map<Endpoint, std::unordered_set<std::string> > listings_;
+    std::chrono::steady_clock::time_point refreshedAt_;
+    bool refreshed_;
+
+    std::mutex scanMu_;                  // one scan at a time
+
+    std::mutex refreshMu_;
+    std::condition_variable refreshCv_;
+    std::thread refresher_;
+    bool stopRefresh_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,10 +1,45 @@
 #ifndef __NETIO_H__
 #define __NETIO_H__
 #include <cstddef>
+#include <string>
+#include <vector>
 
 namespace NetIo {
     int  recvLine(int fd, char* out, size_t cap);          
     bool recvAll(int fd, void* buf, size_t len);           
     bool sendAll(int fd, const void* buf, size_t len);    
+
+    // Per-connection read buffer. One recv fills up to READ_BUF bytes, lines
+    // are cut out of it with memchr, and payload that is already buffered is
+    // copied straight to the caller (the rest is received in place).
+    class Reader {
+    public:
+        static const size_t READ_BUF = 16 * 1024;
+
+        explicit Reader(int fd = -1);
+        void reset(int fd);     // new stream: whatever was buffered is dropped
+
+        // up to and including delim, NUL terminated; count stored, 0 on EOF,
+        // -1 on error. A line longer than cap-1 stops there, or with drain
+        // the rest of it is skipped; *truncated says which happened.
+        int  readUntil(char delim, char* out, size_t cap, bool drain, bool* truncated = nullptr);
+        int  readLine(char* out, size_t cap) { return readUntil('\n', out, cap, false); }
+
+        bool readExact(void* out, size_t len);
+        // buffered bytes if any, else whatever one recv brings; like recv()
+        long readSome(void* out, size_t len);
+
+        size_t buffered() const { return end_ - pos_; }
+        // hand the buffered bytes to someone else reading the same fd
+        std::string take();
+
+    private:
+        long fill();
+
+        int fd_;
+        std::vector<char> buf_;
+        size_t pos_;
+        size_t end_;
+    };
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,80 @@
+#ifndef __PARTIALFILES_H__
+#define __PARTIALFILES_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "chunkSet.h"
+
+// A download in progress that we already seed from. The part files stay open
+// read-only here, so a reader holding the shared_ptr is fine even after the
+// download renamed/merged them away.
+class PartialFile {
+public:
+    PartialFile(long long size, int chunkSize);
+    ~PartialFile();
+
+    // part file covering chunks from firstChunk on (add in order)
+    bool addPart(const std::string& path, long long firstChunk);
+
+    // chunks are on disk; they only ever get added
+    void mark(long long chunk) { mark(chunk, chunk + 1); }
+    void mark(long long first, long long end);
+    bool has(long long chunk) const;
+
+    // block until the chunk is marked (true), ms passed or the download
+    // finished without it
+    bool waitFor(long long chunk, int ms);
+    // download over, done or not: wake whoever waits
+    void finish();
+
+    // for HAVE: what we have as runs [first, end), or as a bitmap with
+    // bit 7 of byte 0 = chunk 0
+    std::vector<std::pair<long long, long long> > runs() const;
+    std::string bitmap() const;
+
+    // bytes of a chunk we have, -1 if missing or unreadable
+    long long read(long long chunk, char* out) const;
+
+    long long size() const { return size_;  }
+    long long chunks() const { return chunks_; }
+
+private:
+    PartialFile(const PartialFile&) = delete;
+    PartialFile& operator=(const PartialFile&) = delete;
+
+    long long size_;
+    int chunkSize_;
+    long long chunks_;
+    std::vector<long long> firstChunk_;
+    std::vector<int> fds_;
+    ChunkSet have_;
+
+    std::mutex waitMu_;
+    std::condition_variable waitCv_;
+    std::atomic<int> waiters_{0};
+    bool finished_ = false;
+};
+
+// Downloads in progress by file name, shared by the downloader (publishes and
+// marks chunks) and the server (LIST/META/HAVE/GET).
+class PartialFiles {
+public:
+    void publish(const std::string& name, const std::shared_ptr<PartialFile>& file);
+    // only removes it if it is still this download's entry
+    void withdraw(const std::string& name, const std::shared_ptr<PartialFile>& file);
+
+    std::shared_ptr<PartialFile> find(const std::string& name) const;
+    std::vector<std::string> names() const;
+
+private:
+    mutable std::mutex mu_;
+    std::map<std::string, std::shared_ptr<PartialFile> > files_;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef __PEERHEALTH_H__
+#define __PEERHEALTH_H__
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include "endpoint.h"
+
+// Process-wide view of which peers answer, so one worker finding a seeder
+// down spares every other worker and job the same retries. Everybody who
+// connects asks allow() first. Failures to connect or to get an answer are
+// reported; success only once a request was answered, as a peer that takes
+// connections but fails every request is no better than one that is down.
+//
+// Per peer circuit breaker:
+//   CLOSED     connect away; FAILS_TO_OPEN failures in a row open it
+//   OPEN       skip it until its backoff (exponential, jittered) runs out
+//   HALF_OPEN  one caller probes; success closes, failure opens it again
+//              with twice the backoff
+class PeerHealth {
+public:
+    enum State { CLOSED, OPEN, HALF_OPEN };
+
+    static PeerHealth& instance();
+
+    // may we connect now? Past the backoff of an open breaker the first
+    // caller gets true and becomes the probe
+    bool allow(const Endpoint& peer);
+    void success(const Endpoint& peer);
+    void failure(const Endpoint& peer);
+
+    // without claiming a probe: would allow() say yes
+    bool usable(const Endpoint& peer) const;
+    State state(const Endpoint& peer) const;
+
+    // wait before our own next attempt: base * 2^attempt, capped, with jitter
+    static std::chrono::milliseconds backoff(int attempt, int baseMs, int capMs);
+
+private:
+    PeerHealth() {}
+    PeerHealth(const PeerHealth&) = delete;
+    PeerHealth& operator=(const PeerHealth&) = delete;
+
+    typedef std::chrono::steady_clock Clock;
+
+    struct Breaker {
+        State state = CLOSED;
+        int fails = 0;             // in a row
+        int trips = 0;             // opened in a row, sizes the backoff
+        Clock::time_point retryAt; // OPEN: until then; HALF_OPEN: probe expires
+    };
+
+    bool usableLocked(const Breaker& b, Clock::time_point now) const;
+
+    mutable std::mutex mu_;
+    std::map<Endpoint, Breaker> peers_;
+    std::atomic<size_t> tracked_{0};   // peers_.size(): success() on healthy peers skips the lock
+};
+
+#endif
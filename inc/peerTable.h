@@ -0,0 +1,35 @@
+#ifndef __PEERTABLE_H__
+#define __PEERTABLE_H__
+
+#include <vector>
+#include <mutex>
+#include <random>
+#include <cstddef>
+#include "endpoint.h"
+
+// Bounded table of peers we know about, shared by the server (answers PEERS)
+// and the scanner (who to LIST). When full, newcomers replace a random entry
+// half the time so the table stays a random sample of the swarm.
+class PeerTable {
+public:
+    explicit PeerTable(size_t capacity = 64);
+
+    void setSelf(const Endpoint& self);
+    bool add(const Endpoint& peer);           // true if it was new
+    void remove(const Endpoint& peer);
+
+    std::vector<Endpoint> sample(size_t n, const Endpoint& exclude = Endpoint()) const;
+    std::vector<Endpoint> all() const;
+    size_t size() const;
+    unsigned long version() const;            // bumps whenever a peer is added
+
+private:
+    mutable std::mutex mu_;
+    std::vector<Endpoint> peers_;
+    size_t capacity_;
+    Endpoint self_;
+    unsigned long version_;
+    mutable std::mt19937 rng_;
+};
+
+#endif
@@ -1,13 +1,16 @@
 #ifndef __PORTALLOCATOR_H__
 #define __PORTALLOCATOR_H__
 #include <netinet/in.h>
+#include <string>
 
 class PortAllocator {
 public:
     PortAllocator();
     ~PortAllocator();
 
-    bool claim(int startPort, int endPort);
+    // first free port of the range; host pins the listening address (the port
+    // is still free on every address, so bin/ports/<port> stays ours)
+    bool claim(int startPort, int endPort, const std::string& host = std::string());
     int  port() const { return port_; }
     int  fd()   const { return listenFd_; }
 
@@ -0,0 +1,32 @@
+#ifndef __RATELIMITER_H__
+#define __RATELIMITER_H__
+
+#include <chrono>
+#include <mutex>
+
+// Token bucket in bytes/sec, 0 = unlimited. Callers reserve before moving
+// bytes and get back how long to wait; the tokens are theirs either way, so
+// waiters queue up in order instead of racing for the refill.
+class RateLimiter {
+public:
+    explicit RateLimiter(long long bytesPerSec = 0);
+
+    // process-wide limit shared by every download
+    static RateLimiter& global();
+
+    void setRate(long long bytesPerSec);
+    long long rate() const;
+
+    std::chrono::microseconds reserve(long long bytes);
+    void refund(long long bytes);        // bytes reserved but never moved
+
+private:
+    void refillLocked(std::chrono::steady_clock::time_point now);
+
+    mutable std::mutex mu_;
+    long long rate_;
+    double tokens_;                      // negative = queued debt
+    std::chrono::steady_clock::time_point last_;
+};
+
+#endif
@@ -13,19 +13,27 @@
 #include "seedServer.h"
 #include "fileScanner.h"
 #include "chunkDownloader.h"
+#include "peerTable.h"
+#include "downloadScheduler.h"
+#include "chunkStore.h"
+#include "partialFiles.h"
 
 class SeedApp {
 
 private:
     struct DownloadJob {
         std::string filename;
-        std::vector<int> seeders;
+        std::vector<Endpoint> seeders;
 
         std::chrono::steady_clock::time_point start;
         std::chrono::steady_clock::time_point end;
         std::atomic<bool> finished{false};
 
         DownloadProgress progress;
+        JobControl control;
+        bool streaming = false;
+        bool isBatch = false;
+        BatchProgress batch;
         std::thread worker;
         long long lastDoneBytes = 0;
         std::chrono::steady_clock::time_point lastTick;
@@ -41,9 +49,13 @@ private:
 
     void showMenu() const;
     int readInt(bool* eof) const;
+    std::string readLine(bool* eof) const;
 
-    void downloadFlow();
+    std::vector<FileEntry> availableFiles();
+    void downloadFlow(bool streaming = false);
+    void batchFlow();
     void statusFlow();
+    void limitFlow();
     void handleClient(int clientFd, int port);
 
 private:
@@ -56,9 +68,15 @@ private:
     int chunkSize_;
 
     int myPort_;
+    Endpoint self_;            // what we listen on; no host = every address
     int listenFd_ = -1;
+    bool udp_ = false;         // bulk chunks over UDP where the seeder can
+    bool chain_ = false;       // downloads join the seeder's relay chain
 
     PortAllocator allocator_;
+    PeerTable peers_;
+    ChunkStore store_;
+    PartialFiles partials_;
     SeedServer server_;
     FileScanner scanner_;
     ChunkDownloader downloader_;
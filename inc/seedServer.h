@@ -2,6 +2,17 @@
 #define __SEEDSERVER_H__
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <map>
+#include <string>
+#include <vector>
+#include "endpoint.h"
+
+class PeerTable;
+class ChunkStore;
+class PartialFiles;
+namespace NetIo { class Reader; }
+namespace Udp { class Sender; }
 
 class SeedServer {
 public:
@@ -11,18 +22,37 @@ public:
     bool start(int port, int boundListenFd);
     void stop();
 
+    void setPeerTable(PeerTable* peers) { peers_ = peers; }
+    void setChunkStore(ChunkStore* store) { store_ = store; }
+    // serve chunks of downloads still in progress
+    void setPartialFiles(PartialFiles* partials) { partials_ = partials; }
+
 private:
     void serveLoop(int port, int listenFd);
-    bool handleMeta(int clientFd, int port, const char* filename);
+    bool handleMeta(int clientFd, int port, const char* filename, bool inlineOk);
     bool handleGet(int clientFd, int port, const char* line);
 
     long long getFileSizeBytes(const char* path);
     bool handleList(int clientFd, int port);
+    bool handlePeers(int clientFd, const char* line);
+    bool handleHashes(int clientFd, const char* filename);
+    bool handleDelta(NetIo::Reader& in, int clientFd, int port, const char* line);
+    bool handleHave(int clientFd, int port, const char* filename);
+    bool handleUdpGet(int clientFd, int port, const char* args, Udp::Sender& udp);
+    bool handleChain(int clientFd, int port, const char* args);
+    bool handleBundle(NetIo::Reader& in, int clientFd, int port, const char* args);
     void handleClient(int clientFd, int port);
 
     std::atomic<bool> running_;
     std::thread thread_;
     int chunkSize_;
     int listenFd_;
+    PeerTable* peers_;
+    ChunkStore* store_;
+    PartialFiles* partials_;
+
+    // relay chains we head: members of each file in order of joining
+    std::mutex chainsMu_;
+    std::map<std::string, std::vector<Endpoint> > chains_;
 };
 #endif
\ No newline at end of file
@@ -10,7 +10,7 @@ public:
 
     int  create();
     int  bind_listen();
-    int  accept(struct sockaddr_in& addr, socklen_t& addrlen);
+    int  accept(struct sockaddr_storage& addr, socklen_t& addrlen);   // either family
     int  fd() const { return server_fd_; }
     void close_fd(int fd);
     ssize_t read(int sock, void* buf, size_t len);
@@ -0,0 +1,29 @@
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Plain SHA-256 (FIPS 180-4), used to name chunks in the chunk store.
+class Sha256 {
+public:
+    Sha256();
+
+    void update(const void* data, size_t len);
+    void final(unsigned char out[32]);
+    std::string finalHex();
+
+    // hex digest of one buffer
+    static std::string hex(const void* data, size_t len);
+
+private:
+    void block(const unsigned char* p);
+
+    uint32_t h_[8];
+    unsigned char buf_[64];
+    size_t used_;
+    uint64_t total_;
+};
+
+#endif
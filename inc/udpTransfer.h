@@ -0,0 +1,154 @@
+#ifndef __UDPTRANSFER_H__
+#define __UDPTRANSFER_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+
+#include "endpoint.h"
+#include "bufferPool.h"
+
+// Bulk chunk transfer over UDP, negotiated on the TCP control connection:
+//
+//   > UDPGET <first> <count> <udpPort> <file>
+//   < <UDP> <serverUdpPort> <token> <packets> <bytes>
+//     ... DATA datagrams server -> client, ACKs (cumulative + SACK) back ...
+//   < <UDP_DONE> <sent> <resent>          (or <UDP_FAILED>)
+//
+// Chunks [first, first + count) go out as one byte range cut into packets.
+// The sender paces them and sizes its window from queuing delay (LEDBAT
+// style), so it backs off before the queue overflows rather than after.
+//
+// SEED_UDP_LOSS=<percent> and SEED_UDP_DELAY_MS=<ms> drop/delay datagrams we
+// send, to try all this on loopback (or use tc netem).
+namespace Udp {
+
+static const size_t PAYLOAD = 1200;       // stays under any sane MTU
+static const int    IDLE_TIMEOUT_MS = 5000;
+
+// Datagrams we send, through the loss/delay shim
+class Link {
+public:
+    explicit Link(int fd = -1) : fd_(fd) {}
+    void reset(int fd);
+
+    void send(const void* data, size_t len);
+    void flush();                          // delayed datagrams that are due
+    long long nextDueUs() const;           // -1 = nothing queued
+
+private:
+    struct Held {
+        long long dueUs;
+        std::string bytes;
+    };
+    void put(const void* data, size_t len);
+
+    int fd_;
+    std::deque<Held> held_;
+};
+
+// Server side: one per control connection, so the congestion state carries
+// over from one range to the next.
+class Sender {
+public:
+    Sender();
+    ~Sender();
+
+    // UDP socket next to the control connection, aimed at the client's port
+    bool open(int ctlFd, int clientUdpPort);
+    int  port() const { return port_; }
+
+    // Push bytes [offset, offset + bytes) of fd. Returns once everything was
+    // acknowledged, or false if the client went quiet or closed ctlFd.
+    bool send(int ctlFd, int fileFd, long long offset, long long bytes, uint32_t token);
+
+    long long sent() const   { return sent_; }
+    long long resent() const { return resent_; }
+
+private:
+    Sender(const Sender&) = delete;
+    Sender& operator=(const Sender&) = delete;
+
+    void onRtt(double ms);
+
+    int fd_;
+    int port_;
+    Link link_;
+
+    // congestion state (packets / ms)
+    double cwnd_;
+    double ssthresh_;
+    double srtt_;
+    double rttvar_;
+    double rto_;
+    double lastRtt_;
+    double baseRtt_;        // min over this and the previous interval
+    double curMin_;
+    double prevMin_;
+    long long minResetUs_;
+
+    long long sent_;
+    long long resent_;
+};
+
+// Client side of one range, driven from outside so nothing here blocks:
+// prepare() the socket and send its request on the control connection,
+// start() with the reply line, pump() whenever the socket is readable, and
+// once done() reack() until the server's closing line is in.
+class Receiver {
+public:
+    Receiver();
+    ~Receiver();
+
+    // results: 0 = ok, 2 = no such file, 3 = bad range, 5 = peer can't do
+    // UDP, 6 = no buffer for the range right now (nothing sent, GET it),
+    // 1 = anything else (control connection unusable)
+    int prepare(int ctlFd, const Endpoint& peer, const std::string& filename,
+                long long first, int count, int chunkSize, std::string& request);
+    int start(const std::string& reply);
+
+    // read what arrived, ack it, hand over each chunk as it completes
+    // (index relative to first). false = failed (timed out)
+    bool pump(const std::function<bool(int, const char*, size_t)>& onChunk);
+
+    bool done() const  { return packets_ > 0 && cum_ == packets_; }
+    void reack();
+    void close();
+
+    int fd() const { return fd_; }
+    long long first() const { return first_; }
+    int count() const { return count_; }
+    // when pump() wants to run even if nothing arrives (timeouts, delayed acks)
+    long long wakeUs() const;
+    // when reack() has held-back datagrams to send, -1 = none
+    long long sendDueUs() const { return link_.nextDueUs(); }
+
+private:
+    Receiver(const Receiver&) = delete;
+    Receiver& operator=(const Receiver&) = delete;
+
+    void ack(uint64_t echoUs);
+
+    int fd_;
+    Link link_;
+    Endpoint peer_;
+    uint32_t token_;
+    long long first_;
+    int count_;
+    int chunkSize_;
+    uint32_t packets_;
+    long long bytes_;
+
+    BufferPool::Buffer data_;         // the whole range, taken at prepare()
+    std::vector<unsigned char> have_;
+    std::vector<int> missing_;        // per chunk: packets still to come
+    uint32_t cum_;                    // every packet below this is here
+    uint32_t highest_;
+    long long lastUs_;
+};
+
+} // namespace Udp
+
+#endif
@@ -0,0 +1,587 @@
+#include "../inc/asyncIo.h"
+#include "../inc/clientsocket.h"
+#include "../inc/connectionPool.h"
+#include "../inc/peerHealth.h"
+#include "../inc/logger2.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <memory>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+namespace Async {
+
+static const int REACTOR_THREADS = 2;
+static const int MAX_SLEEP_MS    = 100;    // timers fire at most this late
+static const size_t READ_CHUNK   = 16 * 1024;
+static const size_t DIRECT_READ_MIN = 4 * 1024; // readExact tails this big skip buf_
+static const int OFFLOAD_THREADS = 32;     // blocking calls in progress at once
+static const int OFFLOAD_IDLE_MS = 10000;  // an offload thread with nothing to do goes away
+
+Reactor& Reactor::instance() {
+    static Reactor reactor;
+    return reactor;
+}
+
+Reactor::Reactor() : epfd_(::epoll_create1(EPOLL_CLOEXEC)), nextId_(0), stopping_(false) {
+    if (epfd_ < 0) {
+        logErr("Reactor: epoll_create1 failed: %s", strerror(errno));
+        return;
+    }
+    for (int i = 0; i < REACTOR_THREADS; ++i) threads_.push_back(std::thread(&Reactor::loop, this));
+}
+
+Reactor::~Reactor() {
+    stopping_.store(true);
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (threads_[i].joinable()) threads_[i].join();
+    }
+    if (epfd_ >= 0) ::close(epfd_);
+}
+
+// Registered under the lock, so an event can't be handled before we are in
+// the table; after unlocking we must not touch *this, it may already be resumed.
+bool Reactor::Ready::await_suspend(std::coroutine_handle<> h) {
+    h_ = h;
+    std::lock_guard<std::mutex> lock(r_.mu_);
+    const uint64_t id = ++r_.nextId_;
+
+    epoll_event ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.events = events_ | EPOLLONESHOT;
+    ev.data.u64 = id;
+    if (r_.epfd_ < 0 || ::epoll_ctl(r_.epfd_, EPOLL_CTL_ADD, fd_, &ev) != 0) {
+        // can't watch it: give up like a timeout instead of spinning
+        timedOut_ = true;
+        return false;
+    }
+
+    Waiting wt;
+    wt.w = this;
+    wt.timer = r_.timers_.insert(std::make_pair(deadline_, id));
+    r_.waiting_[id] = wt;
+    return true;
+}
+
+void Reactor::loop() {
+    epoll_event evs[64];
+    while (!stopping_.load()) {
+        int sleepMs = MAX_SLEEP_MS;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            if (!timers_.empty()) {
+                const long long left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    timers_.begin()->first - std::chrono::steady_clock::now()).count();
+                sleepMs = (int)std::max(0LL, std::min((long long)MAX_SLEEP_MS, left));
+            }
+        }
+
+        const int n = ::epoll_wait(epfd_, evs, 64, sleepMs);
+        if (n < 0 && errno != EINTR) {
+            logErr("Reactor: epoll_wait failed: %s", strerror(errno));
+            return;
+        }
+
+        std::vector<std::coroutine_handle<> > wake;
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            for (int i = 0; i < n; ++i) {
+                // a stale id (it timed out meanwhile) is simply gone
+                std::map<uint64_t, Waiting>::iterator it = waiting_.find(evs[i].data.u64);
+                if (it == waiting_.end()) continue;
+                ::epoll_ctl(epfd_, EPOLL_CTL_DEL, it->second.w->fd_, nullptr);
+                timers_.erase(it->second.timer);
+                wake.push_back(it->second.w->h_);
+                waiting_.erase(it);
+            }
+
+            const Deadline now = std::chrono::steady_clock::now();
+            while (!timers_.empty() && timers_.begin()->first <= now) {
+                std::map<uint64_t, Waiting>::iterator it = waiting_.find(timers_.begin()->second);
+                timers_.erase(timers_.begin());
+                if (it == waiting_.end()) continue;
+                ::epoll_ctl(epfd_, EPOLL_CTL_DEL, it->second.w->fd_, nullptr);
+                it->second.w->timedOut_ = true;
+                wake.push_back(it->second.w->h_);
+                waiting_.erase(it);
+            }
+        }
+
+        for (size_t i = 0; i < wake.size(); ++i) wake[i].resume();
+    }
+}
+
+static thread_local Home* currentHome = nullptr;
+
+Home::Home() : finished_(false), outer_(currentHome) {
+    currentHome = this;
+}
+
+Home::~Home() {
+    currentHome = outer_;
+}
+
+Home* Home::current() {
+    return currentHome;
+}
+
+void Home::post(std::coroutine_handle<> h) {
+    std::lock_guard<std::mutex> lock(mu_);
+    queue_.push_back(h);
+    cv_.notify_all();
+}
+
+void Home::finish() {
+    std::lock_guard<std::mutex> lock(mu_);
+    finished_ = true;
+    cv_.notify_all();
+}
+
+void Home::run() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (true) {
+        cv_.wait(lock, [this]() { return finished_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        std::coroutine_handle<> h = queue_.front();
+        queue_.pop_front();
+        lock.unlock();
+        h.resume();
+        lock.lock();
+    }
+}
+
+// Threads for offload(): started as needed, gone again after a while idle
+struct Offloader {
+    std::mutex mu;
+    std::condition_variable cv;
+    std::deque<std::function<void()> > queue;
+    int threads = 0;
+    int idle = 0;
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mu);
+        while (true) {
+            ++idle;
+            const bool got = cv.wait_for(lock, std::chrono::milliseconds(OFFLOAD_IDLE_MS),
+                                         [this]() { return !queue.empty(); });
+            --idle;
+            if (!got) {
+                --threads;
+                return;
+            }
+            std::function<void()> fn = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            fn();
+            lock.lock();
+        }
+    }
+};
+
+void offload(std::function<void()> fn) {
+    // never destroyed: detached workers may still be finishing at exit
+    static Offloader* off = new Offloader();
+    std::lock_guard<std::mutex> lock(off->mu);
+    off->queue.push_back(std::move(fn));
+    if (off->idle < (int)off->queue.size() && off->threads < OFFLOAD_THREADS) {
+        ++off->threads;
+        std::thread(&Offloader::work, off).detach();
+    }
+    off->cv.notify_one();
+}
+
+// Counted down by every task that finishes, plus once by await_suspend() when
+// it has started them all, so whoever comes last resumes the awaiter
+struct AllDone {
+    std::vector<Task<void> >& tasks;
+    std::atomic<size_t> left{0};
+    std::coroutine_handle<> h;
+    Home* home = nullptr;
+
+    explicit AllDone(std::vector<Task<void> >& t) : tasks(t) {}
+
+    void one() {
+        if (left.fetch_sub(1) != 1) return;
+        if (home) home->post(h);
+        else h.resume();
+    }
+
+    bool await_ready() const noexcept { return tasks.empty(); }
+    bool await_suspend(std::coroutine_handle<> c) {
+        h = c;
+        home = Home::current();
+        left.store(tasks.size() + 1);
+        for (size_t i = 0; i < tasks.size(); ++i) start(std::move(tasks[i]), [this]() { one(); });
+        // all done already: carry on right here
+        return left.fetch_sub(1) != 1;
+    }
+    void await_resume() noexcept {}
+};
+
+Task<void> whenAll(std::vector<Task<void> > tasks) {
+    AllDone all(tasks);
+    co_await all;
+}
+
+Conn::Conn(int fd, int timeoutMs) : fd_(fd), timeoutMs_(timeoutMs), pos_(0), end_(0), broken_(false) {}
+
+Deadline Conn::deadline() const {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs_);
+}
+
+// Space for n more bytes past end_: what's parsed goes, the rest moves to
+// the front, and a line longer than the buffer gets a bigger one
+bool Conn::room(size_t n) {
+    if (pos_ == end_) pos_ = end_ = 0;
+    const size_t left = end_ - pos_;
+    if (buf_ && buf_.size() - end_ >= n) return true;
+    if (buf_ && buf_.size() >= left + n) {
+        std::memmove(buf_.data(), buf_.data() + pos_, left);
+    } else {
+        BufferPool::Buffer bigger = BufferPool::instance().get(std::max(READ_CHUNK, (left + n) * 2),
+                                                               BufferPool::DOWNLOAD);
+        if (!bigger) return false;
+        if (left > 0) std::memcpy(bigger.data(), buf_.data() + pos_, left);
+        buf_ = std::move(bigger);
+    }
+    pos_ = 0;
+    end_ = left;
+    return true;
+}
+
+void Conn::unread(const std::string& bytes) {
+    if (bytes.empty()) return;
+    if (!room(bytes.size())) {
+        logWarn("async: no buffer for %zu bytes already read off fd %d", bytes.size(), fd_);
+        pos_ = end_ = 0;
+        broken_ = true;
+        return;
+    }
+    std::memmove(buf_.data() + pos_ + bytes.size(), buf_.data() + pos_, end_ - pos_);
+    std::memcpy(buf_.data() + pos_, bytes.data(), bytes.size());
+    end_ += bytes.size();
+}
+
+Task<bool> Conn::fill() {
+    if (broken_ || !room(READ_CHUNK / 4)) co_return false;
+    const Deadline until = deadline();
+    while (true) {
+        const ssize_t n = ::recv(fd_, buf_.data() + end_, buf_.size() - end_, MSG_DONTWAIT);
+        if (n > 0) {
+            end_ += (size_t)n;
+            co_return true;
+        }
+        if (n == 0) co_return false;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+        const bool ready = co_await Reactor::instance().ready(fd_, EPOLLIN, until);
+        if (!ready) co_return false;
+    }
+}
+
+Task<bool> Conn::sendAll(std::string data) {
+    const Deadline until = deadline();
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t n = ::send(fd_, data.data() + sent, data.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+        const bool ready = co_await Reactor::instance().ready(fd_, EPOLLOUT, until);
+        if (!ready) co_return false;
+    }
+    co_return true;
+}
+
+Task<bool> Conn::readLine(std::string& line) {
+    while (true) {
+        const char* at = pos_ < end_ ? (const char*)std::memchr(buf_.data() + pos_, '\n', end_ - pos_) : nullptr;
+        if (at) {
+            const size_t nl = (size_t)(at - buf_.data());
+            line.assign(buf_.data() + pos_, nl - pos_);
+            pos_ = nl + 1;
+            while (!line.empty() && line.back() == '\r') line.pop_back();
+            co_return true;
+        }
+        const bool more = co_await fill();
+        if (!more) co_return false;
+    }
+}
+
+// What's read ahead is copied out, a big enough rest comes straight off the
+// socket into out. A small one goes through buf_, which picks up the
+// replies behind it in the same recv
+Task<bool> Conn::readExact(char* out, size_t n) {
+    if (broken_) co_return false;
+    const size_t take = std::min(n, end_ - pos_);
+    if (take > 0) std::memcpy(out, buf_.data() + pos_, take);
+    pos_ += take;
+    size_t got = take;
+
+    const Deadline until = deadline();
+    while (n - got >= DIRECT_READ_MIN) {
+        const ssize_t m = ::recv(fd_, out + got, n - got, MSG_DONTWAIT);
+        if (m > 0) {
+            got += (size_t)m;
+            continue;
+        }
+        if (m == 0) co_return false;
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+        const bool ready = co_await Reactor::instance().ready(fd_, EPOLLIN, until);
+        if (!ready) co_return false;
+    }
+
+    while (got < n) {
+        if (pos_ == end_) {
+            const bool more = co_await fill();
+            if (!more) co_return false;
+        }
+        const size_t part = std::min(n - got, end_ - pos_);
+        std::memcpy(out + got, buf_.data() + pos_, part);
+        pos_ += part;
+        got += part;
+    }
+    co_return true;
+}
+
+Task<bool> Conn::spliceExact(int pipeWr, size_t n) {
+    const Deadline until = deadline();
+    size_t got = 0;
+
+    if (broken_) co_return false;
+    if (pos_ < end_) {
+        const size_t take = std::min(n, end_ - pos_);
+        while (got < take) {
+            const ssize_t w = ::write(pipeWr, buf_.data() + pos_ + got, take - got);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) co_return false;
+            got += (size_t)w;
+        }
+        pos_ += take;
+    }
+
+    while (got < n) {
+        // splice off a TCP socket sleeps for data whatever the flags say, so
+        // wait here and only ask for what has arrived
+        int avail = 0;
+        if (::ioctl(fd_, FIONREAD, &avail) != 0) co_return false;
+        if (avail <= 0) {
+            const bool ready = co_await Reactor::instance().ready(fd_, EPOLLIN, until);
+            if (!ready) co_return false;
+            if (::ioctl(fd_, FIONREAD, &avail) != 0) co_return false;
+            if (avail <= 0) avail = 1;   // readable and empty: EOF, splice says so
+        }
+
+        const size_t want = std::min(n - got, (size_t)avail);
+        const ssize_t m = ::splice(fd_, nullptr, pipeWr, nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (m > 0) {
+            got += (size_t)m;
+            continue;
+        }
+        if (m < 0 && errno == EINTR) continue;
+        co_return false;
+    }
+    co_return true;
+}
+
+Task<int> connectTo(Endpoint peer, int timeoutMs) {
+    sockaddr_storage addr;
+    socklen_t addrLen = 0;
+    if (!peer.toSockaddr(addr, addrLen)) co_return -1;
+    if (!PeerHealth::instance().allow(peer)) co_return -1;
+
+    const int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) co_return -1;
+
+    if (::connect(fd, (sockaddr*)&addr, addrLen) != 0) {
+        const Deadline until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        int err = errno;
+        if (err == EINPROGRESS) {
+            err = ETIMEDOUT;
+            const bool ready = co_await Reactor::instance().ready(fd, EPOLLOUT, until);
+            if (ready) {
+                socklen_t len = sizeof(err);
+                if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) err = errno;
+            }
+        }
+        if (err != 0) {
+            ::close(fd);
+            PeerHealth::instance().failure(peer);
+            co_return -1;
+        }
+    }
+    // connected says little: whoever asks something reports how it went
+    co_return fd;
+}
+
+Lease::Lease() {}
+
+Lease::~Lease() {
+    done(false);
+}
+
+Task<bool> Lease::open(Endpoint peer) {
+    done(false);
+    peer_ = peer;
+
+    cs_ = ConnectionPool::instance().idle(peer);
+    leased_ = cs_ != nullptr;
+    if (!cs_) {
+        const int fd = co_await connectTo(peer);
+        if (fd < 0) co_return false;
+        cs_.reset(new clientSocket());
+        if (!cs_->adopt(fd)) {
+            ::close(fd);
+            cs_.reset();
+            co_return false;
+        }
+    }
+    conn_ = Conn(cs_->fd());
+    conn_.unread(cs_->takeBuffered());
+    co_return true;
+}
+
+void Lease::done(bool clean) {
+    if (!cs_) return;
+    clean = clean && conn_.drained();
+    if (leased_) ConnectionPool::instance().release(peer_, std::move(cs_), clean);
+    else if (clean) ConnectionPool::instance().adopt(peer_, std::move(cs_));
+    cs_.reset();
+    conn_ = Conn();
+}
+
+long long metaReply(const std::string& line) {
+    long long size = -1;
+    if (std::sscanf(line.c_str(), "<META> %lld", &size) == 1 && size >= 0) return size;
+    if (line == "<FILE_NOT_FOUND>" || line == "<BAD_REQUEST>") return -1;
+    return -2;
+}
+
+Task<long long> meta(Conn& conn, std::string filename) {
+    std::string line;
+    bool ok = co_await conn.sendAll("META " + filename + "\n");
+    if (ok) ok = co_await conn.readLine(line);
+    co_return ok ? metaReply(line) : -2;
+}
+
+Task<long long> metaPlus(Conn& conn, std::string filename, long long maxInline,
+                         std::string& data, bool& inlined)
+{
+    inlined = false;
+    std::string line;
+    bool ok = co_await conn.sendAll("META+ " + filename + "\n");
+    if (ok) ok = co_await conn.readLine(line);
+    if (!ok) co_return -2;
+
+    long long size = -1;
+    if (std::sscanf(line.c_str(), "<META> %lld", &size) == 1 && size >= 0) co_return size;
+    if (line == "<FILE_NOT_FOUND>") co_return -1;
+    if (line == "<BAD_REQUEST>") co_return -3;
+    if (std::sscanf(line.c_str(), "<INLINE> %lld", &size) != 1 || size < 0 || size > maxInline) co_return -2;
+
+    data.resize((size_t)size);
+    if (size > 0) {
+        const bool got = co_await conn.readExact(&data[0], (size_t)size);
+        if (!got) co_return -2;
+    }
+    inlined = true;
+    co_return size;
+}
+
+Task<Listing> list(Conn& conn) {
+    Listing out;
+    std::string line;
+    bool ok = co_await conn.sendAll("LIST\n");
+    if (ok) ok = co_await conn.readLine(line);
+    if (!ok || line != "<LIST>") co_return out;
+
+    while (true) {
+        const bool more = co_await conn.readLine(line);
+        if (!more) break;
+        if (line == "<END>") {
+            out.ok = true;
+            break;
+        }
+        if (line.compare(0, 5, "FILE ") == 0 && line.size() > 5) out.files.push_back(line.substr(5));
+    }
+    co_return out;
+}
+
+Task<RangeResult> range(Conn& conn, std::string filename, long long first, int count, int chunkSize,
+                        char* into, std::function<bool(long long, const char*, size_t)> onChunk, SpliceTo splice)
+{
+    RangeResult res;
+    res.code = 1;
+
+    // all requests go out in one write, the replies come back in order
+    std::string req;
+    char row[64];
+    for (int i = 0; i < count; ++i) {
+        std::snprintf(row, sizeof(row), " %lld\n", first + i);
+        req += "GET " + filename + row;
+    }
+    const bool sent = co_await conn.sendAll(req);
+    if (!sent) co_return res;
+
+    std::string head;
+    for (int i = 0; i < count; ++i) {
+        const bool gotHead = co_await conn.readLine(head);
+        if (!gotHead) co_return res;
+
+        if (head == "<FILE_NOT_FOUND>") { res.code = 2; co_return res; }
+        if (head == "<RANGE_ERROR>" || head == "<BAD_REQUEST>") { res.code = 3; co_return res; }
+        if (head == "<NOT_HAVE>") { res.code = 4; co_return res; }
+        if (head == "<BUSY>") {
+            // out of buffers over there, nothing broken: the rest of the run
+            // still gets answered, read past it and the conn can go again
+            for (int j = i + 1; j < count; ++j) {
+                const bool gotRest = co_await conn.readLine(head);
+                if (!gotRest) co_return res;
+                long long idx = -1;
+                int n = -1;
+                if (std::sscanf(head.c_str(), "<CHUNK> %lld %d", &idx, &n) != 2 || n == 0) continue;
+                if (n < 0 || n > chunkSize) co_return res;
+                const bool skipped = co_await conn.readExact(into + (size_t)j * (size_t)chunkSize, (size_t)n);
+                if (!skipped) co_return res;
+            }
+            res.code = 5;
+            co_return res;
+        }
+
+        long long idx = -1;
+        int n = -1;
+        if (std::sscanf(head.c_str(), "<CHUNK> %lld %d", &idx, &n) != 2) co_return res;
+        if (idx != first + i || n < 0 || n > chunkSize) { res.code = 3; co_return res; }
+        if (splice.pipeWr >= 0 && n > 0 && (size_t)n >= splice.minBytes) {
+            const bool moved = co_await conn.spliceExact(splice.pipeWr, (size_t)n);
+            if (!moved) co_return res;
+            ++res.received;
+            if (onChunk && !onChunk(idx, nullptr, (size_t)n)) break;
+            continue;
+        }
+        char* data = into + (size_t)i * (size_t)chunkSize;
+        if (n > 0) {
+            const bool gotData = co_await conn.readExact(data, (size_t)n);
+            if (!gotData) co_return res;
+        }
+
+        ++res.received;
+        if (onChunk && !onChunk(idx, data, (size_t)n)) break;
+    }
+    res.code = 0;
+    co_return res;
+}
+
+} // namespace Async
@@ -0,0 +1,269 @@
+#include "../inc/bufferPool.h"
+#include "../inc/logger2.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <sys/mman.h>
+
+// per thread and class: small buffers are cheap to keep a few of, the big
+// ones aren't
+static const size_t CACHE_SMALL = 64 * 1024;
+static const size_t CACHE_SMALL_SLOTS = 8;
+// trim() only reaches the calling thread's cache: all the others together
+// keep at most 1/CACHE_SHARE of the cap, and nothing once held is that close
+// to it
+static const long long CACHE_SHARE = 8;
+
+struct BufferPool::ThreadCache {
+    std::vector<char*> bufs[CLASSES];
+
+    // the thread is done: what it kept goes to the shared lists
+    ~ThreadCache() {
+        BufferPool& pool = BufferPool::instance();
+        for (int c = 0; c < CLASSES; ++c) {
+            if (bufs[c].empty()) continue;
+            pool.cached_.fetch_sub((long long)(bufs[c].size() * classBytes(c)));
+            std::lock_guard<std::mutex> lock(pool.free_[c].mu);
+            pool.free_[c].bufs.insert(pool.free_[c].bufs.end(), bufs[c].begin(), bufs[c].end());
+        }
+    }
+};
+
+// never destroyed: threads still serving at exit may hand buffers back late
+BufferPool& BufferPool::instance() {
+    static BufferPool* pool = new BufferPool();
+    return *pool;
+}
+
+BufferPool::ThreadCache& BufferPool::cache() {
+    static thread_local ThreadCache tc;
+    return tc;
+}
+
+const char* BufferPool::name(Owner who) {
+    switch (who) {
+    case SERVER:   return "server";
+    case DOWNLOAD: return "download";
+    case DISK:     return "disk";
+    case DELTA:    return "delta";
+    default:       return "?";
+    }
+}
+
+int BufferPool::classOf(size_t bytes) {
+    for (int c = 0; c < CLASSES; ++c) {
+        if (bytes <= classBytes(c)) return c;
+    }
+    return CLASSES;
+}
+
+size_t BufferPool::bytesOf(int cls, size_t n) {
+    if (cls < CLASSES) return classBytes(cls);
+    return (n + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;   // too big to pool, whole huge pages
+}
+
+size_t BufferPool::cacheSlots(int cls) {
+    return classBytes(cls) <= CACHE_SMALL ? CACHE_SMALL_SLOTS : 1;
+}
+
+char* BufferPool::popFree(int cls) {
+    std::vector<char*>& mine = cache().bufs[cls];
+    if (!mine.empty()) {
+        char* p = mine.back();
+        mine.pop_back();
+        cached_.fetch_sub((long long)classBytes(cls));
+        return p;
+    }
+    std::lock_guard<std::mutex> lock(free_[cls].mu);
+    if (free_[cls].bufs.empty()) return nullptr;
+    char* p = free_[cls].bufs.back();
+    free_[cls].bufs.pop_back();
+    return p;
+}
+
+char* BufferPool::fresh(size_t bytes) {
+    if (bytes < HUGE_PAGE) {
+        void* p = nullptr;
+        return ::posix_memalign(&p, PAGE, bytes) == 0 ? (char*)p : nullptr;
+    }
+
+    void* p = MAP_FAILED;
+    if (huge_.load()) {
+        p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+        p = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return nullptr;
+        // no huge pages set aside: let the kernel back it with them if it can
+        if (huge_.load()) ::madvise(p, bytes, MADV_HUGEPAGE);
+    }
+    return (char*)p;
+}
+
+void BufferPool::dispose(char* p, size_t bytes) {
+    if (bytes < HUGE_PAGE) ::free(p);
+    else ::munmap(p, bytes);
+}
+
+bool BufferPool::reserve(size_t bytes) {
+    long long cur = held_.load();
+    while (true) {
+        const long long limit = cap_.load();
+        if (limit > 0 && cur + (long long)bytes > limit) return false;
+        if (held_.compare_exchange_weak(cur, cur + (long long)bytes)) return true;
+    }
+}
+
+// Room in this thread's cache for one more of cls: nobody waits, held isn't
+// near the cap and the caches together stay under their share of it
+bool BufferPool::keepLocal(int cls) {
+    if (cache().bufs[cls].size() >= cacheSlots(cls) || waiters_.load() > 0) return false;
+
+    const long long size = (long long)classBytes(cls);
+    const long long limit = cap_.load();
+    if (limit <= 0) {
+        cached_.fetch_add(size);
+        return true;
+    }
+    if (held_.load() > limit - limit / CACHE_SHARE) return false;
+    if (cached_.fetch_add(size) + size <= limit / CACHE_SHARE) return true;
+    cached_.fetch_sub(size);
+    return false;
+}
+
+void BufferPool::trim() {
+    ThreadCache& tc = cache();
+    for (int c = 0; c < CLASSES; ++c) {
+        std::vector<char*> drop;
+        drop.swap(tc.bufs[c]);
+        cached_.fetch_sub((long long)(drop.size() * classBytes(c)));
+        {
+            std::lock_guard<std::mutex> lock(free_[c].mu);
+            drop.insert(drop.end(), free_[c].bufs.begin(), free_[c].bufs.end());
+            free_[c].bufs.clear();
+        }
+        for (size_t i = 0; i < drop.size(); ++i) dispose(drop[i], classBytes(c));
+        held_.fetch_sub((long long)(drop.size() * classBytes(c)));
+    }
+}
+
+void BufferPool::setCap(long long bytes) {
+    cap_.store(bytes < 0 ? 0 : bytes);
+    std::lock_guard<std::mutex> lock(waitMu_);
+    waitCv_.notify_all();
+}
+
+BufferPool::Buffer BufferPool::get(size_t bytes, Owner who, int waitMs) {
+    if (bytes == 0) bytes = 1;
+    const int cls = classOf(bytes);
+    const size_t size = bytesOf(cls, bytes);
+    Counters& c = counters_[who];
+    c.gets.fetch_add(1, std::memory_order_relaxed);
+
+    char* p = cls < CLASSES ? popFree(cls) : nullptr;
+    if (!p) {
+        const std::chrono::steady_clock::time_point until =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMs);
+        bool room = reserve(size);
+        if (!room) {
+            // past the cap: take what somebody hands back, or free what sits
+            // unused in the lists, until waitMs is up. Counted as waiting
+            // before looking, so a put() in between can't be missed
+            std::unique_lock<std::mutex> lock(waitMu_);
+            waiters_.fetch_add(1);
+            bool late = false;
+            while (!(cls < CLASSES && (p = popFree(cls)) != nullptr)) {
+                trim();
+                if ((room = reserve(size)) || late) break;
+                late = waitCv_.wait_until(lock, until) == std::cv_status::timeout;
+            }
+            waiters_.fetch_sub(1);
+        }
+        if (!p && !room) {
+            c.denied.fetch_add(1, std::memory_order_relaxed);
+            logDbg("BufferPool: %zu bytes for %s would pass the %lld byte cap (%lld held)",
+                    size, name(who), cap_.load(), held_.load());
+            return Buffer();
+        }
+        if (!p) {
+            p = fresh(size);
+            if (!p) {
+                held_.fetch_sub((long long)size);
+                c.denied.fetch_add(1, std::memory_order_relaxed);
+                logErr("BufferPool: out of memory for %zu bytes (%s)", size, name(who));
+                return Buffer();
+            }
+            c.fresh.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    const long long now = c.inUse.fetch_add((long long)size, std::memory_order_relaxed) + (long long)size;
+    long long peak = c.peak.load(std::memory_order_relaxed);
+    while (now > peak && !c.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+
+    Buffer b;
+    b.p_ = p;
+    b.n_ = bytes;
+    b.cls_ = cls;
+    b.owner_ = who;
+    return b;
+}
+
+void BufferPool::put(char* p, int cls, size_t n, Owner who) {
+    const size_t size = bytesOf(cls, n);
+    counters_[who].inUse.fetch_sub((long long)size, std::memory_order_relaxed);
+
+    if (cls >= CLASSES) {
+        dispose(p, size);
+        held_.fetch_sub((long long)size);
+    } else {
+        // share it where trim() and anyone waiting on the cap can get at it,
+        // unless this thread may keep it
+        if (keepLocal(cls)) {
+            cache().bufs[cls].push_back(p);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(free_[cls].mu);
+        free_[cls].bufs.push_back(p);
+    }
+
+    if (waiters_.load() > 0) {
+        std::lock_guard<std::mutex> lock(waitMu_);
+        waitCv_.notify_all();
+    }
+}
+
+BufferPool::Usage BufferPool::usage(Owner who) const {
+    const Counters& c = counters_[who];
+    Usage u;
+    u.inUse = c.inUse.load();
+    u.peak = c.peak.load();
+    u.gets = c.gets.load();
+    u.fresh = c.fresh.load();
+    u.denied = c.denied.load();
+    return u;
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& o) noexcept {
+    if (this != &o) {
+        release();
+        take(o);
+    }
+    return *this;
+}
+
+void BufferPool::Buffer::take(Buffer& o) {
+    p_ = o.p_;
+    n_ = o.n_;
+    cls_ = o.cls_;
+    owner_ = o.owner_;
+    o.p_ = nullptr;
+    o.n_ = 0;
+}
+
+void BufferPool::Buffer::release() {
+    if (!p_) return;
+    BufferPool::instance().put(p_, cls_, n_, owner_);
+    p_ = nullptr;
+    n_ = 0;
+}
@@ -1,16 +1,43 @@
 #include "../inc/chunkDownloader.h"
 #include "../inc/clientsocket.h"
+#include "../inc/connectionPool.h"
+#include "../inc/peerHealth.h"
+#include "../inc/downloadScheduler.h"
+#include "../inc/asyncIo.h"
+#include "../inc/rateLimiter.h"
+#include "../inc/chunkStore.h"
+#include "../inc/partialFiles.h"
+#include "../inc/chunkSet.h"
+#include "../inc/deltaSync.h"
+#include "../inc/sha256.h"
+#include "../inc/udpTransfer.h"
+#include "../inc/downloadSink.h"
+#include "../inc/bufferPool.h"
 #include "../inc/logger2.h"
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
 
 #include <string>
 #include <vector>
 #include <thread>
 #include <chrono>
 #include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
 
 static inline void stripCRLF(char* s) {
     if (!s) return;
@@ -27,8 +54,124 @@ static inline bool startsWith(const char* s, const char* prefix) {
     return std::strncmp(s, prefix, n) == 0;
 }
 
+static const long long INLINE_MAX = 64 * 1024;  // seeders send files up to this whole (META+, BUNDLE)
+static const size_t BUNDLE_FILES = 256;         // names per BUNDLE request
+static const size_t DISK_BUF = 64 * 1024;       // merges and stream copies go this much at a time
+static const int DISK_BUF_WAIT_MS = 5000;       // ... and wait this long for it at the pool's cap
+static const int BUFFER_RETRY_MS = 20;          // a lane without a buffer looks again after this
+static const long long PIPELINE_BYTES = 256 * 1024; // a lane keeps up to this much asked for at once ...
+static const int PIPELINE_MAX = 16;             // ... in at most this many GETs
+
+DownloadProgress::~DownloadProgress() {
+    SlotBlock* b = slots_.next.load();
+    while (b) {
+        SlotBlock* next = b->next.load();
+        delete b;
+        b = next;
+    }
+}
+
+ProgressSlot* DownloadProgress::slot(int worker, const Endpoint& seeder) {
+    for (SlotBlock* b = &slots_; b; ) {
+        for (int i = 0; i < MAX_SLOTS; ++i) {
+            ProgressSlot& s = b->slots[i];
+            int st = s.state.load(std::memory_order_acquire);
+            if (st == ProgressSlot::FREE &&
+                s.state.compare_exchange_strong(st, ProgressSlot::CLAIMING, std::memory_order_acquire)) {
+                s.worker = worker;
+                s.peer = seeder;
+                s.state.store(ProgressSlot::READY, std::memory_order_release);
+                return &s;
+            }
+            // one being claimed right now is somebody else's (a worker only
+            // ever claims its own), skip it
+            if (st == ProgressSlot::READY && s.worker == worker && s.peer == seeder) return &s;
+        }
+        SlotBlock* next = b->next.load(std::memory_order_acquire);
+        if (!next) {
+            SlotBlock* grown = new SlotBlock();
+            if (b->next.compare_exchange_strong(next, grown, std::memory_order_acq_rel)) next = grown;
+            else delete grown;
+        }
+        b = next;
+    }
+    return nullptr;
+}
+
+void DownloadProgress::put(int worker, const Endpoint& seeder, long long bytes, long long chunks, int errors) {
+    ProgressSlot* s = slot(worker, seeder);
+    s->add(bytes, chunks);
+    if (errors) s->errors.fetch_add(errors, std::memory_order_relaxed);
+}
+
+void DownloadProgress::set(int worker, const Endpoint& seeder, long long bytes, long long chunks, int errors) {
+    ProgressSlot* s = slot(worker, seeder);
+    s->bytes.store(bytes);
+    s->chunks.store(chunks);
+    s->errors.store(errors);
+}
+
+long long DownloadProgress::doneBytes() const {
+    long long sum = 0;
+    for (const SlotBlock* b = &slots_; b; b = b->next.load(std::memory_order_acquire)) {
+        for (int i = 0; i < MAX_SLOTS; ++i) sum += b->slots[i].bytes.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+long long DownloadProgress::doneChunks() const {
+    long long sum = 0;
+    for (const SlotBlock* b = &slots_; b; b = b->next.load(std::memory_order_acquire)) {
+        for (int i = 0; i < MAX_SLOTS; ++i) sum += b->slots[i].chunks.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::vector<SeederTally> DownloadProgress::bySeeder() const {
+    std::map<Endpoint, SeederTally> byPeer;
+    for (const SlotBlock* b = &slots_; b; b = b->next.load(std::memory_order_acquire)) {
+        for (int i = 0; i < MAX_SLOTS; ++i) {
+            const ProgressSlot& s = b->slots[i];
+            if (s.state.load(std::memory_order_acquire) != ProgressSlot::READY) continue;
+            SeederTally& row = byPeer[s.peer];
+            row.peer = s.peer;
+            row.bytes += s.bytes.load(std::memory_order_relaxed);
+            row.chunks += s.chunks.load(std::memory_order_relaxed);
+            row.errors += s.errors.load(std::memory_order_relaxed);
+        }
+    }
+    std::vector<SeederTally> out;
+    for (std::map<Endpoint, SeederTally>::const_iterator it = byPeer.begin(); it != byPeer.end(); ++it)
+        out.push_back(it->second);
+    return out;
+}
+
+void DownloadProgress::reset() {
+    totalBytes.store(0);
+    totalChunks.store(0);
+    readyBytes.store(0);
+    active.store(false);
+    pending.store(false);   
+    success.store(false);
+    failed.store(false);
+    SlotBlock* more = slots_.next.exchange(nullptr);
+    while (more) {
+        SlotBlock* next = more->next.load();
+        delete more;
+        more = next;
+    }
+    for (int i = 0; i < MAX_SLOTS; ++i) {
+        ProgressSlot& s = slots_.slots[i];
+        s.state.store(ProgressSlot::FREE);
+        s.bytes.store(0);
+        s.chunks.store(0);
+        s.errors.store(0);
+    }
+}
+
 ChunkDownloader::ChunkDownloader(int chunkSize, int startPort, int endPort)
-    : chunkSize_(chunkSize), startPort_(startPort), endPort_(endPort) {}
+    : chunkSize_(chunkSize), startPort_(startPort), endPort_(endPort), store_(nullptr),
+      partials_(nullptr) {}
 
 std::string ChunkDownloader::portDirectory(int port) const {
     char path[256];
@@ -36,96 +179,231 @@ std::string ChunkDownloader::portDirectory(int port) const {
     return std::string(path);
 }
 
-bool ChunkDownloader::fetchMeta(const std::string& filename, int seederPort, long long& outSize) {
-    outSize = -1;
+// META from one seeder on a leased connection, nothing blocks: size, -1 it
+// hasn't got it, -2 couldn't ask
+static Async::Task<void> askMeta(Endpoint seeder, std::string filename, long long& size) {
+    Async::Lease lease;
+    size = -2;
+    if (!(co_await lease.open(seeder))) co_return;
+    size = co_await Async::meta(lease.conn(), filename);
+    lease.done(size >= -1);
+}
+
+// META+: small files come back whole (inlined), no download needed. Older
+// seeders get plain META on the same connection
+static Async::Task<void> askMetaInline(Endpoint seeder, std::string filename,
+                                       long long& size, std::string& data, bool& inlined)
+{
+    Async::Lease lease;
+    size = -2;
+    inlined = false;
+    if (!(co_await lease.open(seeder))) co_return;
+    size = co_await Async::metaPlus(lease.conn(), filename, INLINE_MAX, data, inlined);
+    if (size == -3) size = co_await Async::meta(lease.conn(), filename);
+    lease.done(size >= -1);
+}
 
-    clientSocket cs;
-    if (!cs.connectServer("127.0.0.1", seederPort))
+bool ChunkDownloader::fetchHashes(const std::string& filename, const Endpoint& seeder, std::vector<CdcChunk>& out) {
+    out.clear();
+
+    PooledConnection conn;
+    if (!conn.open(seeder))
         return false;
 
-    const std::string req = "META " + filename + "\n";
-    if (!cs.sendData(req))
+    const std::string req = "HASHES " + filename + "\n";
+    if (!conn.sock().sendData(req)) {
+        conn.discard();
         return false;
+    }
 
     char line[256];
-    const int n = cs.receiveLine(line, sizeof(line));
-    if (n <= 0)
+    if (conn.sock().receiveLine(line, sizeof(line)) <= 0) {
+        conn.discard();
         return false;
-
+    }
     stripCRLF(line);
 
+    // older seeders don't know HASHES
     if (std::strcmp(line, "<FILE_NOT_FOUND>") == 0) return false;
     if (std::strcmp(line, "<BAD_REQUEST>") == 0)     return false;
 
-    if (!startsWith(line, "<META>"))
+    long long count = -1;
+    if (std::sscanf(line, "<HASHES> %lld", &count) != 1 || count < 0) {
+        conn.discard();
         return false;
-
-    long long sz = -1;
-    if (std::sscanf(line, "<META> %lld", &sz) == 1 && sz >= 0) {
-        outSize = sz;
-        return true;
     }
 
-    return false;
-}
+    for (long long i = 0; i < count; ++i) {
+        if (conn.sock().receiveLine(line, sizeof(line)) <= 0) {
+            conn.discard();
+            return false;
+        }
+        stripCRLF(line);
 
-bool ChunkDownloader::fetchChunk(const std::string& filename,
-                                clientSocket& cs,
-                                int chunkIndex,
-                                char* outBuf,
-                                size_t& outN,
-                                int* outCode)
-{
-    outN = 0;
-    if (outCode) *outCode = 1;
+        CdcChunk c;
+        char hash[72];
+        if (std::sscanf(line, "%lld %lld %71s", &c.offset, &c.length, hash) != 3 ||
+            std::strlen(hash) != 64) {
+            conn.discard();
+            return false;
+        }
+        c.hash = hash;
+        out.push_back(c);
+    }
 
-    char req[512];
-    std::snprintf(req, sizeof(req), "GET %s %d\n", filename.c_str(), chunkIndex);
-    if (!cs.sendData(std::string(req)))
+    if (conn.sock().receiveLine(line, sizeof(line)) <= 0) {
+        conn.discard();
         return false;
-
-    char header[256];
-    const int hn = cs.receiveLine(header, sizeof(header));
-    if (hn <= 0) {
-        if (outCode) *outCode = 1;
+    }
+    stripCRLF(line);
+    if (std::strcmp(line, "<END>") != 0) {
+        conn.discard();
         return false;
     }
+    return true;
+}
+
+// Which chunks a seeder can serve. full = the whole file; otherwise what it
+// has goes into have. false only when the connection is unusable.
+static Async::Task<bool> haveOn(Async::Conn& io, std::string filename, long long totalChunks,
+                                bool& full, ChunkSet& have)
+{
+    full = false;
 
-    stripCRLF(header);
+    std::string line;
+    bool ok = co_await io.sendAll("HAVE " + filename + "\n");
+    if (ok) ok = co_await io.readLine(line);
+    if (!ok) co_return false;
 
-    if (std::strcmp(header, "<FILE_NOT_FOUND>") == 0) {
-        if (outCode) *outCode = 2;
-        return false;
+    // older seeders don't know HAVE, and only ever serve whole files
+    if (line == "<BAD_REQUEST>") {
+        full = true;
+        co_return true;
     }
-    if (std::strcmp(header, "<RANGE_ERROR>") == 0 || std::strcmp(header, "<BAD_REQUEST>") == 0) {
-        if (outCode) *outCode = 3;
-        return false;
+    if (line == "<FILE_NOT_FOUND>") co_return true;
+
+    long long chunks = -1;
+    char what[32];
+    if (std::sscanf(line.c_str(), "<HAVE> %lld %31s", &chunks, what) != 2) co_return false;
+    if (std::strcmp(what, "ALL") == 0) {
+        full = chunks == totalChunks;
+        co_return true;
     }
 
-    int idx = -1;
-    int nbytes = -1;
-    if (std::sscanf(header, "<CHUNK> %d %d", &idx, &nbytes) != 2) {
-        if (outCode) *outCode = 1;
-        return false;
+    if (std::strcmp(what, "RUNS") == 0) {
+        long long k = -1;
+        if (std::sscanf(line.c_str(), "<HAVE> %lld RUNS %lld", &chunks, &k) != 2 || k < 0 || k > totalChunks)
+            co_return false;
+        for (long long i = 0; i < k; ++i) {
+            long long first = -1, end = -1;
+            const bool got = co_await io.readLine(line);
+            if (!got || std::sscanf(line.c_str(), "%lld %lld", &first, &end) != 2) co_return false;
+            // different chunking, nothing we can use
+            if (chunks == totalChunks) have.add(first, std::min(end, totalChunks));
+        }
+        co_return true;
     }
-    if (idx != chunkIndex || nbytes < 0 || nbytes > chunkSize_) {
-        if (outCode) *outCode = 3;
-        return false;
+
+    char* endp = nullptr;
+    const long long n = std::strtoll(what, &endp, 10);
+    if (*endp != '\0' || n < 0 || n > totalChunks / 8 + 1) co_return false;
+    std::string bits((size_t)n, '\0');
+    if (n > 0) {
+        const bool got = co_await io.readExact(&bits[0], (size_t)n);
+        if (!got) co_return false;
+    }
+
+    if (chunks == totalChunks) have.addBitmap(bits, totalChunks);
+    co_return true;
+}
+
+// the same on a connection of our own (a lane's, on an offload thread)
+bool ChunkDownloader::fetchHave(clientSocket& cs, const std::string& filename, long long totalChunks,
+                                bool& full, ChunkSet& have)
+{
+    Async::Conn io(cs.fd());
+    io.unread(cs.takeBuffered());
+    const bool ok = Async::syncWait(haveOn(io, filename, totalChunks, full, have));
+    // anything read past the reply would be lost to the socket
+    return ok && io.drained();
+}
+
+// what one seeder has, asked without a thread of its own; can't tell = full,
+// GET sorts it out
+static Async::Task<void> askHave(Endpoint seeder, std::string filename, long long totalChunks,
+                                 char& full, ChunkSet& have)
+{
+    Async::Lease lease;
+    bool f = true;
+    if (co_await lease.open(seeder)) {
+        const bool ok = co_await haveOn(lease.conn(), filename, totalChunks, f, have);
+        if (!ok) f = true;
+        lease.done(ok);
     }
+    full = f ? 1 : 0;
+}
+
+// Our place in the relay chain of a file: the first whole-file seeder by
+// address heads it (the same one for everybody), upstream is who to pull
+// from. lost = a member we couldn't reach any more. false if nobody heads one.
+bool ChunkDownloader::joinChain(const std::string& filename, const std::vector<Endpoint>& seeders,
+                                const Endpoint& self, const Endpoint& lost,
+                                Endpoint& head, Endpoint& upstream)
+{
+    std::vector<Endpoint> order(seeders);
+    std::sort(order.begin(), order.end());
+
+    std::string req = "CHAIN " + filename + " " + (self.anyAddress() ? std::to_string(self.port) : self.str());
+    if (lost.valid() && !lost.anyAddress()) req += " " + lost.str();
+    req += "\n";
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        PooledConnection conn;
+        if (!conn.open(order[i])) continue;
 
-    if (nbytes == 0) {
-        outN = 0;
-        if (outCode) *outCode = 0;
+        char line[256];
+        if (!conn.sock().sendData(req) || conn.sock().receiveLine(line, sizeof(line)) <= 0) {
+            conn.discard();
+            continue;
+        }
+        stripCRLF(line);
+
+        // partial seeders and older peers don't head chains
+        if (!startsWith(line, "<CHAIN> ")) continue;
+        if (std::strcmp(line + 8, "HEAD") == 0) upstream = order[i];
+        else if (!Endpoint::parse(line + 8, upstream)) continue;
+        head = order[i];
         return true;
     }
+    return false;
+}
+
+// Done with the chain, whichever way: the head stops handing us out to
+// newcomers. Whoever already pulls from us keeps doing so while we last.
+void ChunkDownloader::leaveChain(const std::string& filename, const Endpoint& head, const Endpoint& self) {
+    PooledConnection conn;
+    if (!conn.open(head)) return;
+
+    const std::string req = "CHAIN " + filename + " " +
+                            (self.anyAddress() ? std::to_string(self.port) : self.str()) + " LEAVE\n";
+    char line[256];
+    if (!conn.sock().sendData(req) || conn.sock().receiveLine(line, sizeof(line)) <= 0) conn.discard();
+}
 
-    if (!cs.receiveExact(outBuf, (size_t)nbytes)) {
-        if (outCode) *outCode = 1;
+// A file we got whole (META+, BUNDLE): written next to it, then renamed in
+static bool writeWhole(const std::string& outPath, const std::string& data) {
+    const std::string tmp = outPath + ".part";
+    FILE* out = std::fopen(tmp.c_str(), "wb");
+    if (!out) {
+        logErr("DL: cannot create '%s'", tmp.c_str());
+        return false;
+    }
+    const bool written = std::fwrite(data.data(), 1, data.size(), out) == data.size();
+    if (std::fclose(out) != 0 || !written || std::rename(tmp.c_str(), outPath.c_str()) != 0) {
+        logErr("DL: cannot write '%s'", outPath.c_str());
+        std::remove(tmp.c_str());
         return false;
     }
-
-    outN = (size_t)nbytes;
-    if (outCode) *outCode = 0;
     return true;
 }
 
@@ -136,7 +414,12 @@ static bool mergeParts(const std::string& outPath, const std::vector<std::string
         return false;
     }
 
-    std::vector<char> buf(64 * 1024);
+    BufferPool::Buffer buf = BufferPool::instance().get(DISK_BUF, BufferPool::DISK, DISK_BUF_WAIT_MS);
+    if (!buf) {
+        logErr("mergeParts: no buffer for '%s'", outPath.c_str());
+        std::fclose(out);
+        return false;
+    }
 
     for (size_t i = 0; i < partPaths.size(); ++i) {
         FILE* in = std::fopen(partPaths[i].c_str(), "rb");
@@ -169,337 +452,2352 @@ static bool mergeParts(const std::string& outPath, const std::vector<std::string
 }
 
 bool ChunkDownloader::download(const std::string& filename,
-                              const std::vector<int>& seeders,
+                              const std::vector<Endpoint>& seeders,
                               int myPort)
 {
     return download(filename, seeders, myPort, nullptr);
 }
 
-bool ChunkDownloader::download(const std::string& filename,
-                              const std::vector<int>& seeders,
-                              int myPort,
-                              DownloadProgress* prog)
-{
-    if (seeders.empty()) {
-        logErr("DL: no seeders provided for '%s'", filename.c_str());
-        return false;
+// ---- tail latency: hedged requests + endgame ----
+
+static const int    ENDGAME_CHUNKS = 16;    // remaining chunks that switch on endgame
+static const size_t LATENCY_WINDOW = 64;    // samples kept per seeder
+static const size_t LATENCY_MIN    = 16;    // samples before p95 is trusted
+static const double HEDGE_FLOOR_MS = 20.0;  // never hedge a request younger than this
+static const int    IDLE_RELEASE_MS = 1000; // throttled longer than this: give the socket back
+static const int    HAVE_REFRESH_MS = 500;  // partial seeders: re-ask HAVE this often when out of work
+static const int    RAREST_STALL_MS = 30000; // nothing landed and nobody has the rest: give up
+static const size_t SPLICE_MIN_BYTES = 16 * 1024; // smaller payloads aren't worth the pipe
+static const long long UDP_BATCH_BYTES = 4LL * 1024 * 1024;   // per UDPGET
+static const int    UDP_POLL_MS = 100;      // a UDP lane checks for cancel at least this often
+static const int    UDP_REACK_MS = 50;      // ... and re-acks this often while waiting for <UDP_DONE>
+static const int    RETRY_BASE_MS = 100;    // first wait before retrying a seeder (then doubles)
+static const int    RETRY_MAX_MS = 2000;
+static const int    CHAIN_RETRY_MS = 20;    // upstream hasn't got the chunk yet: ask again after
+static const int    CHAIN_STALL_MS = 15000; // upstream made no progress this long: re-form around it
+static const int    CHAIN_MAX_REJOINS = 16; // a chain that keeps breaking isn't worth it
+
+static const long long SINK_AHEAD_BYTES = 32LL * 1024 * 1024; // landed but not in the sink yet, at most
+static const int    SINK_WAIT_MS = 5;       // a lane that ran that far ahead looks again after this
+static const size_t SINK_SLAB_BYTES = 64 * 1024; // pooled: queued chunks share buffers this big
+static const int    SINK_BUF_WAIT_MS = 1000; // for one of those at the pool's cap
+static const size_t ORDER_MAX = 64 * 1024;  // pooled: candidates a lane lines up at once
+
+struct Range { long long start; long long end; };
+
+static long long nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One per requester (workers + hedger). Published while a GET is in flight so
+// whoever lands the chunk first can cancel the other request.
+struct RequestSlot {
+    std::mutex mu;
+    std::atomic<long long> chunk{-1};
+    std::atomic<int> seeder{-1};        // index into Transfer::seeders
+    std::atomic<long long> sentUs{0};
+    long long runEnd = 0;               // GETs sent with it, up to here
+    int fd = -1;
+    bool cancelled = false;
+};
+
+// What one seeder can serve (HAVE). Chunks only ever get added.
+struct SeederHave {
+    std::atomic<bool> full{false};
+    ChunkSet chunks;
+};
+
+// Shared state of one download
+// A chunk on its way to the sink, in a pooled slab it shares with others
+struct SinkPiece {
+    long long chunk = 0;
+    std::shared_ptr<BufferPool::Buffer> slab;
+    const char* data = nullptr;
+    size_t n = 0;
+};
+
+struct Transfer {
+    long long totalChunks = 0;
+    int chunkSize = 0;
+    long long fileSize = 0;
+    std::vector<Range> ranges;      // work: own chunks of each worker
+    std::vector<Range> parts;       // layout: chunks held by each part file
+    std::vector<int> partFds;
+
+    // DownloadOptions::sink takes the chunks instead of the part files. Lanes
+    // only queue them, feedSink() writes them out on its own thread (in order
+    // for an ordered sink). Lanes stay within sinkAhead chunks of that
+    DownloadSink* sink = nullptr;
+    std::mutex sinkMu;
+    std::condition_variable sinkCv;
+    std::deque<SinkPiece> sinkQueue;
+    std::shared_ptr<BufferPool::Buffer> sinkSlab;   // queued chunks are packed into this one
+    size_t sinkSlabUsed = 0;
+    bool sinkStop = false;
+    std::atomic<long long> sinkNext{0};     // ordered: chunks written so far
+    std::atomic<long long> sinkQueued{0};   // landed, not written yet
+    long long sinkAhead = 0;
+
+    bool sinkFull(long long chunk) const {
+        if (!sink) return false;
+        return sink->ordered() ? chunk >= sinkNext.load() + sinkAhead : sinkQueued.load() >= sinkAhead;
     }
 
-    if (prog) {
-        prog->reset();
-        prog->active.store(true);
-        prog->pending.store(false);
-        prog->failed.store(false);
-        prog->success.store(false);
+    // streaming: workers take chunks in order from `next`, and the in-order
+    // prefix is published as the ready watermark
+    bool sequential = false;
+    std::atomic<long long> next{0};
+
+    // zero copy receive; switched off for good once the part files refuse splice()
+    bool zeroCopy = false;
+    std::atomic<bool> noSplice{false};
+    bool udp = false;
+
+    // relay chain: the lane pulls in order from the member ahead of us; the
+    // whole-file seeders (chainSeeders) tell us who that is when it goes away
+    bool chain = false;
+    std::vector<Endpoint> chainSeeders;
+    Endpoint chainSelf;
+    Endpoint chainHead;             // who we told; we leave it again at the end
+
+    std::mutex readyMu;
+    std::condition_variable readyCv;
+    long long readyChunks = 0;
+    std::atomic<long long> readyMovedUs{0};
+
+    // per chunk state as runs (chunkSet.h), so it stays small however big the
+    // file: landed, claimed by a lane, duplicated by a hedge right now. A chunk
+    // is done as soon as a reply wins it but only written once its bytes are
+    // in place; the ready watermark follows written
+    ChunkSet done;
+    ChunkSet written;
+    ChunkSet inflight;
+    ChunkSet hedged;
+    std::unique_ptr<std::atomic<long long>[]> cursor;   // next own chunk of each worker
+    std::unique_ptr<RequestSlot[]> slots;
+    int slotCount = 0;
+
+    std::atomic<long long> remaining{0};
+    std::atomic<bool> anyFailed{false};
+    std::atomic<int> liveWorkers{0};
+
+    DownloadProgress* prog = nullptr;
+
+    // partial seeders: lanes pick rarest-first among the chunks their seeder
+    // has (in file order when streaming) instead of working fixed ranges
+    bool pooled = false;
+    std::vector<Endpoint> seeders;
+    std::unique_ptr<SeederHave[]> haves;
+    std::atomic<long long> lastCommitUs{0};
+    std::shared_ptr<PartialFile> shared;            // what we seed meanwhile
+
+    bool haveBit(size_t seeder, long long chunk) const {
+        return haves[seeder].full.load() || haves[seeder].chunks.has(chunk);
     }
 
-    //meta
-    long long fileSize = -1;
-    bool metaOk = false;
-    for (size_t i = 0; i < seeders.size(); ++i) {
-        if (fetchMeta(filename, seeders[i], fileSize)) {
-            metaOk = true;
-            break;
-        }
+    bool seederHas(int seeder, long long chunk) const {
+        if (!pooled) return true;
+        return seeder >= 0 && (size_t)seeder < seeders.size() && haveBit((size_t)seeder, chunk);
     }
-    if (!metaOk || fileSize < 0) {
-        if (prog) {
-            prog->failed.store(true);
-            prog->active.store(false);
+
+    // seeders holding a chunk, for rarest first
+    int holders(long long chunk) const {
+        int n = 0;
+        for (size_t k = 0; k < seeders.size(); ++k) n += haveBit(k, chunk) ? 1 : 0;
+        return n;
+    }
+
+
+    int partOf(long long chunk) const {
+        size_t lo = 0, hi = parts.size();
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (parts[mid].start <= chunk) lo = mid;
+            else hi = mid;
         }
-        logErr("DL meta failed file='%s' seeders=%zu", filename.c_str(), seeders.size());
+        return (int)lo;
+    }
+
+    bool isDone(long long chunk) const { return done.has(chunk); }
+    bool isPending(long long chunk) const { return !done.has(chunk) && !inflight.has(chunk); }
+
+    // pending -> claimed; false if another lane has it or it landed meanwhile
+    bool claim(long long chunk) {
+        if (!inflight.add(chunk)) return false;
+        if (!done.has(chunk)) return true;
+        inflight.remove(chunk);
         return false;
     }
+    // the first reply for a chunk wins
+    bool land(long long chunk) {
+        if (!done.add(chunk)) return false;
+        inflight.remove(chunk);
+        return true;
+    }
+};
+
+static void publishSlot(Transfer& t, int self, long long chunk, int seeder, int fd, long long runEnd) {
+    RequestSlot& s = t.slots[self];
+    std::lock_guard<std::mutex> lock(s.mu);
+    s.chunk.store(chunk);
+    s.seeder.store(seeder);
+    s.sentUs.store(nowUs());
+    s.runEnd = runEnd;
+    s.fd = fd;
+    s.cancelled = false;
+}
 
-    const int totalChunks = (int)((fileSize + chunkSize_ - 1) / chunkSize_);
-    if (prog) {
-        prog->totalBytes.store(fileSize);
-        prog->totalChunks.store(totalChunks);
+// the reply for the slot's chunk is in, the next of the run is the one we wait on
+static void moveSlot(Transfer& t, int self, long long chunk) {
+    RequestSlot& s = t.slots[self];
+    std::lock_guard<std::mutex> lock(s.mu);
+    s.chunk.store(chunk);
+    s.sentUs.store(nowUs());
+}
+
+// returns true if another requester won this chunk and cancelled us
+static bool clearSlot(Transfer& t, int self) {
+    RequestSlot& s = t.slots[self];
+    std::lock_guard<std::mutex> lock(s.mu);
+    s.chunk.store(-1);
+    s.fd = -1;
+    return s.cancelled;
+}
+
+// Move the ready watermark over every chunk that is now contiguous with it
+static void advanceReady(Transfer& t) {
+    if (!t.sequential) return;
+    std::lock_guard<std::mutex> lock(t.readyMu);
+    const long long before = t.readyChunks;
+    t.readyChunks = t.written.nextOut(t.readyChunks, t.totalChunks);
+    if (t.readyChunks == before) return;
+
+    t.readyMovedUs.store(nowUs());
+    if (t.prog) {
+        t.prog->readyBytes.store(std::min((long long)t.readyChunks * t.chunkSize, t.fileSize));
     }
+    t.readyCv.notify_all();
+}
 
-    logInfo("DL start file='%s' size=%lld chunks=%d seeders=%zu", 
-            filename.c_str(), fileSize, totalChunks, seeders.size());
+// n bytes waiting in a pipe: into the file at off without touching user
+// space, or through scratch where the filesystem can't splice
+static bool writePiped(Transfer& t, int fd, off_t off, int pipeRd, char* scratch, size_t n) {
+    size_t put = 0;
+    while (put < n && !t.noSplice.load()) {
+        loff_t at = off + (off_t)put;
+        const ssize_t m = ::splice(pipeRd, nullptr, fd, &at, n - put, SPLICE_F_MOVE);
+        if (m > 0) {
+            put += (size_t)m;
+            continue;
+        }
+        if (m < 0 && errno == EINTR) continue;
+        if (m < 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+            logInfo("DL: part files don't take splice(), buffering instead");
+            t.noSplice.store(true);
+            break;
+        }
+        return false;
+    }
 
-    // ALWAYS create parts equal to number of seeders (even if 1)
-    const int parts = (int)seeders.size();
+    while (put < n) {
+        const ssize_t r = ::read(pipeRd, scratch, n - put);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        size_t w = 0;
+        while (w < (size_t)r) {
+            const ssize_t k = ::pwrite(fd, scratch + w, (size_t)r - w, off + (off_t)(put + w));
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) return false;
+            w += (size_t)k;
+        }
+        put += (size_t)r;
+    }
+    return true;
+}
 
-    const std::string baseDir = portDirectory(myPort);
-    const std::string outPath = baseDir + "/" + filename;
+// throw away a payload we lost the race for
+static void drainPipe(int pipeRd, char* scratch, size_t n) {
+    while (n > 0) {
+        const ssize_t r = ::read(pipeRd, scratch, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return;
+        n -= (size_t)r;
+    }
+}
 
-    // creating part paths
-    std::vector<std::string> partPaths((size_t)parts);
-    for (int i = 0; i < parts; ++i) {
-        char suffix[32];
-        std::snprintf(suffix, sizeof(suffix), ".part%d", i);
-        partPaths[(size_t)i] = outPath + suffix;
-        std::remove(partPaths[(size_t)i].c_str());
+// bookkeeping once a chunk's bytes are in place
+static int commitDone(Transfer& t, int self, long long chunk, size_t n, ProgressSlot* tally) {
+    t.written.add(chunk);
+    if (t.shared) t.shared->mark(chunk);
+    t.lastCommitUs.store(nowUs());
+    if (tally) tally->add((long long)n);
+
+    // cancel the duplicate still waiting on this chunk, unless more of its
+    // run comes after it on that socket
+    for (int k = 0; k < t.slotCount; ++k) {
+        if (k == self) continue;
+        RequestSlot& s = t.slots[k];
+        std::lock_guard<std::mutex> lock(s.mu);
+        if (s.chunk.load() == chunk && s.fd >= 0 && chunk + 1 >= s.runEnd) {
+            s.cancelled = true;
+            ::shutdown(s.fd, SHUT_RDWR);
+        }
     }
 
-    // Split chunk ranges among parts: [start, end)
-    struct Range { int start; int end; };
-    std::vector<Range> ranges((size_t)parts);
-    for (int i = 0; i < parts; ++i) {
-        const int start = (totalChunks * i) / parts;
-        const int end   = (totalChunks * (i + 1)) / parts;
-        ranges[(size_t)i] = Range{ start, end };
-        logInfo("Part %d: chunks %d-%d (seeder port %d)", 
-                i, start, end - 1, seeders[i]);
+    t.remaining.fetch_sub(1);
+    advanceReady(t);
+    return 1;
+}
+
+// Hand a landed chunk to feedSink(): the lane's buffer goes on with the next
+// reply, so it's copied into the current slab (a page per chunk would be a
+// waste at small chunk sizes). A slab goes back once its last chunk is
+// written. false = the pool had none
+static bool queueSink(Transfer& t, long long chunk, const char* data, size_t n) {
+    std::unique_lock<std::mutex> lock(t.sinkMu);
+    if (!t.sinkSlab || t.sinkSlab->size() - t.sinkSlabUsed < n) {
+        lock.unlock();
+        std::shared_ptr<BufferPool::Buffer> slab = std::make_shared<BufferPool::Buffer>(
+            BufferPool::instance().get(std::max(n, SINK_SLAB_BYTES), BufferPool::DOWNLOAD, SINK_BUF_WAIT_MS));
+        if (!*slab) return false;
+        lock.lock();
+        t.sinkSlab = std::move(slab);
+        t.sinkSlabUsed = 0;
     }
+    char* at = t.sinkSlab->data() + t.sinkSlabUsed;
+    t.sinkSlabUsed += n;
+    std::memcpy(at, data, n);
+    SinkPiece piece;
+    piece.chunk = chunk;
+    piece.slab = t.sinkSlab;
+    piece.data = at;
+    piece.n = n;
+    t.sinkQueue.push_back(std::move(piece));
+    t.sinkQueued.fetch_add(1);
+    lock.unlock();
+    t.sinkCv.notify_one();
+    return true;
+}
 
-    std::atomic<bool> anyFailed(false);
-    std::vector<std::thread> threads;
-    threads.reserve(parts);
+// The sink's own thread: whatever it costs to write holds up this one, not
+// the scheduler's. Chunks that overtake sinkNext wait in early (ordered sink).
+// Runs until sinkStop with nothing queued; a refusal fails the download and
+// what still comes is dropped.
+static void feedSink(Transfer& t) {
+    const bool ordered = t.sink->ordered();
+    std::map<long long, SinkPiece> early;
+    std::deque<SinkPiece> batch;
+    long long next = 0;
+    bool ok = true;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(t.sinkMu);
+            t.sinkCv.wait(lock, [&]() { return t.sinkStop || !t.sinkQueue.empty(); });
+            if (t.sinkQueue.empty()) break;
+            batch.swap(t.sinkQueue);
+        }
 
-    // Create worker threads
-    for (int i = 0; i < parts; ++i) {
-    const Range r = ranges[(size_t)i];
-    const std::string partPath = partPaths[(size_t)i];
-    const std::string fnCopy = filename;
-
-    // Capture the whole seeders list (by value) so the thread can failover
-    threads.push_back(std::thread([this, seeders, i, r, partPath, fnCopy, prog, &anyFailed]() {
-        if (r.start >= r.end) {
-            logWarn("Empty segment for worker %d", i);
-            return;
+        for (; !batch.empty(); batch.pop_front()) {
+            const long long c = batch.front().chunk;
+            if (ordered && ok) {
+                early[c] = std::move(batch.front());
+                continue;
+            }
+            if (ok && !t.sink->write(c * t.chunkSize, batch.front().data, batch.front().n)) {
+                logErr("DL: sink refused chunk %lld", c);
+                ok = false;
+            }
+            t.sinkQueued.fetch_sub(1);
         }
 
-        FILE* out = std::fopen(partPath.c_str(), "wb");
-        if (!out) {
-            anyFailed.store(true);
-            if (prog) {
-                prog->failed.store(true);
-                prog->active.store(false);
+        for (auto it = early.find(next); ok && it != early.end(); it = early.find(next)) {
+            if (!t.sink->write(it->first * t.chunkSize, it->second.data, it->second.n)) {
+                logErr("DL: sink refused chunk %lld", it->first);
+                ok = false;
             }
-            logErr("DL: cannot create part '%s'", partPath.c_str());
-            return;
+            early.erase(it);
+            t.sinkNext.store(++next);
+            t.sinkQueued.fetch_sub(1);
         }
+        if (!ok) {
+            t.sinkQueued.fetch_sub((long long)early.size());
+            early.clear();
+            t.anyFailed.store(true);
+        }
+    }
+}
+
+// First valid reply wins: 1 = written, 0 = duplicate (dropped), -1 = write error.
+// data == nullptr: the payload is in pipeRd (scratch holds chunkSize bytes).
+static int commitChunk(Transfer& t, int self, long long chunk, const char* data, size_t n, ProgressSlot* tally,
+                       int pipeRd = -1, char* scratch = nullptr) {
+    if (!t.land(chunk)) {
+        if (!data) drainPipe(pipeRd, scratch, n);
+        return 0;
+    }
 
-        std::vector<char> buf((size_t)chunkSize_);
-        clientSocket cs;
+    if (t.sink) {
+        // no zero copy with a sink, data is always there
+        if (!queueSink(t, chunk, data, n)) {
+            logErr("DL: no buffer to queue chunk %lld for the sink", chunk);
+            return -1;
+        }
+        return commitDone(t, self, chunk, n, tally);
+    }
 
-        // ---- FAILOVER STATE ----
-        size_t curIdx = (size_t)i % seeders.size();          // start with "assigned" seeder
-        int seederPort = seeders[curIdx];
-        std::vector<bool> dead(seeders.size(), false);       // local dead list for this worker
+    const int p = t.partOf(chunk);
+    const off_t off = (off_t)(chunk - t.parts[(size_t)p].start) * (off_t)t.chunkSize;
+    if (!data && !writePiped(t, t.partFds[(size_t)p], off, pipeRd, scratch, n)) {
+        logErr("DL: write failed for chunk %lld: %s", chunk, strerror(errno));
+        return -1;
+    }
+    size_t put = data ? 0 : n;
+    while (put < n) {
+        ssize_t w = ::pwrite(t.partFds[(size_t)p], data + put, n - put, off + (off_t)put);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            logErr("DL: write failed for chunk %lld: %s", chunk, strerror(errno));
+            return -1;
+        }
+        put += (size_t)w;
+    }
 
-        auto pickNextSeeder = [&]() -> bool {
-            // mark current as dead
-            dead[curIdx] = true;
+    return commitDone(t, self, chunk, n, tally);
+}
 
-            // find next alive seeder
-            for (size_t k = 0; k < seeders.size(); ++k) {
-                size_t cand = (curIdx + 1 + k) % seeders.size();
-                if (!dead[cand]) {
-                    curIdx = cand;
-                    seederPort = seeders[curIdx];
-                    return true;
-                }
+// Write bytes at a file offset into whichever part file(s) hold them
+static bool writeSpan(Transfer& t, long long off, const char* data, size_t n) {
+    while (n > 0) {
+        const int p = t.partOf(off / t.chunkSize);
+        const long long partStart = (long long)t.parts[(size_t)p].start * t.chunkSize;
+        const long long partEnd   = (long long)t.parts[(size_t)p].end * t.chunkSize;
+        const size_t take = (size_t)std::min((long long)n, partEnd - off);
+
+        size_t put = 0;
+        while (put < take) {
+            ssize_t w = ::pwrite(t.partFds[(size_t)p], data + put, take - put, (off_t)(off - partStart + (long long)put));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return false;
             }
-            return false; // no seeders left
-        };
-
-        bool connected = false;
-        int consecutiveFailures = 0;
-
-        // You can tune these:
-        const int MAX_RETRIES_PER_SEEDER = 3;   // how many temp failures before switching seeders
-        const int MAX_SEEDER_SWITCHES = (int)seeders.size(); // full cycle
-
-        int seederSwitchCount = 0;
-
-        int chunk = r.start;
-        while (chunk < r.end && !anyFailed.load()) {
-
-            // Establish connection
-            if (!connected) {
-                if (prog) prog->pending.store(true);
-
-                if (!cs.connectServer("127.0.0.1", seederPort)) {
-                    consecutiveFailures++;
-
-                    if (consecutiveFailures >= MAX_RETRIES_PER_SEEDER) {
-                        logWarn("DL: seeder %d seems down, switching (worker %d)", seederPort, i);
-                        cs.closeConn();
-                        connected = false;
-                        consecutiveFailures = 0;
-
-                        if (!pickNextSeeder()) {
-                            logErr("DL: no seeders left for worker %d", i);
-                            anyFailed.store(true);
-                            if (prog) {
-                                prog->failed.store(true);
-                                prog->active.store(false);
-                                prog->pending.store(false);
-                            }
-                            break;
-                        }
-
-                        seederSwitchCount++;
-                        if (seederSwitchCount > MAX_SEEDER_SWITCHES) {
-                            logErr("DL: too many seeder switches (worker %d)", i);
-                            anyFailed.store(true);
-                            if (prog) {
-                                prog->failed.store(true);
-                                prog->active.store(false);
-                                prog->pending.store(false);
-                            }
-                            break;
-                        }
-                    }
+            put += (size_t)w;
+        }
+        off += (long long)take;
+        data += take;
+        n -= take;
+    }
+    return true;
+}
 
-                    std::this_thread::sleep_for(std::chrono::milliseconds(500));
-                    continue;
-                }
+// Copy every remote chunk we already hold locally into the part files and mark
+// the transfer chunks they fully cover as done. Returns bytes reused.
+static long long prefillFromStore(Transfer& t, ChunkStore& store,
+                                  const std::vector<CdcChunk>& remote, long long fileSize)
+{
+    // the manifest has to tile the file exactly or it's useless
+    long long expect = 0;
+    for (size_t i = 0; i < remote.size(); ++i) {
+        if (remote[i].offset != expect || remote[i].length <= 0) return 0;
+        expect += remote[i].length;
+    }
+    if (expect != fileSize) return 0;
+
+    // no refresh() here: the store re-indexes on its own thread
+
+    // a transfer chunk is only skippable if every byte of it is local
+    ChunkSet missing;
+    std::vector<bool> local(remote.size(), false);
+    std::string data;
+    long long reused = 0;
+    ProgressSlot* tally = nullptr;
+
+    for (size_t i = 0; i < remote.size(); ++i) {
+        const CdcChunk& c = remote[i];
+        if (store.read(c.hash, c.length, data) && writeSpan(t, c.offset, data.data(), data.size())) {
+            local[i] = true;
+            continue;
+        }
+        missing.add(c.offset / t.chunkSize, (c.offset + c.length - 1) / t.chunkSize + 1);
+    }
 
-                connected = true;
-                consecutiveFailures = 0;
-                if (prog) prog->pending.store(false);
-
-                logInfo("DL: worker %d connected to seeder %d for chunks %d-%d",
-                        i, seederPort, r.start, r.end - 1);
-            }
-
-            // Fetch chunk
-            size_t n = 0;
-            int code = 1;
-            const bool ok = fetchChunk(fnCopy, cs, chunk, buf.data(), n, &code);
-
-            if (!ok) {
-                if (code == 1) {
-                    // TEMP failure -> reconnect; if too many, switch seeders
-                    logWarn("DL: temp failure chunk %d from seeder %d (worker %d)",
-                            chunk, seederPort, i);
-
-                    cs.closeConn();
-                    connected = false;
-                    consecutiveFailures++;
-
-                    if (consecutiveFailures >= MAX_RETRIES_PER_SEEDER) {
-                        logWarn("DL: switching seeder for worker %d (current %d)", i, seederPort);
-                        consecutiveFailures = 0;
-
-                        if (!pickNextSeeder()) {
-                            logErr("DL: no seeders left for worker %d", i);
-                            anyFailed.store(true);
-                            if (prog) {
-                                prog->failed.store(true);
-                                prog->active.store(false);
-                                prog->pending.store(false);
-                            }
-                            break;
-                        }
-
-                        seederSwitchCount++;
-                        if (seederSwitchCount > MAX_SEEDER_SWITCHES) {
-                            logErr("DL: too many seeder switches (worker %d)", i);
-                            anyFailed.store(true);
-                            if (prog) {
-                                prog->failed.store(true);
-                                prog->active.store(false);
-                                prog->pending.store(false);
-                            }
-                            break;
-                        }
-                    }
+    // what's left are runs of whole local chunks
+    long long k = missing.nextOut(0, t.totalChunks);
+    while (k < t.totalChunks) {
+        const long long end = missing.nextIn(k, t.totalChunks);
+        const long long n = std::min(end * t.chunkSize, fileSize) - k * t.chunkSize;
+        t.done.add(k, end);
+        t.written.add(k, end);
+        t.remaining.fetch_sub(end - k);
+        reused += n;
+        if (t.prog && !tally) tally = t.prog->slot(-1, Endpoint());
+        if (tally) tally->add(n, end - k);
+        k = missing.nextOut(end, t.totalChunks);
+    }
+    return reused;
+}
 
-                    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-                    continue;
-                }
+void ChunkDownloader::recordLatency(const Endpoint& seeder, double ms) {
+    std::lock_guard<std::mutex> lock(latMu_);
+    LatencyWindow& w = latency_[seeder];
+    if (w.samples.size() < LATENCY_WINDOW) {
+        w.samples.push_back(ms);
+    } else {
+        w.samples[w.next] = ms;
+        w.next = (w.next + 1) % LATENCY_WINDOW;
+    }
+}
 
-                // Permanent failure: keep your current behavior (fail whole download)
-                logErr("DL: permanent fail chunk %d from seeder %d code=%d",
-                       chunk, seederPort, code);
-                anyFailed.store(true);
-                if (prog) {
-                    prog->failed.store(true);
-                    prog->active.store(false);
-                    prog->pending.store(false);
-                }
-                break;
-            }
+// p95 of recent chunk latencies for this seeder, or -1 while we know too little
+double ChunkDownloader::hedgeThresholdMs(const Endpoint& seeder) {
+    std::vector<double> v;
+    {
+        std::lock_guard<std::mutex> lock(latMu_);
+        std::map<Endpoint, LatencyWindow>::const_iterator it = latency_.find(seeder);
+        if (it == latency_.end() || it->second.samples.size() < LATENCY_MIN) return -1.0;
+        v = it->second.samples;
+    }
 
-            // Write chunk
-            consecutiveFailures = 0;
-            if (n > 0) {
-                size_t written = std::fwrite(buf.data(), 1, n, out);
-                if (written != n) {
-                    logErr("DL: write failed for chunk %d", chunk);
-                    anyFailed.store(true);
-                    if (prog) {
-                        prog->failed.store(true);
-                        prog->active.store(false);
-                    }
-                    break;
-                }
-            }
+    const size_t k = (v.size() * 95) / 100;
+    std::nth_element(v.begin(), v.begin() + (long)k, v.end());
+    return std::max(v[k], HEDGE_FLOOR_MS);
+}
 
-            if (prog) {
-                prog->doneBytes.fetch_add((long long)n);
-                prog->doneChunks.fetch_add(1);
+// Pick a chunk worth duplicating. Requests past their seeder's p95 always
+// qualify; once in endgame every outstanding chunk does, including the ones
+// still queued at the tail of a slow worker's range. When streaming, the
+// chunk holding up the ready watermark goes first, and earlier chunks beat
+// later ones.
+static long long pickHedge(Transfer& t, int self, int mySeeder, int& ownerSeeder,
+                           const std::function<double(int)>& thresholdMs)
+{
+    const bool endgame = t.remaining.load() <= ENDGAME_CHUNKS;
+    const long long now = nowUs();
+
+    if (t.sequential) {
+        long long head;
+        {
+            std::lock_guard<std::mutex> lock(t.readyMu);
+            head = t.readyChunks;
+        }
+        if (head < t.totalChunks && !t.isDone(head) && !t.hedged.has(head)) {
+            // stalled since the watermark last moved, or since it was requested
+            int owner = -1;
+            long long since = t.readyMovedUs.load();
+            for (int k = 0; k < t.slotCount; ++k) {
+                if (k == self || t.slots[k].chunk.load() != head) continue;
+                owner = t.slots[k].seeder.load();
+                since = std::max(since, t.slots[k].sentUs.load());
             }
+            // not on the wire: which worker claimed it (e.g. stuck connecting)
+            for (size_t p = 0; owner < 0 && p < t.ranges.size(); ++p) {
+                if ((int)p != self && t.cursor[p].load() == head) owner = t.slots[p].seeder.load();
+            }
+            const double thr = std::max(owner >= 0 ? thresholdMs(owner) : -1.0, HEDGE_FLOOR_MS);
+            if ((owner < 0 || owner != mySeeder) && (mySeeder < 0 || t.seederHas(mySeeder, head)) &&
+                (double)(now - since) / 1000.0 > thr && t.hedged.add(head)) {
+                ownerSeeder = owner;
+                return head;
+            }
+        }
+    }
 
-            ++chunk;
+    long long best = -1;
+    int bestOwner = -1;
+    for (int k = 0; k < t.slotCount; ++k) {
+        if (k == self) continue;
+        const long long c = t.slots[k].chunk.load();
+        const int seeder = t.slots[k].seeder.load();
+        if (c < 0 || seeder == mySeeder || t.isDone(c)) continue;
+        if (t.hedged.has(c)) continue;
+        if (mySeeder >= 0 && !t.seederHas(mySeeder, c)) continue;
+
+        if (!endgame) {
+            const double thr = thresholdMs(seeder);
+            const double elapsedMs = (double)(now - t.slots[k].sentUs.load()) / 1000.0;
+            if (thr < 0 || elapsedMs <= thr) continue;
         }
 
-        std::fclose(out);
-        cs.closeConn();
+        if (best < 0 || (t.sequential && c < best)) {
+            best = c;
+            bestOwner = seeder;
+            if (!t.sequential) break;
+        }
+    }
+    if (best >= 0 && t.hedged.add(best)) {
+        ownerSeeder = bestOwner;
+        return best;
+    }
 
-        if (chunk >= r.end && !anyFailed.load()) {
-            logInfo("DL: worker %d completed segment", i);
+    // pooled lanes take whatever is left themselves, there are no ranges to steal from
+    if (!endgame || t.pooled) return -1;
+
+    // steal from the tail of other ranges, owners work from the front
+    for (size_t p = 0; p < t.ranges.size(); ++p) {
+        if ((int)p == self) continue;
+        const int owner = t.slots[p].seeder.load();
+        if (owner == mySeeder) continue;
+        const long long front = t.cursor[p].load();
+        // hop over landed runs rather than chunk by chunk
+        for (long long c = t.done.prevOut(front + 1, t.ranges[p].end); c > front;
+             c = t.done.prevOut(front + 1, c)) {
+            if (t.inflight.has(c) || !t.hedged.add(c)) continue;
+            ownerSeeder = owner;
+            return c;
         }
-    }));
+    }
+    return -1;
 }
 
-    // Join all threads
-    for (size_t i = 0; i < threads.size(); ++i) {
-        if (threads[i].joinable()) {
-            threads[i].join();
-        }
+// Copy the ready prefix of a streaming download into DownloadOptions::streamTo
+// as it grows. Runs until the whole file went out (all = true), the sink
+// refuses, or stop is set (under readyMu). Ending the sink is the caller's.
+static void feedStream(Transfer& t, std::string path, DownloadSink* to, bool& stop, bool& all) {
+    BufferPool::Buffer buf = BufferPool::instance().get(DISK_BUF, BufferPool::DISK, DISK_BUF_WAIT_MS);
+    int in = buf ? ::open(path.c_str(), O_RDONLY) : -1;
+    if (in < 0 || !to->begin(t.fileSize)) {
+        logErr("DL: stream feed cannot open '%s'", path.c_str());
+        if (in >= 0) ::close(in);
+        return;
     }
 
-    // Check for failures
-    const bool ok = !anyFailed.load() && (!prog || !prog->failed.load());
-    if (!ok) {
-        logErr("DL incomplete file='%s'", filename.c_str());
-        if (prog) {
-            prog->failed.store(true);
-            prog->active.store(false);
+    long long sent = 0;
+    while (sent < t.fileSize) {
+        long long ready;
+        {
+            std::unique_lock<std::mutex> lock(t.readyMu);
+            t.readyCv.wait(lock, [&]() {
+                return stop || (long long)t.readyChunks * t.chunkSize > sent;
+            });
+            ready = std::min((long long)t.readyChunks * t.chunkSize, t.fileSize);
+            if (ready <= sent && stop) break;
         }
-        // Clean up partial files
-        for (size_t i = 0; i < partPaths.size(); ++i) {
-            std::remove(partPaths[i].c_str());
+
+        bool broken = false;
+        while (sent < ready && !broken) {
+            const size_t want = (size_t)std::min((long long)buf.size(), ready - sent);
+            const ssize_t n = ::pread(in, buf.data(), want, (off_t)sent);
+            if (n <= 0 || !to->write(sent, buf.data(), (size_t)n)) { broken = true; break; }
+            sent += (long long)n;
+        }
+        if (broken) {
+            logWarn("DL: stream feed stopped after %lld bytes", sent);
+            break;
         }
-        return false;
     }
+    all = sent == t.fileSize;
+    ::close(in);
+}
 
-    // Merge parts into final file
-    std::remove(outPath.c_str());
+// One seeder lane of a download, run in slices by the shared scheduler.
+// index < parts: works through its own chunk range (or, pooled, the rarest
+// chunks its seeder has), then helps in endgame.
+// index == parts: the hedger, duplicating requests that run past p95.
+struct ChunkDownloader::Lane : public SchedTask {
+    static const int MAX_RETRIES_PER_SEEDER = 3;  // how many temp failures before switching seeders
+
+    Lane(ChunkDownloader& dl, Transfer& t, JobControl& ctl, const std::string& filename,
+         const std::vector<Endpoint>& seeders, int index)
+        : dl(dl), t(t), ctl(ctl), filename(filename), seeders(seeders), index(index),
+          hedger(index == (int)t.ranges.size()),
+          curIdx(seeders.empty() ? 0 : (size_t)index % seeders.size()),
+          connected(false), consecutiveFailures(0), seederSwitchCount(0),
+          chunk(0), rangeEnd(0), rangeDone(false), reserved(0),
+          orderPos(0), orderFull(false), haveCheckedUs(0), awaiting(false)
+    {
+        if (!hedger) {
+            seeder = seeders[curIdx];
+            t.slots[index].seeder.store((int)curIdx);
+            udpOn = t.udp;
+            if (t.pooled) {
+                rangeEnd = t.totalChunks;
+                rebuildOrder();
+                advance();
+            } else if (t.sequential) {
+                rangeEnd = t.totalChunks;
+                advance();
+            } else {
+                chunk = t.ranges[(size_t)index].start;
+                rangeEnd = t.ranges[(size_t)index].end;
+                if (chunk >= rangeEnd) logWarn("Empty segment for worker %d", index);
+            }
+        }
+    }
+    ~Lane() { closePipe(); }
 
-    if (parts == 1) {
-        // Single part - try rename first, fallback to merge
-        if (std::rename(partPaths[0].c_str(), outPath.c_str()) == 0) {
-            logInfo("DL: renamed single part to final file");
-        } else {
-            logWarn("DL: rename failed, using merge");
-            if (!mergeParts(outPath, partPaths)) {
-                logErr("DL finalize failed (merge) out='%s'", outPath.c_str());
-                if (prog) {
-                    prog->failed.store(true);
-                    prog->active.store(false);
+    // next chunk to fetch: our own range in order, the shared in-order cursor
+    // when streaming, or (pooled) the next one of our list nobody claimed yet
+    void advance() {
+        // still ours from the last run
+        if (chunk + 1 < ownedEnd) {
+            ++chunk;
+            return;
+        }
+        if (t.pooled) {
+            chunk = t.totalChunks;
+            for (int pass = 0; pass < 2; ++pass) {
+                while (orderPos < order.size()) {
+                    const long long c = order[orderPos++];
+                    if (t.claim(c)) {
+                        chunk = c;
+                        return;
+                    }
                 }
-                return false;
+                // the list was cut short: line up the next lot
+                if (!orderFull) return;
+                rebuildOrder();
             }
-            std::remove(partPaths[0].c_str());
+            return;
         }
-    } else {
+        if (!t.sequential) {
+            ++chunk;
+            return;
+        }
+        long long c = t.next.fetch_add(1);
+        while (c < t.totalChunks && t.isDone(c)) c = t.next.fetch_add(1);
+        chunk = std::min(c, t.totalChunks);
+    }
+
+    // GETs to send together, starting at chunk: the chunks right after it
+    // that are ours to take (our range, the in-order cursor, our claims)
+    int extendRun() {
+        runLen = 1;
+        while (runLen < depth && chunk + runLen < rangeEnd) {
+            const long long c = chunk + runLen;
+            if (t.isDone(c)) break;
+            if (c >= ownedEnd) {
+                if (t.pooled) {
+                    if (orderPos >= order.size() || order[orderPos] != c || !t.claim(c)) break;
+                    ++orderPos;
+                } else if (t.sequential) {
+                    long long expect = c;
+                    if (!t.next.compare_exchange_strong(expect, c + 1)) break;
+                } else {
+                    t.claim(c);
+                }
+            }
+            ++runLen;
+        }
+        ownedEnd = std::max(ownedEnd, chunk + runLen);
+        return runLen;
+    }
+
+    Result step(long long& bytesOut, TimePoint& wakeAt) override;
+    void interrupt() override;
+
+    bool startHedge(int preferSeeder, Result& out, TimePoint& wakeAt);
+    Result sendHedge();
+    Result hedgeIdle(TimePoint& wakeAt);
+    bool onHedgeReply(long long& bytesOut, Result& out);
+    void sendRequest(long long c, int count, bool hedge);
+    bool onReply(long long& bytesOut, TimePoint& wakeAt, Result& out);
+    void onConnected();
+    Result connectFailed(TimePoint& wakeAt);
+    void rebuildOrder();
+    void refreshHave();
+    void unclaim();
+    bool throttle(TimePoint& wakeAt);
+    void settle(long long used);
+    bool pickNextSeeder();
+    bool rejoinChain();
+    Result switchSeeder(TimePoint& wakeAt);
+    Result switched(bool ok, TimePoint& wakeAt);
+    int maxSwitches() const { return t.chain ? CHAIN_MAX_REJOINS : (int)seeders.size(); } // full cycle
+    Result finish();
+    Result fail();
+    Result retryLater(int ms, TimePoint& wakeAt);
+    bool udpStart(Result& out, TimePoint& wakeAt);
+    void udpBegun();
+    void udpFailed(int rc);
+    Result udpStep(long long& bytesOut);
+    void udpFinished();
+    void udpAbandon();
+
+    // our progress slot for this seeder (cached, we mostly stay on one)
+    ProgressSlot* tallyFor(const Endpoint& peer) {
+        if (!t.prog) return nullptr;
+        if (!tally || peer != tallyPeer) {
+            tally = t.prog->slot(index, peer);
+            tallyPeer = peer;
+        }
+        return tally;
+    }
+    void countError(const Endpoint& peer) {
+        ProgressSlot* s = tallyFor(peer);
+        if (s) s->fail();
+    }
+
+    // Blocking work (connects, HAVE, chain joins) runs on Async::offload()'s
+    // threads, never on the pool. We return BLOCKED; once fn is back, the next
+    // step() starts with then(fn's answer): true = return out, false = carry on
+    typedef std::function<bool(bool, Result&, TimePoint&)> Then;
+    Result offload(std::function<bool()> fn, Then then) {
+        resume = std::move(then);
+        Async::offload([this, fn]() {
+            offloadOk = fn();
+            DownloadScheduler::instance().poke(this);
+        });
+        return BLOCKED;
+    }
+
+    // before trying our seeder again: backs off with each failure in a row
+    int retryMs() const {
+        return (int)PeerHealth::backoff(consecutiveFailures - 1, RETRY_BASE_MS, RETRY_MAX_MS).count();
+    }
+
+    // splice pipe with room for a whole chunk, made on first use
+    bool openPipe() {
+        if (!t.zeroCopy || t.noSplice.load()) return false;
+        if (pipeFds[0] >= 0) return true;
+        if (::pipe2(pipeFds, O_CLOEXEC) != 0) {
+            pipeFds[0] = pipeFds[1] = -1;
+            return false;
+        }
+        if (::fcntl(pipeFds[1], F_SETPIPE_SZ, t.chunkSize) < t.chunkSize) {
+            logInfo("DL: no pipe can hold a %d byte chunk, buffering instead", t.chunkSize);
+            t.noSplice.store(true);
+            closePipe();
+            return false;
+        }
+        return true;
+    }
+    void closePipe() {
+        for (int i = 0; i < 2; ++i) {
+            if (pipeFds[i] >= 0) ::close(pipeFds[i]);
+            pipeFds[i] = -1;
+        }
+    }
+
+    ChunkDownloader& dl;
+    Transfer& t;
+    JobControl& ctl;
+    const std::string& filename;
+    const std::vector<Endpoint>& seeders;
+    const int index;
+    const bool hedger;
+
+    BufferPool::Buffer buf;        // depth chunks, taken on the first step
+    PooledConnection conn;
+
+    // ---- FAILOVER STATE ----
+    size_t curIdx;                 // start with "assigned" seeder
+    Endpoint seeder;               // seeders[curIdx] once we have one
+    bool connected;
+    int consecutiveFailures;
+    int seederSwitchCount;
+
+    long long chunk;
+    long long rangeEnd;
+    long long ownedEnd = 0;        // chunks below this (from chunk on) we took for a run
+    int depth = 1;                 // GETs per request, see PIPELINE_BYTES
+    int runLen = 1;                // ... in the one in flight
+    bool rangeDone;
+    long long reserved;            // bandwidth already paid for the next request
+
+    // pooled: chunks our seeder has that were still free, best first
+    std::vector<long long> order;
+    size_t orderPos;
+    bool orderFull;                // stopped at ORDER_MAX, there may be more
+    long long haveCheckedUs;
+
+    // GET in flight on the reactor; filled in before we get poked
+    struct Reply {
+        bool ok = false;
+        int code = 1;
+        std::vector<size_t> sizes; // per chunk of the run that came in, at buf + i*chunkSize
+        bool piped = false;        // payload waits in pipeFds[0], not in buf
+        bool hedge = false;        // for hedgeChunk, see onHedgeReply()
+        long long sentUs = 0;
+    };
+    bool awaiting;
+    Reply reply;
+    Async::Conn io;
+
+    // the duplicate we are fetching for someone else's chunk
+    long long hedgeChunk = -1;
+    int hedgeTarget = -1;
+    int hedgeOwner = -1;
+
+    Then resume;                   // offload() in progress
+    bool offloadOk = false;
+
+    ProgressSlot* tally = nullptr;
+    Endpoint tallyPeer;
+
+    int pipeFds[2] = { -1, -1 };
+
+    // UDP bulk mode: our range a batch at a time, until a seeder refuses
+    bool udpOn = false;
+    Udp::Receiver udpRx;
+    // handshake or closing line on the reactor, the answer in udpCode
+    enum UdpWait { UDP_NONE, UDP_BEGIN, UDP_FINISH };
+    UdpWait udpWait = UDP_NONE;
+    int udpCode = 0;
+
+    long long upstreamSinceUs = 0; // chain: when we switched to this upstream
+};
+
+// Rarest first, and among equally rare ones start at our own range so the
+// lanes don't all queue up on the same chunk. Streaming keeps file order.
+// Up to ORDER_MAX at a time, found a run at a time (landed chunks, chunks
+// our seeder lacks) so a huge file costs no more than a small one.
+void ChunkDownloader::Lane::rebuildOrder() {
+    order.clear();
+    orderPos = 0;
+
+    const long long from = t.sequential ? 0 : t.ranges[(size_t)index].start;
+    const SeederHave& have = t.haves[curIdx];
+    for (int wrap = 0; wrap < 2 && order.size() < ORDER_MAX; ++wrap) {
+        long long c = wrap == 0 ? from : 0;
+        const long long end = wrap == 0 ? t.totalChunks : from;
+        while (c < end && order.size() < ORDER_MAX) {
+            const long long open = t.done.nextOut(c, end);
+            const long long here = have.full.load() ? open : have.chunks.nextIn(open, end);
+            if (here != open) {
+                c = here;
+                continue;
+            }
+            if (open < end && !t.inflight.has(open)) order.push_back(open);
+            c = open + 1;
+        }
+    }
+    orderFull = order.size() >= ORDER_MAX;
+    if (t.sequential || order.empty()) return;
+
+    // already in order of distance from our range
+    std::vector<std::pair<int, long long> > keyed(order.size());
+    for (size_t i = 0; i < order.size(); ++i) keyed[i] = std::make_pair(t.holders(order[i]), order[i]);
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const std::pair<int, long long>& a, const std::pair<int, long long>& b) {
+                         return a.first < b.first;
+                     });
+    for (size_t i = 0; i < keyed.size(); ++i) order[i] = keyed[i].second;
+}
+
+// Ask our (partial) seeder again what it has by now
+void ChunkDownloader::Lane::refreshHave() {
+    if (t.haves[curIdx].full.load()) return;
+    if (!connected) {
+        if (!conn.open(seeder)) return;
+        connected = true;
+    }
+
+    bool full = false;
+    if (!dl.fetchHave(conn.sock(), filename, t.totalChunks, full, t.haves[curIdx].chunks)) {
+        conn.discard();
+        connected = false;
+        return;
+    }
+    if (full) t.haves[curIdx].full.store(true);
+}
+
+// hand our claimed chunk back, e.g. the new seeder doesn't have it
+void ChunkDownloader::Lane::unclaim() {
+    if (chunk >= t.totalChunks) return;
+    for (long long c = chunk; c < std::max(ownedEnd, chunk + 1); ++c) t.inflight.remove(c);
+    chunk = t.totalChunks;
+    ownedEnd = 0;
+}
+
+// Pay for the next request up front (global + per-job bucket). Returns true
+// if the lane has to wait; it keeps its reservation and goes on after wakeAt.
+bool ChunkDownloader::Lane::throttle(TimePoint& wakeAt) {
+    if (reserved > 0) return false;
+
+    // a run pays for all of it, settle() gives back what it didn't get
+    reserved = (long long)t.chunkSize * (hedger || rangeDone ? 1 : depth);
+    const std::chrono::microseconds wait = std::max(RateLimiter::global().reserve(reserved),
+                                                    ctl.limiter().reserve(reserved));
+    if (wait.count() <= 0) return false;
+
+    if (wait > std::chrono::milliseconds(IDLE_RELEASE_MS)) {
+        // don't sit on a connection the whole time
+        conn.release();
+        connected = false;
+    }
+    wakeAt = std::chrono::steady_clock::now() + wait;
+    return true;
+}
+
+void ChunkDownloader::Lane::settle(long long used) {
+    if (reserved > used) {
+        RateLimiter::global().refund(reserved - used);
+        ctl.limiter().refund(reserved - used);
+    }
+    reserved = 0;
+}
+
+bool ChunkDownloader::Lane::pickNextSeeder() {
+    // next seeder nobody found down; the registry is shared by every lane and
+    // job, so one that went away is only discovered once
+    for (size_t k = 0; k + 1 < seeders.size(); ++k) {
+        size_t cand = (curIdx + 1 + k) % seeders.size();
+        if (PeerHealth::instance().usable(seeders[cand])) {
+            curIdx = cand;
+            seeder = seeders[curIdx];
+            t.slots[index].seeder.store((int)curIdx);
+            if (t.pooled) {
+                // different seeder, different chunks
+                unclaim();
+                rebuildOrder();
+                advance();
+            }
+            return true;
+        }
+    }
+    return false; // no seeders left
+}
+
+// Our upstream in the relay chain is gone (or stuck): report it and carry on
+// from wherever the chain closes up. Chunks we have stay; we go on in order.
+bool ChunkDownloader::Lane::rejoinChain() {
+    Endpoint head, up;
+    if (!dl.joinChain(filename, t.chainSeeders, t.chainSelf, seeder, head, up)) return false;
+    // told the same again: skip it, the head always has the file
+    if (up == seeder) up = head;
+    t.chainHead = head;
+
+    logInfo("DL: worker %d: chain of '%s' re-formed, pulling from %s instead of %s",
+            index, filename.c_str(), up.str().c_str(), seeder.str().c_str());
+    seeder = up;
+    upstreamSinceUs = nowUs();
+    return true;
+}
+
+// Our seeder keeps failing: on to the next one, after a pause. In a relay
+// chain that means asking the chain who to pull from now, off the pool.
+SchedTask::Result ChunkDownloader::Lane::switchSeeder(TimePoint& wakeAt) {
+    if (t.chain) {
+        return offload([this]() { return rejoinChain(); }, [this](bool ok, Result& out, TimePoint& wake) {
+            out = switched(ok, wake);
+            return true;
+        });
+    }
+    return switched(pickNextSeeder(), wakeAt);
+}
+
+SchedTask::Result ChunkDownloader::Lane::switched(bool ok, TimePoint& wakeAt) {
+    if (!ok) {
+        logErr("DL: no seeders left for worker %d", index);
+        return fail();
+    }
+    if (++seederSwitchCount > maxSwitches()) {
+        logErr("DL: too many seeder switches (worker %d)", index);
+        return fail();
+    }
+    return retryLater(retryMs(), wakeAt);
+}
+
+// Cancel: unblock a request in flight so its socket is freed right away
+void ChunkDownloader::Lane::interrupt() {
+    RequestSlot& s = t.slots[index];
+    std::lock_guard<std::mutex> lock(s.mu);
+    if (s.fd >= 0) {
+        s.cancelled = true;
+        ::shutdown(s.fd, SHUT_RDWR);
+    }
+}
+
+SchedTask::Result ChunkDownloader::Lane::finish() {
+    settle(0);
+    conn.release();
+    if (!hedger) t.liveWorkers.fetch_sub(1);
+    return FINISHED;
+}
+
+SchedTask::Result ChunkDownloader::Lane::fail() {
+    t.anyFailed.store(true);
+    if (t.prog) {
+        t.prog->failed.store(true);
+        t.prog->active.store(false);
+        t.prog->pending.store(false);
+    }
+    conn.discard();
+    return finish();
+}
+
+SchedTask::Result ChunkDownloader::Lane::retryLater(int ms, TimePoint& wakeAt) {
+    wakeAt = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    return WAIT;
+}
+
+static Async::Task<bool> readable(int fd, Async::Deadline until) {
+    const bool ready = co_await Async::Reactor::instance().ready(fd, EPOLLIN, until);
+    co_return ready;
+}
+
+// UDPGET out on the control connection, its <UDP> line back
+static Async::Task<int> udpBegin(Async::Conn& io, Udp::Receiver& rx, std::string request) {
+    const bool sent = co_await io.sendAll(std::move(request));
+    if (!sent) co_return 1;
+    std::string line;
+    const bool got = co_await io.readLine(line);
+    if (!got) co_return 1;
+    co_return rx.start(line);
+}
+
+// The batch is in: wait for the server's closing line, answering any
+// retransmission meanwhile (our last ack may not have made it)
+static Async::Task<int> udpFinish(Async::Conn& io, Udp::Receiver& rx) {
+    const long long until = nowUs() + (long long)Udp::IDLE_TIMEOUT_MS * 1000;
+    while (io.drained()) {
+        const long long now = nowUs();
+        if (now > until) co_return 1;
+        rx.reack();
+        long long wake = std::min(until, now + (long long)UDP_REACK_MS * 1000);
+        if (rx.sendDueUs() >= 0) wake = std::min(wake, rx.sendDueUs());
+        const bool ready = co_await Async::Reactor::instance().ready(
+            io.fd(), EPOLLIN, Async::Deadline(std::chrono::microseconds(wake)));
+        if (ready) break;
+    }
+    std::string line;
+    const bool got = co_await io.readLine(line);
+    co_return got && line.compare(0, 10, "<UDP_DONE>") == 0 ? 0 : 1;
+}
+
+// Ask for the next batch of our range over UDP. true = step() returns out
+// (waiting on the rate cap, or on the handshake); false = the lane is on GETs
+// for good (and disconnected if the stream broke).
+bool ChunkDownloader::Lane::udpStart(Result& out, TimePoint& wakeAt) {
+    // under a rate cap, about a second's worth at a time (it may have been
+    // set since the last batch)
+    long long batch = UDP_BATCH_BYTES;
+    const long long rates[2] = { RateLimiter::global().rate(), ctl.limiter().rate() };
+    for (int i = 0; i < 2; ++i) {
+        if (rates[i] > 0) batch = std::min(batch, rates[i]);
+    }
+    const int count = (int)std::min(rangeEnd - chunk, std::max(1LL, batch / t.chunkSize));
+
+    // the rate cap holds per batch, not just for the GET we paid for
+    const long long want = (long long)count * t.chunkSize;
+    if (want > reserved) {
+        const long long more = want - reserved;
+        reserved = want;
+        const std::chrono::microseconds wait = std::max(RateLimiter::global().reserve(more),
+                                                        ctl.limiter().reserve(more));
+        if (wait.count() > 0) {
+            wakeAt = std::chrono::steady_clock::now() + wait;
+            out = WAIT;
+            return true;
+        }
+    }
+
+    std::string request;
+    const int rc = udpRx.prepare(conn.sock().fd(), seeder, filename, chunk, count, t.chunkSize, request);
+    // no buffer for the batch: GET these, UDP again for the next
+    if (rc == 6) {
+        logDbg("DL: no buffer for a UDP batch, worker %d uses GET for now", index);
+        return false;
+    }
+    if (rc != 0) {
+        udpFailed(rc);
+        return false;
+    }
+    io = Async::Conn(conn.sock().fd());
+    io.unread(conn.sock().takeBuffered());
+    udpWait = UDP_BEGIN;
+    Async::start(udpBegin(io, udpRx, std::move(request)), std::function<void(int)>([this](int code) {
+        udpCode = code;
+        DownloadScheduler::instance().poke(this);
+    }));
+    out = BLOCKED;
+    return true;
+}
+
+void ChunkDownloader::Lane::udpBegun() {
+    if (udpCode != 0) {
+        udpFailed(udpCode);
+        return;
+    }
+    t.inflight.add(udpRx.first(), udpRx.first() + udpRx.count());
+    logDbg("DL: worker %d: chunks %lld-%lld over UDP", index, udpRx.first(), udpRx.first() + udpRx.count() - 1);
+}
+
+void ChunkDownloader::Lane::udpFailed(int rc) {
+    udpRx.close();
+    udpOn = false;
+    if (rc == 1) {
+        countError(seeder);
+        conn.discard();
+        connected = false;
+    }
+    logInfo("DL: no UDP from seeder %s (code=%d), worker %d uses GET", seeder.str().c_str(), rc, index);
+}
+
+// Take in what arrived for the current UDP batch, then wait on the reactor
+// for more
+SchedTask::Result ChunkDownloader::Lane::udpStep(long long& bytesOut) {
+    const long long first = udpRx.first();
+    bool broken = false;
+    const bool ok = udpRx.pump([&](int c, const char* data, size_t n) {
+        const int rc = commitChunk(t, index, first + c, data, n, tallyFor(seeder));
+        if (rc < 0) {
+            broken = true;
+            return false;
+        }
+        if (rc > 0) bytesOut += (long long)n;
+        return true;
+    });
+    if (broken) {
+        udpRx.close();
+        return fail();
+    }
+    if (!ok) {
+        logWarn("DL: UDP from seeder %s went quiet, worker %d back to GET", seeder.str().c_str(), index);
+        countError(seeder);
+        udpAbandon();
+        udpOn = false;
+        return MORE;
+    }
+
+    if (udpRx.done()) {
+        udpWait = UDP_FINISH;
+        Async::start(udpFinish(io, udpRx), std::function<void(int)>([this](int code) {
+            udpCode = code;
+            DownloadScheduler::instance().poke(this);
+        }));
+        return BLOCKED;
+    }
+
+    const Async::Deadline until = std::min(
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(UDP_POLL_MS),
+        Async::Deadline(std::chrono::microseconds(udpRx.wakeUs())));
+    Async::start(readable(udpRx.fd(), until), std::function<void(bool)>([this](bool) {
+        DownloadScheduler::instance().poke(this);
+    }));
+    return BLOCKED;
+}
+
+void ChunkDownloader::Lane::udpFinished() {
+    const long long first = udpRx.first();
+    chunk = first + udpRx.count();
+    // ones a hedge landed first are still marked ours
+    t.inflight.remove(first, chunk);
+    udpRx.close();
+    reserved = 0;      // spent on the batch
+    if (udpCode != 0 || !io.drained()) {
+        conn.discard();
+        connected = false;
+    }
+}
+
+// drop the UDP batch in flight: its missing chunks are up for grabs again
+void ChunkDownloader::Lane::udpAbandon() {
+    if (udpRx.fd() < 0) return;
+    t.inflight.remove(udpRx.first(), udpRx.first() + udpRx.count());
+    udpRx.close();
+    conn.discard();
+    connected = false;
+}
+
+// Duplicate one chunk. preferSeeder < 0 lets us pick any seeder other than
+// the one that owns the slow request. Connecting goes off the pool, the GET
+// onto the reactor like any other; onHedgeReply() takes the answer. Returns
+// false if there is nothing to do.
+bool ChunkDownloader::Lane::startHedge(int preferSeeder, Result& out, TimePoint& wakeAt) {
+    std::function<double(int)> thresholdMs = [this](int k) { return dl.hedgeThresholdMs(seeders[(size_t)k]); };
+
+    int ownerSeeder = -1;
+    const long long c = pickHedge(t, index, preferSeeder, ownerSeeder, thresholdMs);
+    if (c < 0) return false;
+
+    int target = preferSeeder;
+    if (target < 0) {
+        double best = 0;
+        for (int k = 0; k < (int)seeders.size(); ++k) {
+            if (k == ownerSeeder || !t.seederHas(k, c)) continue;
+            // seeders we have no numbers for go last
+            double score = thresholdMs(k);
+            if (score < 0) score = 1e9;
+            if (target < 0 || score < best) { target = k; best = score; }
+        }
+    }
+    if (target < 0) { t.hedged.remove(c); return false; }
+    hedgeChunk = c;
+    hedgeTarget = target;
+    hedgeOwner = ownerSeeder;
+
+    const Endpoint peer = seeders[(size_t)target];
+    if (conn.valid() && conn.peer() == peer) {
+        out = sendHedge();
+        return true;
+    }
+    connected = false;   // conn isn't our own seeder's any more
+    out = offload([this, peer]() { return conn.open(peer); }, [this](bool ok, Result& res, TimePoint& wake) {
+        if (ok) {
+            res = sendHedge();
+        } else {
+            t.hedged.remove(hedgeChunk);
+            res = hedgeIdle(wake);
+        }
+        return true;
+    });
+    (void)wakeAt;
+    return true;
+}
+
+SchedTask::Result ChunkDownloader::Lane::sendHedge() {
+    publishSlot(t, index, hedgeChunk, hedgeTarget, conn.sock().fd(), hedgeChunk + 1);
+    if (t.isDone(hedgeChunk)) {
+        // landed while we were connecting; commit only cancels published slots
+        clearSlot(t, index);
+        t.hedged.remove(hedgeChunk);
+        reserved = 0;
+        return MORE;
+    }
+    sendRequest(hedgeChunk, 1, true);
+    return BLOCKED;
+}
+
+// nothing to duplicate: give the bandwidth back and look again shortly
+SchedTask::Result ChunkDownloader::Lane::hedgeIdle(TimePoint& wakeAt) {
+    settle(0);
+    return retryLater(5, wakeAt);
+}
+
+bool ChunkDownloader::Lane::onHedgeReply(long long& bytesOut, Result& out) {
+    const long long c = hedgeChunk;
+    const Endpoint& peer = seeders[(size_t)hedgeTarget];
+    const bool ok = reply.ok;
+    const size_t n = ok ? reply.sizes[0] : 0;
+    const bool cancelled = clearSlot(t, index);
+    if (!ok) closePipe();
+
+    if (ok) {
+        PeerHealth::instance().success(peer);
+        dl.recordLatency(peer, (double)(nowUs() - reply.sentUs) / 1000.0);
+        const int rc = commitChunk(t, index, c, reply.piped ? nullptr : buf.data(), n, tallyFor(peer),
+                                   pipeFds[0], buf.data());
+        if (rc < 0) t.anyFailed.store(true);
+        else if (rc > 0) {
+            bytesOut += (long long)n;
+            logDbg("DL: hedge won chunk %lld via seeder %s (owner %s)", c, peer.str().c_str(),
+                   hedgeOwner >= 0 ? seeders[(size_t)hedgeOwner].str().c_str() : "-");
+        }
+    }
+    // busy: the seeder is short of buffers, not broken, and the conn is clean
+    const bool busy = !ok && reply.code == 5;
+    if (!ok && !cancelled && !busy) countError(peer);
+    if ((!ok && !busy) || cancelled) {
+        conn.discard();
+        connected = false;
+    }
+    // landed or not, isDone() keeps it from being hedged again
+    t.hedged.remove(c);
+    reserved = 0;
+    out = MORE;
+    return true;
+}
+
+// GET chunks c..c+count-1 on the reactor; the scheduler runs us again once
+// they're answered. hedge says which half of step() takes the reply
+void ChunkDownloader::Lane::sendRequest(long long c, int count, bool hedge) {
+    awaiting = true;
+    reply = Reply();
+    reply.hedge = hedge;
+    reply.sentUs = nowUs();
+    reply.sizes.reserve((size_t)count);
+    io = Async::Conn(conn.sock().fd());
+    io.unread(conn.sock().takeBuffered());
+
+    // a pipe holds one payload, so only single GETs splice
+    Async::SpliceTo splice;
+    if (count == 1 && openPipe()) {
+        splice.pipeWr = pipeFds[1];
+        splice.minBytes = SPLICE_MIN_BYTES;
+    }
+
+    const long long end = c + count;
+    Async::Task<Async::RangeResult> get = Async::range(io, filename, c, count, t.chunkSize, buf.data(),
+        [this, end](long long idx, const char* data, size_t n) {
+            reply.piped = data == nullptr;
+            reply.sizes.push_back(n);
+            if (!reply.hedge) {
+                // each reply of a run counts from the one before it, like
+                // the hedger sees it
+                const long long now = nowUs();
+                dl.recordLatency(seeder, (double)(now - t.slots[index].sentUs.load()) / 1000.0);
+                if (idx + 1 < end) moveSlot(t, index, idx + 1);
+            }
+            return true;
+        }, splice);
+    Async::start(std::move(get), std::function<void(Async::RangeResult)>([this, count](Async::RangeResult r) {
+        reply.ok = r.code == 0 && r.received == count && io.drained();
+        reply.code = reply.ok ? 0 : (r.code != 0 ? r.code : 1);
+        if (reply.code == 5 && !io.drained()) reply.code = 1;
+        DownloadScheduler::instance().poke(this);
+    }));
+}
+
+void ChunkDownloader::Lane::onConnected() {
+    connected = true;
+    consecutiveFailures = 0;
+    if (t.prog) t.prog->pending.store(false);
+
+    if (t.pooled) {
+        logInfo("DL: worker %d connected to seeder %s (%zu chunks to pick from)",
+                index, seeder.str().c_str(), order.size() - orderPos + 1);
+    } else {
+        logInfo("DL: worker %d connected to seeder %s for chunks %lld-%lld",
+                index, seeder.str().c_str(), t.ranges[(size_t)index].start, rangeEnd - 1);
+    }
+}
+
+SchedTask::Result ChunkDownloader::Lane::connectFailed(TimePoint& wakeAt) {
+    countError(seeder);
+    consecutiveFailures++;
+
+    // someone may have found it down already (or it is now)
+    if (consecutiveFailures >= MAX_RETRIES_PER_SEEDER || !PeerHealth::instance().usable(seeder)) {
+        logWarn("DL: seeder %s seems down, switching (worker %d)", seeder.str().c_str(), index);
+        consecutiveFailures = 0;
+        return switchSeeder(wakeAt);
+    }
+    return retryLater(retryMs(), wakeAt);
+}
+
+// Second half of a request: true = step() returns out right away,
+// false = carry on with the next chunk
+bool ChunkDownloader::Lane::onReply(long long& bytesOut, TimePoint& wakeAt, Result& out) {
+    const bool ok = reply.ok;
+    const int code = reply.code;
+    // a failed reply may have left half a payload in the pipe
+    const size_t got = ok || !reply.piped ? reply.sizes.size() : 0;
+    const bool cancelled = clearSlot(t, index);
+    if (!ok) closePipe();
+
+    // what came in before a failure counts (a hedge may have beaten us to it)
+    long long used = 0;
+    for (size_t i = 0; i < got; ++i) {
+        const size_t n = reply.sizes[i];
+        const char* data = reply.piped ? nullptr : buf.data() + i * (size_t)t.chunkSize;
+        const int rc = commitChunk(t, index, chunk + (long long)i, data, n, tallyFor(seeder), pipeFds[0], buf.data());
+        if (rc < 0) {
+            out = fail();
+            return true;
+        }
+        if (rc > 0) bytesOut += (long long)n;
+        used += (long long)n;
+    }
+
+    // the whole run is in (a failure past it only means the stream is off)
+    const bool whole = got == (size_t)runLen;
+    if (got > 0) {
+        consecutiveFailures = 0;
+        PeerHealth::instance().success(seeder);
+        settle(used);
+        chunk += (long long)got - (whole ? 1 : 0);
+    }
+    if (whole) {
+        if (!ok || cancelled) {
+            conn.discard();
+            connected = false;
+        }
+        if (cancelled && ctl.stopRequested()) {
+            out = finish();
+            return true;
+        }
+        advance();
+        return false;
+    }
+
+    // from here on chunk is the one that failed. Replies to the rest of the
+    // run are still coming: that socket is no good to anyone (busy read past them)
+    if (got + 1 < (size_t)runLen && code != 5) {
+        conn.discard();
+        connected = false;
+    }
+    if (cancelled) {
+        // a duplicate won (or the job was cancelled) and shut our socket down
+        conn.discard();
+        connected = false;
+        if (ctl.stopRequested()) {
+            out = finish();
+            return true;
+        }
+        advance();
+        return false;
+    }
+
+    // out of buffers over there: not a failure, same socket, a little later
+    if (code == 5) {
+        logDbg("DL: seeder %s busy at chunk %lld (worker %d)", seeder.str().c_str(), chunk, index);
+        out = retryLater(RETRY_BASE_MS, wakeAt);
+        return true;
+    }
+
+    // relay chain: the member ahead of us hasn't got this chunk either (it
+    // held our request a while already). Ask again, unless it stopped moving.
+    if (t.chain && (code == 2 || code == 4)) {
+        const long long idleUs = nowUs() - std::max(t.lastCommitUs.load(), upstreamSinceUs);
+        if (code == 4 && idleUs < CHAIN_STALL_MS * 1000LL) {
+            out = retryLater(CHAIN_RETRY_MS, wakeAt);
+            return true;
+        }
+        logWarn("DL: chain upstream %s %s (worker %d)", seeder.str().c_str(),
+                code == 2 ? "dropped the file" : "stopped moving", index);
+        countError(seeder);
+        conn.release();
+        connected = false;
+        if (++seederSwitchCount > CHAIN_MAX_REJOINS) {
+            logErr("DL: relay chain of '%s' keeps breaking, giving up", filename.c_str());
+            out = fail();
+            return true;
+        }
+        out = offload([this]() { return rejoinChain(); }, [this](bool ok, Result& res, TimePoint&) {
+            if (ok) return false;
+            logErr("DL: relay chain of '%s' keeps breaking, giving up", filename.c_str());
+            res = fail();
+            return true;
+        });
+        return true;
+    }
+
+    countError(seeder);
+    if (code == 1) {
+        // TEMP failure -> reconnect; if too many, switch seeders
+        logWarn("DL: temp failure chunk %lld from seeder %s (worker %d)",
+                chunk, seeder.str().c_str(), index);
+
+        conn.discard();
+        connected = false;
+        consecutiveFailures++;
+        PeerHealth::instance().failure(seeder);
+
+        if (consecutiveFailures >= MAX_RETRIES_PER_SEEDER || !PeerHealth::instance().usable(seeder)) {
+            logWarn("DL: switching seeder for worker %d (current %s)", index, seeder.str().c_str());
+            consecutiveFailures = 0;
+            out = switchSeeder(wakeAt);
+            return true;
+        }
+
+        out = retryLater(retryMs(), wakeAt);
+        return true;
+    }
+
+    // partial seeder dropped the file or hasn't got the chunk after all:
+    // try another one, this lane alone doesn't sink the download
+    if (t.pooled && (code == 2 || code == 4)) {
+        logWarn("DL: seeder %s can't serve chunk %lld (code=%d, worker %d)",
+                seeder.str().c_str(), chunk, code, index);
+        conn.release();
+        connected = false;
+        if (++seederSwitchCount > maxSwitches() || !pickNextSeeder()) {
+            unclaim();
+            out = finish();
+            return true;
+        }
+        return false;
+    }
+
+    // Permanent failure: keep your current behavior (fail whole download)
+    logErr("DL: permanent fail chunk %lld from seeder %s code=%d",
+           chunk, seeder.str().c_str(), code);
+    out = fail();
+    return true;
+}
+
+SchedTask::Result ChunkDownloader::Lane::step(long long& bytesOut, TimePoint& wakeAt) {
+    DownloadProgress* prog = t.prog;
+
+    // the request we sent last time got answered
+    if (awaiting) {
+        awaiting = false;
+        Result out;
+        if (reply.hedge ? onHedgeReply(bytesOut, out) : onReply(bytesOut, wakeAt, out)) return out;
+    }
+    // so did whatever we offloaded
+    if (resume) {
+        Then then = std::move(resume);
+        resume = nullptr;
+        Result out;
+        if (then(offloadOk, out, wakeAt)) return out;
+    }
+    // ... or the UDP handshake / closing line
+    if (udpWait != UDP_NONE) {
+        const UdpWait was = udpWait;
+        udpWait = UDP_NONE;
+        if (was == UDP_BEGIN) udpBegun();
+        else udpFinished();
+    }
+
+    if (ctl.stopRequested() || t.anyFailed.load()) {
+        udpRx.close();
+        conn.discard();
+        return finish();
+    }
+    if (ctl.paused()) {
+        // hand the socket back while we sit out
+        udpAbandon();
+        conn.release();
+        connected = false;
+        return PARKED;
+    }
+    // at the pool's cap: wait for a buffer here rather than hold a thread
+    if (!buf) {
+        // splicing lanes go a chunk at a time, the pipe holds one
+        if (!hedger && !t.zeroCopy)
+            depth = (int)std::max(1LL, std::min((long long)PIPELINE_MAX, PIPELINE_BYTES / t.chunkSize));
+        buf = BufferPool::instance().get((size_t)t.chunkSize * (size_t)depth, BufferPool::DOWNLOAD);
+        if (!buf) return retryLater(BUFFER_RETRY_MS, wakeAt);
+    }
+    if (udpRx.fd() >= 0) return udpStep(bytesOut);
+
+    // the hedger: duplicate whatever runs past its seeder's p95
+    if (hedger) {
+        if (seeders.size() < 2 || t.liveWorkers.load() == 0 || t.remaining.load() == 0)
+            return finish();
+        if (throttle(wakeAt)) return WAIT;
+        Result out;
+        if (startHedge(-1, out, wakeAt)) return out;
+        return hedgeIdle(wakeAt);
+    }
+
+    // endgame: help finish the stragglers from our own seeder
+    if (rangeDone) {
+        if (t.remaining.load() == 0) return finish();
+
+        // pooled: chunks nobody could take yet, maybe our seeder has them by now
+        if (t.pooled && nowUs() - haveCheckedUs >= HAVE_REFRESH_MS * 1000LL) {
+            haveCheckedUs = nowUs();
+            return offload([this]() { refreshHave(); return true; }, [this](bool, Result& out, TimePoint&) {
+                rebuildOrder();
+                advance();
+                if (chunk < rangeEnd) {
+                    rangeDone = false;
+                    out = MORE;
+                    return true;
+                }
+                if (nowUs() - t.lastCommitUs.load() > RAREST_STALL_MS * 1000LL) {
+                    logErr("DL: no seeder has the remaining %lld chunks of '%s'",
+                           t.remaining.load(), filename.c_str());
+                    out = fail();
+                    return true;
+                }
+                return false;
+            });
+        }
+        if (throttle(wakeAt)) return WAIT;
+        Result out;
+        if (startHedge((int)curIdx, out, wakeAt)) return out;
+        return hedgeIdle(wakeAt);
+    }
+
+    while (chunk < rangeEnd) {
+        t.cursor[index].store(chunk);
+
+        // a hedge already landed this one
+        if (t.isDone(chunk)) {
+            advance();
+            continue;
+        }
+
+        // the sink is behind: don't run further ahead of it
+        if (t.sinkFull(chunk)) return retryLater(SINK_WAIT_MS, wakeAt);
+
+        if (throttle(wakeAt)) return WAIT;
+
+        // Establish connection
+        if (!connected) {
+            if (prog) prog->pending.store(true);
+            // the connect (and a dead seeder's timeout) waits off the pool
+            const Endpoint peer = seeder;
+            return offload([this, peer]() { return conn.open(peer); }, [this](bool ok, Result& out, TimePoint& wake) {
+                if (!ok) {
+                    out = connectFailed(wake);
+                    return true;
+                }
+                onConnected();
+                return false;
+            });
+        }
+
+        if (udpOn) {
+            Result out;
+            if (udpStart(out, wakeAt)) return out;
+            if (!connected) continue;
+        }
+
+        // Fetch chunk
+        t.claim(chunk);
+
+        const int count = extendRun();
+        publishSlot(t, index, chunk, (int)curIdx, conn.sock().fd(), chunk + count);
+        if (t.isDone(chunk)) {
+            // a hedge landed it while we were connecting/throttled
+            clearSlot(t, index);
+            advance();
+            continue;
+        }
+
+        // the pool thread is free while it's on the wire; the chunks after
+        // this one go out with it, the replies come back in order
+        sendRequest(chunk, count, false);
+        return BLOCKED;
+    }
+
+    if (chunk >= rangeEnd) {
+        rangeDone = true;
+        t.cursor[index].store(rangeEnd);
+        logInfo("DL: worker %d completed segment", index);
+    }
+    return MORE;
+}
+
+// Keeps a download offered for partial seeding until it goes out of scope,
+// i.e. after the final file is in place (or the parts are gone)
+struct PartialListing {
+    PartialListing(PartialFiles* files, const std::string& name) : files(files), name(name) {}
+    ~PartialListing() {
+        if (files && file) {
+            files->withdraw(name, file);
+            file->finish();
+        }
+    }
+
+    void publish(const std::shared_ptr<PartialFile>& f) {
+        file = f;
+        files->publish(name, file);
+    }
+
+    PartialFiles* files;
+    std::string name;
+    std::shared_ptr<PartialFile> file;
+};
+
+bool ChunkDownloader::download(const std::string& filename,
+                              const std::vector<Endpoint>& seeders,
+                              int myPort,
+                              DownloadProgress* prog)
+{
+    JobControl ctl;
+    return download(filename, seeders, myPort, prog, ctl);
+}
+
+bool ChunkDownloader::download(const std::string& filename,
+                              const std::vector<Endpoint>& seeders,
+                              int myPort,
+                              DownloadProgress* prog,
+                              JobControl& ctl)
+{
+    return download(filename, seeders, myPort, prog, ctl, DownloadOptions());
+}
+
+// A download() in progress; later calls for the same file wait on it
+struct ChunkDownloader::Inflight {
+    std::mutex mu;
+    std::condition_variable cv;
+    DownloadProgress* prog = nullptr;     // the leader's (or own), until it returns
+    DownloadProgress own;                 // for a leader that brought none
+    bool done = false;
+    bool ok = false;
+    bool cancelled = false;               // its job was cancelled: a waiter goes again
+
+    // final numbers for the waiters
+    long long totalBytes = 0;
+    long long totalChunks = 0;
+    std::vector<SeederTally> rows;
+};
+
+static const int FOLLOW_POLL_MS = 100;    // waiters refresh their progress this often
+
+// the leader's numbers as a waiter's (roll-up slots only)
+static void mirrorProgress(DownloadProgress& to, long long totalBytes, long long totalChunks,
+                           const std::vector<SeederTally>& rows)
+{
+    to.totalBytes.store(totalBytes);
+    to.totalChunks.store(totalChunks);
+    for (size_t k = 0; k < rows.size(); ++k)
+        to.set(-1, rows[k].peer, rows[k].bytes, rows[k].chunks, rows[k].errors);
+}
+
+// Ends a caller's sink exactly once, however downloadAsync() returns
+struct SinkEnd {
+    DownloadSink* sink;
+    bool ended = false;
+
+    explicit SinkEnd(DownloadSink* s) : sink(s) {}
+    ~SinkEnd() { end(false); }
+
+    bool end(bool ok) {
+        if (!sink || ended) return ok;
+        ended = true;
+        return sink->end(ok);
+    }
+};
+
+// the finished file into a waiter's stream sink, like the feeder would;
+// ending it is the caller's
+static bool copyToSink(const std::string& path, DownloadSink& to) {
+    BufferPool::Buffer buf = BufferPool::instance().get(DISK_BUF, BufferPool::DISK, DISK_BUF_WAIT_MS);
+    const int in = buf ? ::open(path.c_str(), O_RDONLY) : -1;
+    struct stat st;
+    if (in < 0 || ::fstat(in, &st) != 0 || !to.begin((long long)st.st_size)) {
+        logWarn("DL: cannot stream '%s'", path.c_str());
+        if (in >= 0) ::close(in);
+        return false;
+    }
+
+    long long sent = 0;
+    bool ok = true;
+    while (ok) {
+        const ssize_t n = ::read(in, buf.data(), buf.size());
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        ok = to.write(sent, buf.data(), (size_t)n);
+        sent += (long long)n;
+    }
+    ::close(in);
+    return ok;
+}
+
+// A follower's copy of the leader's bytes into a sink of its own, as far as
+// they are final: the leader's .part while it is at it, else the file
+struct Tail {
+    DownloadSink* to;
+    std::string path;
+    int fd = -1;
+    bool begun = false;
+    long long sent = 0;
+    BufferPool::Buffer buf;
+
+    Tail(DownloadSink* s, const std::string& outPath) : to(s), path(outPath) {}
+    ~Tail() { if (fd >= 0) ::close(fd); }
+
+    // up to upTo of size; done = the leader renamed its .part into place
+    bool feed(long long size, long long upTo, bool done) {
+        if (fd < 0) {
+            const std::string from = done ? path : path + ".part";
+            fd = ::open(from.c_str(), O_RDONLY | O_CLOEXEC);
+            // renamed into place under us: the finished file will do
+            if (fd < 0 && errno == ENOENT && !done) return true;
+            if (fd < 0) {
+                logWarn("DL: cannot follow '%s'", from.c_str());
+                return false;
+            }
+        }
+        if (!begun) {
+            if (!to->begin(size)) return false;
+            begun = true;
+        }
+        if (!buf) buf = BufferPool::instance().get(DISK_BUF, BufferPool::DISK, DISK_BUF_WAIT_MS);
+        if (!buf) return false;
+
+        while (sent < upTo) {
+            const size_t want = (size_t)std::min((long long)buf.size(), upTo - sent);
+            const ssize_t n = ::pread(fd, buf.data(), want, (off_t)sent);
+            if (n <= 0 || !to->write(sent, buf.data(), (size_t)n)) return false;
+            sent += (long long)n;
+        }
+        return true;
+    }
+};
+
+// Sit out someone else's download of the same file. 1 = it got the file,
+// 0 = it failed, -1 = its job was cancelled, -2 = ours was. With to, its bytes
+// go there too: as they become final behind an in-order leader, else once it
+// is done (0 if that fails). fed = bytes that went there.
+int ChunkDownloader::follow(Inflight& f, DownloadProgress* prog, JobControl& ctl,
+                            DownloadSink* to, const std::string& outPath, long long* fed)
+{
+    if (prog) {
+        prog->reset();
+        prog->active.store(true);
+        prog->pending.store(true);
+        prog->failed.store(false);
+        prog->success.store(false);
+    }
+
+    Tail tail(to, outPath);
+    int rc = 1;
+    std::unique_lock<std::mutex> lock(f.mu);
+    while (!f.done) {
+        if (ctl.stopRequested()) {
+            rc = -2;
+            break;
+        }
+        long long ready = -1, size = -1;
+        if (f.prog) {
+            if (prog) {
+                mirrorProgress(*prog, f.prog->totalBytes.load(), f.prog->totalChunks.load(), f.prog->bySeeder());
+                prog->readyBytes.store(f.prog->readyBytes.load());
+                prog->pending.store(f.prog->pending.load());
+            }
+            // only an in-order leader moves it before the end
+            ready = f.prog->readyBytes.load();
+            size = f.prog->totalBytes.load();
+        }
+        if (to && ready > tail.sent) {
+            lock.unlock();
+            const bool fedOk = tail.feed(size, ready, false);
+            lock.lock();
+            if (!fedOk) {
+                rc = 0;
+                break;
+            }
+        }
+        f.cv.wait_for(lock, std::chrono::milliseconds(FOLLOW_POLL_MS));
+    }
+    if (f.done) rc = f.cancelled ? -1 : (f.ok ? 1 : 0);
+    const long long totalBytes = f.totalBytes;
+    if (prog && f.done) mirrorProgress(*prog, totalBytes, f.totalChunks, f.rows);
+    lock.unlock();
+
+    // the rest (or all of it) from the finished file
+    if (rc == 1 && to && !tail.feed(totalBytes, totalBytes, true)) rc = 0;
+    if (fed) *fed = tail.sent;
+
+    if (prog) {
+        if (rc == 1) prog->readyBytes.store(totalBytes);
+        prog->pending.store(false);
+        prog->active.store(false);
+        if (rc >= 0) {
+            prog->success.store(rc == 1);
+            prog->failed.store(rc == 0);
+        }
+    }
+    return rc;
+}
+
+bool ChunkDownloader::download(const std::string& filename,
+                              const std::vector<Endpoint>& seeders,
+                              int myPort,
+                              DownloadProgress* prog,
+                              JobControl& ctl,
+                              const DownloadOptions& opts)
+{
+    const std::string outPath = portDirectory(myPort) + "/" + filename;
+
+    // the bytes go to a sink of the caller's: ride along with whoever is
+    // fetching the file already, else fetch it without claiming it
+    if (opts.sink) {
+        const std::shared_ptr<Inflight> other = findInflight(outPath);
+        if (other) {
+            logInfo("DL: '%s' is already coming in, sharing that download", filename.c_str());
+            long long fed = 0;
+            const int rc = follow(*other, prog, ctl, opts.sink, outPath, &fed);
+            if (rc == 1) return opts.sink->end(true);
+            if (rc != -1 || fed > 0 || ctl.stopRequested()) {
+                opts.sink->end(false);
+                return false;
+            }
+        }
+        return Async::syncWait(downloadAsync(filename, seeders, myPort, prog, ctl, opts));
+    }
+
+    DownloadOptions o = opts;
+    while (true) {
+        std::shared_ptr<Inflight> other;
+        const std::shared_ptr<Inflight> lead = leadInflight(outPath, prog, other);
+        if (other) {
+            logInfo("DL: '%s' is already coming in, sharing that download", filename.c_str());
+            long long fed = 0;
+            const int rc = follow(*other, prog, ctl, o.streamTo, outPath, &fed);
+            // its job went away but we still want the file: one of us goes again
+            // (a stream that got part of it can't be rewound, the file still can)
+            if (rc == -1 && !ctl.stopRequested()) {
+                if (o.streamTo && fed > 0) {
+                    o.streamTo->end(false);
+                    o.streamTo = nullptr;
+                }
+                continue;
+            }
+
+            if (o.streamTo) o.streamTo->end(rc == 1);
+            return rc == 1;
+        }
+
+        DownloadProgress* const watched = prog ? prog : &lead->own;
+        const bool ok = Async::syncWait(downloadAsync(filename, seeders, myPort, watched, ctl, o));
+        endInflight(outPath, lead, ok, ctl.stopRequested(), watched);
+        return ok;
+    }
+}
+
+// Ours to fetch, or other = whoever fetches it already
+std::shared_ptr<ChunkDownloader::Inflight> ChunkDownloader::leadInflight(const std::string& outPath,
+                                                                         DownloadProgress* prog,
+                                                                         std::shared_ptr<Inflight>& other)
+{
+    std::lock_guard<std::mutex> lock(inflightMu_);
+    std::shared_ptr<Inflight>& slot = inflight_[outPath];
+    if (slot) {
+        other = slot;
+        return nullptr;
+    }
+    slot = std::make_shared<Inflight>();
+    slot->prog = prog ? prog : &slot->own;
+    return slot;
+}
+
+std::shared_ptr<ChunkDownloader::Inflight> ChunkDownloader::findInflight(const std::string& outPath) {
+    std::lock_guard<std::mutex> lock(inflightMu_);
+    std::map<std::string, std::shared_ptr<Inflight> >::iterator it = inflight_.find(outPath);
+    return it == inflight_.end() ? nullptr : it->second;
+}
+
+// again = we didn't get it but mean no harm: a waiter fetches it itself
+void ChunkDownloader::endInflight(const std::string& outPath, const std::shared_ptr<Inflight>& lead,
+                                  bool ok, bool again, DownloadProgress* prog)
+{
+    {
+        std::lock_guard<std::mutex> lock(inflightMu_);
+        inflight_.erase(outPath);
+    }
+    {
+        std::lock_guard<std::mutex> lock(lead->mu);
+        lead->done = true;
+        lead->ok = ok;
+        lead->cancelled = again;
+        if (prog) {
+            lead->totalBytes = prog->totalBytes.load();
+            lead->totalChunks = prog->totalChunks.load();
+            lead->rows = prog->bySeeder();
+        }
+        lead->prog = nullptr;
+    }
+    lead->cv.notify_all();
+}
+
+Async::Task<bool> ChunkDownloader::downloadAsync(std::string filename,
+                                                 std::vector<Endpoint> seeders,
+                                                 int myPort,
+                                                 DownloadProgress* prog,
+                                                 JobControl& ctl,
+                                                 DownloadOptions opts)
+{
+    // the thread waiting on us; everything up to the lanes runs on it anyway
+    Async::Home* home = Async::Home::current();
+    // a caller's sinks are ended whichever way this returns
+    SinkEnd sinkEnd(opts.sink);
+    SinkEnd streamEnd(opts.streamTo);
+
+    if (seeders.empty()) {
+        logErr("DL: no seeders provided for '%s'", filename.c_str());
+        co_return false;
+    }
+
+    if (prog) {
+        prog->reset();
+        prog->active.store(true);
+        prog->pending.store(false);
+        prog->failed.store(false);
+        prog->success.store(false);
+    }
+
+    // small files come back whole with META+: no part files, no lanes. It
+    // asked every seeder for the size too, so no answer there is the answer
+    long long fileSize = opts.knownSize;
+    if (fileSize < 0 || fileSize <= INLINE_MAX) {
+        long long size = -1;
+        std::string data;
+        bool inlined = false;
+        Endpoint from;
+        const bool known = co_await probeInline(filename, seeders, size, data, inlined, from);
+        if (known) fileSize = size;
+
+        if (inlined) {
+            const std::string outPath = portDirectory(myPort) + "/" + filename;
+            bool ok;
+            if (opts.sink) {
+                ok = opts.sink->begin(size) && opts.sink->write(0, data.data(), data.size());
+                ok = sinkEnd.end(ok);
+            } else {
+                ok = writeWhole(outPath, data);
+            }
+            if (prog) {
+                prog->totalBytes.store(size);
+                prog->totalChunks.store((size + chunkSize_ - 1) / chunkSize_);
+                if (ok) {
+                    prog->put(-1, from, size, (size + chunkSize_ - 1) / chunkSize_);
+                    prog->readyBytes.store(size);
+                }
+                prog->success.store(ok);
+                prog->failed.store(!ok);
+                prog->active.store(false);
+            }
+            if (opts.streamTo && !opts.sink) streamEnd.end(ok && copyToSink(outPath, *opts.streamTo));
+            if (!ok) co_return false;
+
+            if (store_ && !opts.sink) store_->addFile(filename);
+            logInfo("DL COMPLETE file='%s' bytes=%lld inline from %s", filename.c_str(), size, from.str().c_str());
+            co_return true;
+        }
+    }
+
+    // relay chain: joined once our copy is listed (below), laid out for it now
+    const bool chainWanted = opts.chain && !opts.sink;
+
+    if (fileSize < 0) {
+        if (prog) {
+            prog->failed.store(true);
+            prog->active.store(false);
+        }
+        logErr("DL meta failed file='%s' seeders=%zu", filename.c_str(), seeders.size());
+        co_return false;
+    }
+
+    const long long totalChunks = (fileSize + chunkSize_ - 1) / chunkSize_;
+    if (prog) {
+        prog->totalBytes.store(fileSize);
+        prog->totalChunks.store(totalChunks);
+    }
+
+    logInfo("DL start file='%s' size=%lld chunks=%lld seeders=%zu", 
+            filename.c_str(), fileSize, totalChunks, seeders.size());
+
+    // ALWAYS create parts equal to number of seeders (even if 1)
+    int parts = (int)seeders.size();
+
+    const std::string baseDir = portDirectory(myPort);
+    const std::string outPath = baseDir + "/" + filename;
+
+    Transfer t;
+    t.totalChunks = totalChunks;
+    t.chunkSize = chunkSize_;
+    t.fileSize = fileSize;
+    t.chainSelf = opts.self;
+    // in order, so whoever pulls from us finds the next chunk right behind
+    t.sink = opts.sink;
+    t.sinkAhead = std::max((long long)PIPELINE_MAX * 2, SINK_AHEAD_BYTES / chunkSize_);
+    t.sequential = opts.streaming || chainWanted || (t.sink && t.sink->ordered());
+    t.zeroCopy = opts.zeroCopy && !t.sink && (size_t)chunkSize_ >= SPLICE_MIN_BYTES;
+    t.prog = prog;
+    t.remaining.store(totalChunks);
+    t.cursor.reset(new std::atomic<long long>[(size_t)parts]);
+    t.slotCount = parts + 1;                 // last slot belongs to the hedger
+    t.lastCommitUs.store(nowUs());
+
+    // who has what; any seeder that is itself still downloading switches the
+    // lanes to rarest-first over the chunks their seeder holds
+    t.seeders = seeders;
+    t.haves.reset(new SeederHave[seeders.size()]);
+    if (totalChunks > 0 && !chainWanted) {
+        std::vector<char> full(seeders.size(), 1);
+        // all at once on the reactor, then back on this thread
+        std::vector<Async::Task<void> > askers;
+        for (size_t i = 0; i < seeders.size(); ++i)
+            askers.push_back(askHave(seeders[i], filename, totalChunks, full[i], t.haves[i].chunks));
+        co_await Async::whenAll(std::move(askers));
+
+        int partial = 0;
+        for (size_t i = 0; i < seeders.size(); ++i) {
+            if (full[i]) t.haves[i].full.store(true);
+            else ++partial;
+        }
+        t.pooled = partial > 0;
+        if (t.pooled) {
+            logInfo("DL: %d of %zu seeders are partial, picking rarest chunks first", partial, seeders.size());
+        }
+    }
+    // the UDP sender paces itself, there is no per chunk request to throttle
+    t.udp = opts.udp && !t.pooled && !t.sequential;
+    t.slots.reset(new RequestSlot[(size_t)t.slotCount]);
+
+    // Split chunk ranges among parts: [start, end)
+    // (streaming: everyone works the whole file in order, one output file)
+    t.ranges.resize((size_t)parts);
+    for (int i = 0; i < parts; ++i) {
+        const long long start = t.sequential ? 0 : (totalChunks * i) / parts;
+        const long long end   = t.sequential ? totalChunks : (totalChunks * (i + 1)) / parts;
+        t.ranges[(size_t)i] = Range{ start, end };
+        t.cursor[i].store(start);
+        if (!t.sequential && !t.pooled) {
+            logInfo("Part %d: chunks %lld-%lld (seeder %s)", 
+                    i, start, end - 1, seeders[i].str().c_str());
+        }
+    }
+    if (t.sequential) t.parts.assign(1, Range{ 0, totalChunks });
+    else t.parts = t.ranges;
+
+    // creating part paths (opened up front so any requester can write any chunk)
+    const int files = t.sink ? 0 : (int)t.parts.size();
+    std::vector<std::string> partPaths((size_t)files);
+    t.partFds.assign((size_t)files, -1);
+    for (int i = 0; i < files; ++i) {
+        char suffix[32];
+        if (t.sequential) std::snprintf(suffix, sizeof(suffix), ".part");
+        else std::snprintf(suffix, sizeof(suffix), ".part%d", i);
+        partPaths[(size_t)i] = outPath + suffix;
+        std::remove(partPaths[(size_t)i].c_str());
+
+        t.partFds[(size_t)i] = ::open(partPaths[(size_t)i].c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (t.partFds[(size_t)i] < 0) {
+            logErr("DL: cannot create part '%s'", partPaths[(size_t)i].c_str());
+            t.anyFailed.store(true);
+        }
+    }
+    std::thread sinkFeeder;
+    if (t.sink && !t.sink->begin(fileSize)) {
+        logErr("DL: sink refused '%s' (%lld bytes)", filename.c_str(), fileSize);
+        t.anyFailed.store(true);
+    } else {
+        if (t.sink) sinkFeeder = std::thread(feedSink, std::ref(t));
+        if (t.sequential) logInfo("DL: streaming into '%s' in order", t.sink ? "sink" : partPaths[0].c_str());
+    }
+
+    // reuse whatever we already have locally (other versions of the same data)
+    if (store_ && !t.sink && !t.anyFailed.load() && fileSize > 0) {
+        std::vector<CdcChunk> remote;
+        for (size_t i = 0; i < seeders.size(); ++i) {
+            if (fetchHashes(filename, seeders[i], remote)) break;
+            remote.clear();
+        }
+        if (!remote.empty()) {
+            const long long reused = prefillFromStore(t, *store_, remote, fileSize);
+            advanceReady(t);
+            logInfo("DL: reused %lld of %lld bytes from local chunks (%lld chunks left to fetch)",
+                    reused, fileSize, t.remaining.load());
+        }
+    }
+
+    // seed what we have (and whatever lands) while the rest comes in
+    PartialListing listing(partials_, filename);
+    if (partials_ && !t.sink && !t.anyFailed.load() && totalChunks > 0) {
+        std::shared_ptr<PartialFile> shared = std::make_shared<PartialFile>(fileSize, chunkSize_);
+        bool opened = true;
+        for (size_t i = 0; i < t.parts.size() && opened; ++i) {
+            opened = shared->addPart(partPaths[i], t.parts[i].start);
+        }
+        if (opened) {
+            const std::vector<std::pair<long long, long long> > have = t.done.runsIn(0, totalChunks);
+            for (size_t i = 0; i < have.size(); ++i) shared->mark(have[i].first, have[i].second);
+            t.shared = shared;
+            listing.publish(shared);
+        }
+    }
+
+    // only now join the chain: whoever joins right behind us asks us for
+    // META and chunks straight away. The one lane pulls from whoever joined
+    // before us
+    if (chainWanted && !t.anyFailed.load()) {
+        Endpoint head, upstream;
+        if (joinChain(filename, seeders, opts.self, Endpoint(), head, upstream)) {
+            logInfo("DL: '%s' in the relay chain of %s, pulling from %s",
+                    filename.c_str(), head.str().c_str(), upstream.str().c_str());
+            t.chain = true;
+            t.chainSeeders = seeders;
+            t.chainHead = head;
+            seeders.assign(1, upstream);
+            t.seeders = seeders;
+            parts = 1;
+            t.slotCount = parts + 1;
+            t.ranges.assign(1, Range{ 0, totalChunks });
+        } else {
+            logInfo("DL: no seeder heads a relay chain for '%s', plain download", filename.c_str());
+        }
+    }
+
+    // streaming to a second sink: a feeder copies the ready prefix as it grows
+    bool feedStop = false;
+    bool streamed = false;
+    std::thread feeder;
+    if (t.sequential && !t.sink && opts.streamTo && !t.anyFailed.load()) {
+        feeder = std::thread(feedStream, std::ref(t), partPaths[0], opts.streamTo,
+                             std::ref(feedStop), std::ref(streamed));
+    }
+
+    // one lane per seeder + the hedger, all run by the shared scheduler
+    t.liveWorkers.store(parts);
+    std::vector<std::unique_ptr<Lane> > lanes;
+    std::vector<SchedTask*> tasks;
+    if (!t.anyFailed.load()) {
+        for (int i = 0; i <= parts; ++i) {
+            lanes.push_back(std::unique_ptr<Lane>(new Lane(*this, t, ctl, filename, seeders, i)));
+            tasks.push_back(lanes.back().get());
+        }
+        co_await DownloadScheduler::instance().runAsync(ctl, tasks);
+        // the last lane's pool thread resumed us: joins, merging and renames
+        // are for the caller's thread, not the pool's
+        co_await Async::resumeOn(home);
+    }
+    lanes.clear();
+    if (t.chain) leaveChain(filename, t.chainHead, t.chainSelf);
+
+    if (feeder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(t.readyMu);
+            feedStop = true;
+        }
+        t.readyCv.notify_all();
+        feeder.join();
+    }
+    streamEnd.end(streamed);
+    if (sinkFeeder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(t.sinkMu);
+            t.sinkStop = true;
+        }
+        t.sinkCv.notify_all();
+        sinkFeeder.join();
+    }
+    for (size_t i = 0; i < t.partFds.size(); ++i) {
+        if (t.partFds[i] >= 0) ::close(t.partFds[i]);
+    }
+
+    if (ctl.stopRequested()) {
+        logInfo("DL cancelled file='%s'", filename.c_str());
+        if (prog) {
+            prog->active.store(false);
+            prog->pending.store(false);
+        }
+        for (size_t i = 0; i < partPaths.size(); ++i) {
+            std::remove(partPaths[i].c_str());
+        }
+        sinkEnd.end(false);
+        co_return false;
+    }
+
+    // Check for failures
+    bool ok = !t.anyFailed.load() && t.remaining.load() == 0 && t.sinkQueued.load() == 0 &&
+              (!prog || !prog->failed.load());
+    if (t.sink) ok = sinkEnd.end(ok);
+    if (!ok) {
+        logErr("DL incomplete file='%s'", filename.c_str());
+        if (prog) {
+            prog->failed.store(true);
+            prog->active.store(false);
+        }
+        // Clean up partial files
+        for (size_t i = 0; i < partPaths.size(); ++i) {
+            std::remove(partPaths[i].c_str());
+        }
+        co_return false;
+    }
+
+    // Merge parts into final file
+    if (t.sink) {
+        // nothing here: it all went to the sink
+    } else if (files == 1) {
+        std::remove(outPath.c_str());
+        // Single part - try rename first, fallback to merge
+        if (std::rename(partPaths[0].c_str(), outPath.c_str()) == 0) {
+            logInfo("DL: renamed single part to final file");
+        } else {
+            logWarn("DL: rename failed, using merge");
+            if (!mergeParts(outPath, partPaths)) {
+                logErr("DL finalize failed (merge) out='%s'", outPath.c_str());
+                if (prog) {
+                    prog->failed.store(true);
+                    prog->active.store(false);
+                }
+                co_return false;
+            }
+            std::remove(partPaths[0].c_str());
+        }
+    } else {
         // Multiple parts - always merge
+        std::remove(outPath.c_str());
         if (!mergeParts(outPath, partPaths)) {
             logErr("DL merge failed out='%s'", outPath.c_str());
             if (prog) {
                 prog->failed.store(true);
                 prog->active.store(false);
             }
-            return false;
+            co_return false;
         }
         // Clean up parts
         for (size_t i = 0; i < partPaths.size(); ++i) {
@@ -513,20 +2811,535 @@ bool ChunkDownloader::download(const std::string& filename,
         prog->pending.store(false);
     }
 
-    logInfo("DL COMPLETE file='%s' bytes=%lld chunks=%d parts=%d",
-            filename.c_str(), fileSize, totalChunks, parts);
+    if (store_ && !t.sink) store_->addFile(filename);
 
-    return true;
+    logInfo("DL COMPLETE file='%s' bytes=%lld chunks=%lld parts=%d%s",
+            filename.c_str(), fileSize, totalChunks, files, t.sink ? " (sink)" : "");
+
+    co_return true;
+}
+
+// META for a batch of files from one seeder: all requests written up front,
+// replies read back in order. sizes[i] stays -1 for what it didn't answer
+static Async::Task<void> askMetas(Endpoint peer, std::vector<std::string> names, std::vector<long long>& sizes) {
+    Async::Lease lease;
+    if (!(co_await lease.open(peer))) co_return;
+
+    std::string req;
+    for (size_t i = 0; i < names.size(); ++i) req += "META " + names[i] + "\n";
+    const bool sent = co_await lease.conn().sendAll(req);
+    if (!sent) co_return;
+
+    std::string line;
+    for (size_t i = 0; i < names.size(); ++i) {
+        const bool got = co_await lease.conn().readLine(line);
+        if (!got) co_return;
+        sizes[i] = Async::metaReply(line);
+        if (sizes[i] == -2) co_return;      // out of step: don't reuse the connection
+    }
+    lease.done(true);
+}
+
+// META for every file of a batch: one connection per seeder, asked all at
+// once on the reactor. First seeder (by address) that answers wins.
+void ChunkDownloader::planSizes(std::vector<BatchItem>& items) {
+    std::map<Endpoint, std::vector<size_t> > bySeeder;
+    for (size_t i = 0; i < items.size(); ++i) {
+        for (size_t k = 0; k < items[i].seeders.size(); ++k) bySeeder[items[i].seeders[k]].push_back(i);
+    }
+
+    std::vector<std::vector<long long> > sizes;
+    sizes.reserve(bySeeder.size());
+    std::vector<Async::Task<void> > askers;
+    for (std::map<Endpoint, std::vector<size_t> >::const_iterator it = bySeeder.begin(); it != bySeeder.end(); ++it) {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < it->second.size(); ++i) names.push_back(items[it->second[i]].filename);
+        sizes.push_back(std::vector<long long>(names.size(), -1));
+        askers.push_back(askMetas(it->first, names, sizes.back()));
+    }
+    Async::syncWait(Async::whenAll(std::move(askers)));
+
+    size_t k = 0;
+    for (std::map<Endpoint, std::vector<size_t> >::const_iterator it = bySeeder.begin(); it != bySeeder.end(); ++it, ++k) {
+        for (size_t i = 0; i < it->second.size(); ++i) {
+            BatchItem& item = items[it->second[i]];
+            if (item.size < 0 && sizes[k][i] >= 0) item.size = sizes[k][i];
+        }
+    }
+}
+
+bool ChunkDownloader::downloadBatch(std::vector<BatchItem> items,
+                                    int myPort,
+                                    DownloadProgress* prog,
+                                    JobControl& ctl,
+                                    BatchProgress* batch)
+{
+    static const size_t BATCH_PARALLEL = 3;   // files in flight at once
+
+    if (prog) {
+        prog->reset();
+        prog->active.store(true);
+        prog->pending.store(true);
+    }
+
+    // the connections it opens stay in the pool for what follows
+    planSizes(items);
+
+    // drop what we can't get or already have, then shortest job first
+    std::vector<BatchItem> plan;
+    long long totalBytes = 0;
+    long long totalChunks = 0;
+    int skipped = 0, unknown = 0;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (items[i].size < 0) {
+            logWarn("DL batch: no seeder answered META for '%s'", items[i].filename.c_str());
+            ++unknown;
+            continue;
+        }
+        struct stat st;
+        const std::string local = portDirectory(myPort) + "/" + items[i].filename;
+        if (::stat(local.c_str(), &st) == 0 && (long long)st.st_size == items[i].size) {
+            ++skipped;
+            continue;
+        }
+        totalBytes += items[i].size;
+        totalChunks += (items[i].size + chunkSize_ - 1) / chunkSize_;
+        plan.push_back(items[i]);
+    }
+    std::stable_sort(plan.begin(), plan.end(), [](const BatchItem& a, const BatchItem& b) {
+        return a.size < b.size;
+    });
+
+    if (batch) {
+        batch->totalFiles.store((int)items.size());
+        batch->skippedFiles.store(skipped);
+        batch->failedFiles.store(unknown);
+    }
+    if (prog) {
+        prog->totalBytes.store(totalBytes);
+        prog->totalChunks.store(totalChunks);
+        prog->pending.store(false);
+    }
+    logInfo("DL batch start: %zu files to fetch (%lld bytes), %d already here, %d unavailable",
+            plan.size(), totalBytes, skipped, unknown);
+
+    std::vector<DownloadProgress> parts(plan.size());
+    std::atomic<size_t> next(0);
+    std::atomic<int> fetched(0);
+    std::atomic<int> failed(unknown);
+    std::atomic<int> running(0);
+
+    // small files in bulk: one BUNDLE per seeder (its first one to list them),
+    // each seeder at the same time; whatever didn't come that way is fetched
+    // on its own below. Files some download() already fetches are left to it,
+    // the others are ours in inflight_ until the bundles are in
+    std::vector<char> got(plan.size(), 0);
+    std::map<Endpoint, std::vector<size_t> > small;
+    std::vector<std::shared_ptr<Inflight> > leads(plan.size());
+    for (size_t i = 0; i < plan.size(); ++i) {
+        if (plan[i].size > INLINE_MAX || plan[i].seeders.empty() || ctl.stopRequested()) continue;
+        std::shared_ptr<Inflight> other;
+        leads[i] = leadInflight(portDirectory(myPort) + "/" + plan[i].filename, &parts[i], other);
+        if (leads[i]) small[plan[i].seeders[0]].push_back(i);
+    }
+    if (!small.empty()) {
+        std::vector<std::thread> bundlers;
+        for (std::map<Endpoint, std::vector<size_t> >::const_iterator it = small.begin(); it != small.end(); ++it) {
+            bundlers.push_back(std::thread([this, it, &plan, myPort, &parts, &got]() {
+                bundleFrom(it->first, plan, it->second, myPort, parts, got);
+            }));
+        }
+        for (size_t b = 0; b < bundlers.size(); ++b) bundlers[b].join();
+
+        int bundled = 0;
+        for (size_t i = 0; i < plan.size(); ++i) {
+            if (got[i]) {
+                ++bundled;
+                if (store_) store_->addFile(plan[i].filename);
+                if (batch) batch->doneFiles.fetch_add(1);
+            }
+            // missed ones: whoever waits on us fetches it, like we do below
+            if (leads[i]) endInflight(portDirectory(myPort) + "/" + plan[i].filename, leads[i], got[i] != 0, !got[i], &parts[i]);
+        }
+        fetched.store(bundled);
+        logInfo("DL batch: %d small files came in bundles from %zu seeders", bundled, small.size());
+    }
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < plan.size(); ++i) {
+        if (!got[i]) todo.push_back(i);
+    }
+
+    std::vector<std::thread> runners;
+    const size_t width = std::min(BATCH_PARALLEL, todo.size());
+    running.store((int)width);
+    for (size_t r = 0; r < width; ++r) {
+        runners.push_back(std::thread([&]() {
+            while (!ctl.stopRequested()) {
+                const size_t k = next.fetch_add(1);
+                if (k >= todo.size()) break;
+                const size_t i = todo[k];
+
+                DownloadOptions opts;
+                opts.knownSize = plan[i].size;
+                const bool ok = download(plan[i].filename, plan[i].seeders, myPort, &parts[i], ctl, opts);
+                if (ok) fetched.fetch_add(1);
+                else failed.fetch_add(1);
+                if (batch) {
+                    if (ok) batch->doneFiles.fetch_add(1);
+                    else batch->failedFiles.fetch_add(1);
+                }
+            }
+            running.fetch_sub(1);
+        }));
+    }
+
+    // roll the per-file counters up for the status screen
+    while (true) {
+        const bool last = running.load() == 0;
+        if (prog) {
+            std::map<Endpoint, SeederTally> sum;
+            for (size_t i = 0; i < parts.size(); ++i) {
+                const std::vector<SeederTally> rows = parts[i].bySeeder();
+                for (size_t k = 0; k < rows.size(); ++k) {
+                    SeederTally& row = sum[rows[k].peer];
+                    row.bytes += rows[k].bytes;
+                    row.chunks += rows[k].chunks;
+                    row.errors += rows[k].errors;
+                }
+            }
+            for (std::map<Endpoint, SeederTally>::const_iterator it = sum.begin(); it != sum.end(); ++it)
+                prog->set(-1, it->first, it->second.bytes, it->second.chunks, it->second.errors);
+        }
+        if (last) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    for (size_t r = 0; r < runners.size(); ++r) runners[r].join();
+
+    const bool ok = failed.load() == 0 && !ctl.stopRequested();
+    if (prog) {
+        prog->active.store(false);
+        prog->success.store(ok);
+        prog->failed.store(!ok);
+    }
+    logInfo("DL batch done: %d fetched, %d failed, %d skipped",
+            fetched.load(), failed.load(), skipped);
+    return ok;
+}
+
+void ChunkDownloader::bundleFrom(const Endpoint& seeder, const std::vector<BatchItem>& plan,
+                                 const std::vector<size_t>& mine, int myPort,
+                                 std::vector<DownloadProgress>& parts, std::vector<char>& got)
+{
+    PooledConnection conn;
+    if (!conn.open(seeder)) return;
+
+    std::string data;
+    char line[256];
+    for (size_t from = 0; from < mine.size(); from += BUNDLE_FILES) {
+        const size_t n = std::min(BUNDLE_FILES, mine.size() - from);
+        std::string req = "BUNDLE " + std::to_string(n) + "\n";
+        for (size_t k = 0; k < n; ++k) req += plan[mine[from + k]].filename + "\n";
+        if (!conn.sock().sendData(req)) {
+            conn.discard();
+            return;
+        }
+
+        for (size_t k = 0; k < n; ++k) {
+            const size_t i = mine[from + k];
+            if (conn.sock().receiveLine(line, sizeof(line)) <= 0) {
+                conn.discard();
+                return;
+            }
+            stripCRLF(line);
+
+            // older seeders answer every line with <BAD_REQUEST>: out of step now
+            long long sz = -1;
+            if (std::strcmp(line, "<BAD_REQUEST>") == 0) {
+                logInfo("DL batch: %s can't BUNDLE, fetching its files one by one", seeder.str().c_str());
+                conn.discard();
+                return;
+            }
+            if (std::sscanf(line, "<FILE> %lld", &sz) != 1) continue;    // <SKIP>, <FILE_NOT_FOUND>
+            if (sz < 0 || sz > INLINE_MAX) {
+                conn.discard();
+                return;
+            }
+
+            data.resize((size_t)sz);
+            if (sz > 0 && !conn.sock().receiveExact(&data[0], (size_t)sz)) {
+                conn.discard();
+                return;
+            }
+            if (sz != plan[i].size) continue;    // changed since the plan: the usual way
+
+            if (!writeWhole(portDirectory(myPort) + "/" + plan[i].filename, data)) continue;
+            DownloadProgress& p = parts[i];
+            p.totalBytes.store(sz);
+            p.totalChunks.store((sz + chunkSize_ - 1) / chunkSize_);
+            p.put(-1, seeder, sz, (sz + chunkSize_ - 1) / chunkSize_);
+            p.success.store(true);
+            got[i] = 1;
+        }
+    }
+}
+
+// at least n bytes in buf; what it has is kept if that is enough already
+static bool fitBuffer(BufferPool::Buffer& buf, size_t n, BufferPool::Owner who) {
+    if (buf && buf.size() >= n) return true;
+    buf.release();
+    buf = BufferPool::instance().get(n, who, DISK_BUF_WAIT_MS);
+    return (bool)buf;
+}
+
+// Rebuild <local>.part from the old copy + the seeder's instructions, check the
+// whole-file hash, then swap it in. 1 = done, 0 = try another seeder,
+// -1 = stop (cancelled or local trouble).
+int ChunkDownloader::deltaFrom(const std::string& filename, const Endpoint& seeder, const std::string& localPath,
+                               int blockSize, const std::string& request,
+                               DownloadProgress* prog, JobControl& ctl)
+{
+    static const size_t DATA_MAX = 1024 * 1024;
+    static const int SLICE_MS = 50;     // a wait for the rate cap or a pause looks at cancel this often
+
+    PooledConnection conn;
+    if (!conn.open(seeder)) return 0;
+    if (!conn.sock().sendAll(request.data(), request.size())) {
+        conn.discard();
+        return 0;
+    }
+
+    char line[256];
+    if (conn.sock().receiveLine(line, sizeof(line)) <= 0) {
+        conn.discard();
+        return 0;
+    }
+    stripCRLF(line);
+
+    long long size = -1;
+    char wantHash[72];
+    if (std::sscanf(line, "<DELTA> %lld %71s", &size, wantHash) != 2 || size < 0) {
+        // older seeder / file gone: the stream state is unclear, don't reuse it
+        logWarn("DL delta: seeder %s answered '%s'", seeder.str().c_str(), line);
+        conn.discard();
+        return 0;
+    }
+    if (prog) {
+        prog->totalBytes.store(size);
+        prog->totalChunks.store((size + chunkSize_ - 1) / chunkSize_);
+    }
+
+    const std::string tmpPath = localPath + ".part";
+    const int in = ::open(localPath.c_str(), O_RDONLY);
+    const int out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in < 0 || out < 0) {
+        if (in >= 0) ::close(in);
+        if (out >= 0) ::close(out);
+        conn.discard();
+        logErr("DL delta: cannot open '%s' / '%s'", localPath.c_str(), tmpPath.c_str());
+        return -1;
+    }
+
+    // COPY may only name whole blocks of the old copy
+    struct stat st;
+    const long long localBlocks = ::fstat(in, &st) == 0 ? (long long)st.st_size / blockSize : 0;
+
+    Sha256 hash;
+    BufferPool::Buffer buf;        // up to DATA_MAX, grown as COPY / DATA need
+    long long written = 0, literal = 0;
+    int rc = 0;
+    bool ended = false;
+
+    // n bytes from buf onto the end of the new copy
+    auto append = [&](size_t n) {
+        if (written + (long long)n > size || ::pwrite(out, buf.data(), n, (off_t)written) != (ssize_t)n) return false;
+        hash.update(buf.data(), n);
+        written += (long long)n;
+        if (prog) prog->put(-1, seeder, (long long)n, 0);
+        return true;
+    };
+
+    // sit out a pause and what the rate caps ask for, in slices; false = cancelled
+    auto sitOut = [&](std::chrono::microseconds wait) {
+        const std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + wait;
+        while (!ctl.stopRequested()) {
+            const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (now >= until && !ctl.paused()) return true;
+            std::chrono::steady_clock::duration nap = std::chrono::milliseconds(SLICE_MS);
+            if (!ctl.paused()) nap = std::min(nap, until - now);
+            std::this_thread::sleep_for(nap);
+        }
+        return false;
+    };
+
+    while (!ended) {
+        if (!sitOut(std::chrono::microseconds(0))) { rc = -1; break; }
+
+        if (conn.sock().receiveLine(line, sizeof(line)) <= 0) break;
+        stripCRLF(line);
+
+        long long a = 0, b = 0;
+        if (std::strcmp(line, "<END>") == 0) {
+            ended = true;
+        } else if (std::sscanf(line, "COPY %lld %lld", &a, &b) == 2 && a >= 0 && b > 0) {
+            if (a >= localBlocks || b > localBlocks - a) {
+                logWarn("DL delta: seeder %s wants blocks %lld+%lld of %lld", seeder.str().c_str(), a, b, localBlocks);
+                break;
+            }
+            // a long run goes over in pieces, never more than DATA_MAX in memory
+            long long off = a * blockSize;
+            const long long end = (a + b) * blockSize;
+            while (off < end) {
+                const size_t n = (size_t)std::min((long long)DATA_MAX, end - off);
+                if (!fitBuffer(buf, n, BufferPool::DELTA)) break;
+                if (::pread(in, buf.data(), n, (off_t)off) != (ssize_t)n || !append(n)) break;
+                off += (long long)n;
+            }
+            if (off < end) break;
+        } else if (std::sscanf(line, "DATA %lld", &a) == 1 && a > 0 && (size_t)a <= DATA_MAX) {
+            const size_t n = (size_t)a;
+            if (!fitBuffer(buf, n, BufferPool::DELTA)) break;
+            // literals are real traffic: same budget as chunk downloads, paid
+            // before they come in
+            const std::chrono::microseconds wait = std::max(RateLimiter::global().reserve(a),
+                                                            ctl.limiter().reserve(a));
+            if (!sitOut(wait)) { rc = -1; break; }
+            if (!conn.sock().receiveExact(buf.data(), n)) break;
+            literal += a;
+            if (!append(n)) break;
+        } else {
+            break;
+        }
+    }
+    ::close(in);
+    ::close(out);
+
+    if (!ended) conn.discard();
+    else conn.release();
+
+    if (ended) {
+        unsigned char d[32];
+        hash.final(d);
+        char got[65];
+        for (int i = 0; i < 32; ++i) std::snprintf(got + i * 2, 3, "%02x", d[i]);
+        if (written == size && std::strcmp(got, wantHash) == 0 &&
+            std::rename(tmpPath.c_str(), localPath.c_str()) == 0) {
+            logInfo("DL delta: '%s' rebuilt from seeder %s, %lld of %lld bytes over the wire",
+                    filename.c_str(), seeder.str().c_str(), literal, size);
+            return 1;
+        }
+        logWarn("DL delta: '%s' from seeder %s did not verify", filename.c_str(), seeder.str().c_str());
+    }
+
+    std::remove(tmpPath.c_str());
+    return rc;
+}
+
+bool ChunkDownloader::syncDelta(const std::string& filename,
+                                const std::vector<Endpoint>& seeders,
+                                int myPort,
+                                DownloadProgress* prog,
+                                JobControl& ctl)
+{
+    const std::string localPath = portDirectory(myPort) + "/" + filename;
+
+    struct stat st;
+    if (::stat(localPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+    if (prog) {
+        prog->reset();
+        prog->active.store(true);
+    }
+
+    const int blockSize = DeltaSync::blockSizeFor((long long)st.st_size);
+    std::vector<DeltaSync::BlockSig> sigs;
+    if (!DeltaSync::signature(localPath, blockSize, sigs)) {
+        logErr("DL delta: cannot read '%s'", localPath.c_str());
+        return false;
+    }
+
+    std::string request = "DELTA " + filename + " " + std::to_string(blockSize) + " " +
+                          std::to_string(sigs.size()) + "\n";
+    char row[64];
+    for (size_t i = 0; i < sigs.size(); ++i) {
+        std::snprintf(row, sizeof(row), "%08x %s\n", sigs[i].weak, sigs[i].strong.c_str());
+        request += row;
+    }
+
+    logInfo("DL delta start file='%s' local=%lld bytes, %zu blocks of %d",
+            filename.c_str(), (long long)st.st_size, sigs.size(), blockSize);
+
+    const std::vector<Endpoint> order = ConnectionPool::instance().warm(seeders);
+    for (size_t i = 0; i < order.size(); ++i) {
+        const int rc = deltaFrom(filename, order[i], localPath, blockSize, request, prog, ctl);
+        if (rc <= 0 && prog) {
+            // that try's bytes don't count, the failure does
+            ProgressSlot* s = prog->slot(-1, order[i]);
+            s->bytes.store(0);
+            s->fail();
+        }
+        if (rc == 0) continue;
+        if (rc < 0) break;
+
+        if (prog) {
+            prog->success.store(true);
+            prog->active.store(false);
+        }
+        if (store_) store_->addFile(filename);
+        return true;
+    }
+
+    if (prog) {
+        prog->reset();
+        prog->active.store(!ctl.stopRequested());
+    }
+    return false;
+}
+
+// probeSize() with META+: from = whoever answered (the first seeder in the
+// list that did). Every seeder is asked at once, on the reactor
+Async::Task<bool> ChunkDownloader::probeInline(std::string filename, std::vector<Endpoint> seeders,
+                                               long long& outSize, std::string& data, bool& inlined,
+                                               Endpoint& from)
+{
+    outSize = -1;
+    inlined = false;
+
+    std::vector<long long> sizes(seeders.size(), -2);
+    std::vector<std::string> datas(seeders.size());
+    std::unique_ptr<bool[]> whole(new bool[seeders.size()]());
+    std::vector<Async::Task<void> > asks;
+    for (size_t i = 0; i < seeders.size(); ++i)
+        asks.push_back(askMetaInline(seeders[i], filename, sizes[i], datas[i], whole[i]));
+    co_await Async::whenAll(std::move(asks));
+
+    for (size_t i = 0; i < seeders.size(); ++i) {
+        if (sizes[i] < 0) continue;
+        outSize = sizes[i];
+        inlined = whole[i];
+        data.swap(datas[i]);
+        from = seeders[i];
+        co_return true;
+    }
+    co_return false;
 }
 
 bool ChunkDownloader::probeSize(const std::string& filename,
-                               const std::vector<int>& seeders,
+                               const std::vector<Endpoint>& seeders,
                                long long& outSize)
 {
     outSize = -1;
+
+    // every seeder at once, the first in the list that knows the file wins
+    std::vector<long long> sizes(seeders.size(), -2);
+    std::vector<Async::Task<void> > asks;
+    for (size_t i = 0; i < seeders.size(); ++i) asks.push_back(askMeta(seeders[i], filename, sizes[i]));
+    Async::syncWait(Async::whenAll(std::move(asks)));
+
     for (size_t i = 0; i < seeders.size(); ++i) {
-        if (fetchMeta(filename, seeders[i], outSize))
+        if (sizes[i] >= 0) {
+            outSize = sizes[i];
             return true;
+        }
     }
     return false;
 }
\ No newline at end of file
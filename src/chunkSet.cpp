@@ -0,0 +1,208 @@
+#include "../inc/chunkSet.h"
+
+#include <algorithm>
+#include <climits>
+#include <iterator>
+
+ChunkSet::Runs::const_iterator ChunkSet::runOf(const Runs& runs, long long c) {
+    Runs::const_iterator it = runs.upper_bound(c);
+    if (it == runs.begin()) return runs.end();
+    --it;
+    return c < it->second ? it : runs.end();
+}
+
+// merges with whatever it overlaps or touches, so runs stay as few as possible
+// (runs of other stripes in the shard are never near enough to touch)
+void ChunkSet::addRun(Runs& runs, long long first, long long end) {
+    if (first >= end) return;
+
+    Runs::iterator it = runs.upper_bound(first);
+    if (it != runs.begin()) {
+        Runs::iterator prev = std::prev(it);
+        if (prev->second >= first) {
+            first = prev->first;
+            end = std::max(end, prev->second);
+            it = runs.erase(prev);
+        }
+    }
+    while (it != runs.end() && it->first <= end) {
+        end = std::max(end, it->second);
+        it = runs.erase(it);
+    }
+    runs.emplace_hint(it, first, end);
+}
+
+void ChunkSet::removeRun(Runs& runs, long long first, long long end) {
+    if (first >= end) return;
+
+    Runs::iterator it = runs.upper_bound(first);
+    if (it != runs.begin() && std::prev(it)->second > first) --it;
+    while (it != runs.end() && it->first < end) {
+        const long long a = it->first, b = it->second;
+        it = runs.erase(it);
+        if (a < first) runs.emplace(a, first);
+        if (b > end) {
+            runs.emplace(end, b);
+            break;
+        }
+    }
+}
+
+// every shard asked once, so crossing an empty stretch costs the same however long
+long long ChunkSet::nextStart(long long c) const {
+    long long best = LLONG_MAX;
+    for (int i = 0; i < SHARDS; ++i) {
+        std::lock_guard<std::mutex> lock(shards_[i].mu);
+        Runs::const_iterator it = shards_[i].runs.lower_bound(c);
+        if (it != shards_[i].runs.end()) best = std::min(best, it->first);
+    }
+    return best;
+}
+
+bool ChunkSet::add(long long c) {
+    if (c < 0) return false;
+    Shard& s = shardOf(c);
+    std::lock_guard<std::mutex> lock(s.mu);
+    if (runOf(s.runs, c) != s.runs.end()) return false;
+    addRun(s.runs, c, c + 1);
+    return true;
+}
+
+void ChunkSet::add(long long first, long long end) {
+    for (first = std::max(first, 0LL); first < end; first = stripeEnd(first)) {
+        Shard& s = shardOf(first);
+        std::lock_guard<std::mutex> lock(s.mu);
+        addRun(s.runs, first, std::min(end, stripeEnd(first)));
+    }
+}
+
+bool ChunkSet::remove(long long c) {
+    if (c < 0) return false;
+    Shard& s = shardOf(c);
+    std::lock_guard<std::mutex> lock(s.mu);
+    if (runOf(s.runs, c) == s.runs.end()) return false;
+    removeRun(s.runs, c, c + 1);
+    return true;
+}
+
+void ChunkSet::remove(long long first, long long end) {
+    for (first = std::max(first, 0LL); first < end; first = stripeEnd(first)) {
+        Shard& s = shardOf(first);
+        std::lock_guard<std::mutex> lock(s.mu);
+        removeRun(s.runs, first, std::min(end, stripeEnd(first)));
+    }
+}
+
+bool ChunkSet::has(long long c) const {
+    if (c < 0) return false;
+    const Shard& s = shardOf(c);
+    std::lock_guard<std::mutex> lock(s.mu);
+    return runOf(s.runs, c) != s.runs.end();
+}
+
+long long ChunkSet::nextIn(long long from, long long end) const {
+    from = std::max(from, 0LL);
+    if (from >= end) return end;
+    if (has(from)) return from;
+    return std::min(nextStart(from), end);
+}
+
+long long ChunkSet::nextOut(long long from, long long end) const {
+    from = std::max(from, 0LL);
+    while (from < end) {
+        const Shard& s = shardOf(from);
+        std::lock_guard<std::mutex> lock(s.mu);
+        Runs::const_iterator it = runOf(s.runs, from);
+        if (it == s.runs.end()) return from;
+        // runs never touch, so whatever follows one is free, unless it runs
+        // up to the end of the stripe: then the next one decides
+        from = it->second;
+        if (from < stripeEnd(it->first)) break;
+    }
+    return std::min(from, end);
+}
+
+long long ChunkSet::prevOut(long long from, long long end) const {
+    long long c = end - 1;
+    while (c >= from && c >= 0) {
+        const Shard& s = shardOf(c);
+        std::lock_guard<std::mutex> lock(s.mu);
+        Runs::const_iterator it = runOf(s.runs, c);
+        if (it == s.runs.end()) return c;
+        c = it->first - 1;
+        // likewise: a run from the start of its stripe leaves it to the one before
+        if (it->first % SPAN != 0) break;
+    }
+    return c >= from ? c : from - 1;
+}
+
+std::vector<std::pair<long long, long long> > ChunkSet::runsIn(long long from, long long end) const {
+    std::vector<std::pair<long long, long long> > out;
+    from = std::max(from, 0LL);
+    while (from < end) {
+        const long long stop = std::min(end, stripeEnd(from));
+        bool any = false;
+        {
+            const Shard& s = shardOf(from);
+            std::lock_guard<std::mutex> lock(s.mu);
+            Runs::const_iterator it = s.runs.upper_bound(from);
+            if (it != s.runs.begin() && std::prev(it)->second > from) --it;
+            for (; it != s.runs.end() && it->first < stop; ++it) {
+                const long long a = std::max(it->first, from), b = std::min(it->second, stop);
+                // glued back together where a run went on over a stripe's end
+                if (!out.empty() && out.back().second == a) out.back().second = b;
+                else out.push_back(std::make_pair(a, b));
+                any = true;
+            }
+        }
+        // nothing here: straight on to the next run, wherever it is
+        from = any ? stop : nextStart(stop);
+    }
+    return out;
+}
+
+std::string ChunkSet::bitmap(long long n) const {
+    std::string out((size_t)((n + 7) / 8), '\0');
+    const std::vector<std::pair<long long, long long> > runs = runsIn(0, n);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        long long c = runs[i].first;
+        while (c < runs[i].second) {
+            if ((c & 7) == 0 && c + 8 <= runs[i].second) {
+                out[(size_t)(c >> 3)] = (char)0xFF;
+                c += 8;
+            } else {
+                out[(size_t)(c >> 3)] |= (char)(0x80u >> (c & 7));
+                ++c;
+            }
+        }
+    }
+    return out;
+}
+
+void ChunkSet::addBitmap(const std::string& bits, long long n) {
+    const long long limit = std::min(n, (long long)bits.size() * 8);
+
+    long long start = -1;
+    long long c = 0;
+    while (c < limit) {
+        const unsigned char b = (unsigned char)bits[(size_t)(c >> 3)];
+        // whole bytes at a time where they are all set or all clear
+        if ((c & 7) == 0 && c + 8 <= limit && (b == 0 || b == 0xFF)) {
+            if (b == 0xFF && start < 0) start = c;
+            if (b == 0 && start >= 0) {
+                add(start, c);
+                start = -1;
+            }
+            c += 8;
+            continue;
+        }
+        const bool on = (b & (0x80u >> (c & 7))) != 0;
+        if (on && start < 0) start = c;
+        if (!on && start >= 0) {
+            add(start, c);
+            start = -1;
+        }
+        ++c;
+    }
+    if (start >= 0) add(start, limit);
+}
@@ -0,0 +1,316 @@
+#include "../inc/chunkStore.h"
+#include "../inc/sha256.h"
+#include "../inc/logger2.h"
+#include "../inc/bufferPool.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+static const size_t   CDC_MIN  = 512;           // no cut before this
+static const size_t   CDC_MAX  = 32 * 1024;     // forced cut
+static const uint64_t CDC_MASK = 0xFFF0000000000000ULL;  // 12 bits -> ~4 KiB average
+
+// Same table on every peer, otherwise boundaries (and hashes) won't line up
+struct GearTable {
+    uint64_t v[256];
+    GearTable() {
+        uint64_t x = 0x5eed5eed5eed5eedULL;
+        for (int i = 0; i < 256; ++i) {
+            // splitmix64
+            x += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            v[i] = z ^ (z >> 31);
+        }
+    }
+};
+static const GearTable GEAR;
+
+static const size_t READ_BUF = 256 * 1024;      // files are chunked through this
+static const int    READ_BUF_WAIT_MS = 5000;
+
+static bool statFile(const std::string& path, long long& size, long long& mtime) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+    size = (long long)st.st_size;
+    mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + (long long)st.st_mtim.tv_nsec;
+    return true;
+}
+
+// Cuts a byte stream into chunks as it arrives, so a file never has to be in
+// memory whole. Gives the same boundaries as cutting it all in one go.
+class Chunker {
+public:
+    explicit Chunker(std::vector<CdcChunk>& out) : out_(out) {}
+
+    void feed(const char* data, size_t len) {
+        size_t from = 0;
+        for (size_t i = 0; i < len; ++i) {
+            h_ = (h_ << 1) + GEAR.v[(unsigned char)data[i]];
+            ++len_;
+            if ((len_ >= CDC_MIN && (h_ & CDC_MASK) == 0) || len_ == CDC_MAX) {
+                sha_.update(data + from, i + 1 - from);
+                from = i + 1;
+                cut();
+            }
+        }
+        if (from < len) sha_.update(data + from, len - from);
+    }
+
+    void finish() {
+        if (len_ > 0) cut();
+    }
+
+private:
+    void cut() {
+        CdcChunk c;
+        c.offset = start_;
+        c.length = (long long)len_;
+        c.hash = sha_.finalHex();
+        out_.push_back(c);
+        start_ += (long long)len_;
+        len_ = 0;
+        h_ = 0;
+        sha_ = Sha256();
+    }
+
+    std::vector<CdcChunk>& out_;
+    long long start_ = 0;
+    size_t len_ = 0;
+    uint64_t h_ = 0;
+    Sha256 sha_;
+};
+
+ChunkStore::ChunkStore() {}
+
+void ChunkStore::setDirectory(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mu_);
+    dir_ = dir;
+    files_.clear();
+    byHash_.clear();
+}
+
+ChunkStore::~ChunkStore() {
+    stopRefresh();
+}
+
+std::vector<CdcChunk> ChunkStore::split(const char* data, size_t len) {
+    std::vector<CdcChunk> out;
+    Chunker chunker(out);
+    chunker.feed(data, len);
+    chunker.finish();
+    return out;
+}
+
+bool ChunkStore::splitFile(const std::string& path, std::vector<CdcChunk>& out) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    BufferPool::Buffer buf = BufferPool::instance().get(READ_BUF, BufferPool::DISK, READ_BUF_WAIT_MS);
+    if (!buf) {
+        ::close(fd);
+        return false;
+    }
+
+    out.clear();
+    Chunker chunker(out);
+    while (true) {
+        ssize_t n = ::read(fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        chunker.feed(buf.data(), (size_t)n);
+    }
+    ::close(fd);
+    chunker.finish();
+    return true;
+}
+
+void ChunkStore::forgetLocked(const std::string& name) {
+    std::map<std::string, FileIndex>::iterator it = files_.find(name);
+    if (it == files_.end()) return;
+    for (size_t i = 0; i < it->second.chunks.size(); ++i) {
+        std::unordered_map<std::string, Location>::iterator h = byHash_.find(it->second.chunks[i].hash);
+        if (h != byHash_.end() && h->second.name == name) byHash_.erase(h);
+    }
+    files_.erase(it);
+}
+
+void ChunkStore::installLocked(const std::string& name, const FileIndex& fi) {
+    forgetLocked(name);
+    for (size_t i = 0; i < fi.chunks.size(); ++i) {
+        const CdcChunk& c = fi.chunks[i];
+        if (byHash_.count(c.hash)) continue;        // first copy wins
+        Location loc;
+        loc.name = name;
+        loc.offset = c.offset;
+        loc.length = c.length;
+        byHash_[c.hash] = loc;
+    }
+    files_[name] = fi;
+}
+
+// The file is read and hashed without mu_ held, so HASHES and chunk reads
+// for other files don't queue up behind a big one. If two threads index the
+// same file the last one in wins; both saw a version that was current.
+bool ChunkStore::index(const std::string& dir, const std::string& name,
+                       long long size, long long mtime, FileIndex& fi) {
+    fi.size = size;
+    fi.mtime = mtime;
+    const bool ok = splitFile(dir + "/" + name, fi.chunks);
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (dir_ != dir) return false;                  // setDirectory() in between
+    if (!ok) {
+        forgetLocked(name);
+        return false;
+    }
+    installLocked(name, fi);
+    logDbg("store: indexed '%s' (%zu chunks)", name.c_str(), fi.chunks.size());
+    return true;
+}
+
+bool ChunkStore::current(const std::string& name, long long size, long long mtime, std::vector<CdcChunk>* out) {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<std::string, FileIndex>::const_iterator it = files_.find(name);
+    if (it == files_.end() || it->second.size != size || it->second.mtime != mtime) return false;
+    if (out) *out = it->second.chunks;
+    return true;
+}
+
+std::string ChunkStore::directory() {
+    std::lock_guard<std::mutex> lock(mu_);
+    return dir_;
+}
+
+bool ChunkStore::manifest(const std::string& name, std::vector<CdcChunk>& out) {
+    const std::string dir = directory();
+    long long size = 0, mtime = 0;
+    if (dir.empty() || !statFile(dir + "/" + name, size, mtime)) return false;
+    if (current(name, size, mtime, &out)) return true;
+
+    FileIndex fi;
+    if (!index(dir, name, size, mtime, fi)) return false;
+    out.swap(fi.chunks);
+    return true;
+}
+
+bool ChunkStore::read(const std::string& hash, long long length, std::string& out) {
+    std::string dir;
+    Location loc;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        std::unordered_map<std::string, Location>::const_iterator it = byHash_.find(hash);
+        if (it == byHash_.end() || it->second.length != length) return false;
+        dir = dir_;
+        loc = it->second;
+    }
+
+    const std::string path = dir + "/" + loc.name;
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    out.assign((size_t)length, '\0');
+    size_t got = 0;
+    while (got < (size_t)length) {
+        ssize_t n = ::pread(fd, &out[got], (size_t)length - got, (off_t)(loc.offset + (long long)got));
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    ::close(fd);
+
+    // the file may have changed under us since it was indexed
+    if (got != (size_t)length || Sha256::hex(out.data(), out.size()) != hash) {
+        logWarn("store: stale chunk in '%s', reindexing", loc.name.c_str());
+        long long size = 0, mtime = 0;
+        FileIndex fi;
+        if (statFile(path, size, mtime)) {
+            index(dir, loc.name, size, mtime, fi);
+        } else {
+            std::lock_guard<std::mutex> lock(mu_);
+            if (dir_ == dir) forgetLocked(loc.name);
+        }
+        return false;
+    }
+    return true;
+}
+
+void ChunkStore::addFile(const std::string& name) {
+    const std::string dir = directory();
+    long long size = 0, mtime = 0;
+    if (dir.empty() || !statFile(dir + "/" + name, size, mtime)) return;
+    FileIndex fi;
+    index(dir, name, size, mtime, fi);
+}
+
+void ChunkStore::refresh() {
+    const std::string dir = directory();
+    if (dir.empty()) return;
+
+    DIR* d = opendir(dir.c_str());
+    if (!d) return;
+
+    std::map<std::string, bool> seen;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != nullptr) {
+        const char* name = entry->d_name;
+        if (name[0] == '.') continue;
+        if (std::strstr(name, ".part") != nullptr) continue;
+
+        long long size = 0, mtime = 0;
+        if (!statFile(dir + "/" + name, size, mtime)) continue;
+        seen[name] = true;
+
+        if (!current(name, size, mtime, nullptr)) {
+            FileIndex fi;
+            index(dir, name, size, mtime, fi);
+        }
+    }
+    closedir(d);
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (dir_ != dir) return;
+    std::vector<std::string> gone;
+    for (std::map<std::string, FileIndex>::const_iterator it = files_.begin(); it != files_.end(); ++it) {
+        if (!seen.count(it->first)) gone.push_back(it->first);
+    }
+    for (size_t i = 0; i < gone.size(); ++i) forgetLocked(gone[i]);
+}
+
+void ChunkStore::startRefresh(int intervalMs) {
+    stopRefresh();
+    {
+        std::lock_guard<std::mutex> lock(refreshMu_);
+        stopRefresh_ = false;
+    }
+    refresher_ = std::thread(&ChunkStore::refreshLoop, this, intervalMs);
+}
+
+void ChunkStore::stopRefresh() {
+    {
+        std::lock_guard<std::mutex> lock(refreshMu_);
+        stopRefresh_ = true;
+    }
+    refreshCv_.notify_all();
+    if (refresher_.joinable()) refresher_.join();
+}
+
+void ChunkStore::refreshLoop(int intervalMs) {
+    // first pass right away so the files we start with are reusable early
+    std::unique_lock<std::mutex> lock(refreshMu_);
+    while (!stopRefresh_) {
+        lock.unlock();
+        refresh();
+        lock.lock();
+        refreshCv_.wait_for(lock, std::chrono::milliseconds(intervalMs));
+    }
+}
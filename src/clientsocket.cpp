@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <netinet/tcp.h>
 #include <sys/time.h>
+#include <fcntl.h>
 
 
 clientSocket::clientSocket() : client_fd(-1) {
@@ -14,6 +15,7 @@ clientSocket::clientSocket() : client_fd(-1) {
         cErr("socket() failed: %s", strerror(errno));
         client_fd = -1;
     }
+    in_.reset(client_fd);
     //cDbg("socket() ok, fd=%d", client_fd);
 }
 
@@ -23,18 +25,62 @@ clientSocket::~clientSocket() {
 
 
 bool clientSocket::connectServer(const std::string& ip, int port) {
+    return connectServer(Endpoint(ip, port));
+}
+
+bool clientSocket::connectServer(const Endpoint& peer) {
     if (client_fd >= 0) {
         ::close(client_fd);
         client_fd = -1;
     }
 
-    client_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    socklen_t addrLen = 0;
+    if (!peer.toSockaddr(serv_addr, addrLen)) {
+        cErr("connectServer(): invalid address '%s'", peer.str().c_str());
+        in_.reset(-1);
+        return false;
+    }
+
+    client_fd = ::socket(serv_addr.ss_family, SOCK_STREAM, 0);
+    in_.reset(client_fd);
     if (client_fd < 0) {
         cErr("socket() failed: %s", strerror(errno));
         return false;
     }
 
     // Enable socket options BEFORE connect
+    applyOptions();
+
+    if (::connect(client_fd, (struct sockaddr*)&serv_addr, addrLen) < 0) {
+        cErr("connect() to %s failed: %s", peer.str().c_str(), strerror(errno));
+        ::close(client_fd);
+        client_fd = -1;
+        return false;
+    }
+
+    // Only log successful connections (INFO level, not TRACE)
+    cInfo("connected to %s", peer.str().c_str());
+    return true;
+}
+
+bool clientSocket::adopt(int fd) {
+    closeConn();
+    if (fd < 0) return false;
+
+    // scanner sockets come in non-blocking; this class expects blocking + timeouts
+    int fl = ::fcntl(fd, F_GETFL, 0);
+    if (fl < 0 || ::fcntl(fd, F_SETFL, fl & ~O_NONBLOCK) < 0) {
+        cErr("adopt(): fcntl failed: %s", strerror(errno));
+        return false;
+    }
+
+    client_fd = fd;
+    in_.reset(fd);
+    applyOptions();
+    return true;
+}
+
+void clientSocket::applyOptions() {
     // Disable Nagle's algorithm for better small-packet performance
     int one = 1;
     if (::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
@@ -51,42 +97,15 @@ bool clientSocket::connectServer(const std::string& ip, int port) {
     if (::setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
         cWarn("setsockopt(SO_SNDTIMEO) failed: %s", strerror(errno));
     }
-
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port   = htons(port);
-
-    int rc = ::inet_pton(AF_INET, ip.c_str(), &serv_addr.sin_addr);
-    if (rc <= 0) {
-        if (rc == 0) {
-            cErr("inet_pton(): invalid IPv4 address '%s'", ip.c_str());
-        } else {
-            cErr("inet_pton() failed: %s", strerror(errno));
-        }
-        ::close(client_fd);
-        client_fd = -1;
-        return false;
-    }
-
-    if (::connect(client_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        cErr("connect() to %s:%d failed: %s", ip.c_str(), port, strerror(errno));
-        ::close(client_fd);
-        client_fd = -1;
-        return false;
-    }
-
-    // Only log successful connections (INFO level, not TRACE)
-    cInfo("connected to %s:%d", ip.c_str(), port);
-    return true;
 }
 
-
 void clientSocket::closeConn() {
     if (client_fd >= 0) {
         ::close(client_fd);
         client_fd = -1;
         //cTrace("closed client socket fd=%d", fd);
     }
+    in_.reset(-1);
 }
 
 bool clientSocket::sendData(const std::string& data) {
@@ -114,9 +133,9 @@ int clientSocket::receiveData(char* buffer, size_t size) {
         return -1;
     }
 
-    ssize_t n = ::read(client_fd, buffer, size - 1);
+    long n = in_.readSome(buffer, size - 1);
     if (n < 0) {
-        cErr("read() failed: %s", strerror(errno));
+        cErr("recv() failed: %s", strerror(errno));
         return (int)n;
     }
 
@@ -139,7 +158,7 @@ bool clientSocket::sendAll(const void* data, size_t len) {
     size_t total = 0;
 
     while (total < len) {
-        ssize_t n = ::send(client_fd, p + total, len - total, 0);
+        ssize_t n = ::send(client_fd, p + total, len - total, MSG_NOSIGNAL);
         if (n < 0) {
             if (errno == EINTR) continue; // interrupted, retry
             cErr("send() failed in sendAll(): %s", strerror(errno));
@@ -165,23 +184,11 @@ bool clientSocket::receiveExact(void* buffer, size_t len) {
         return false;
     }
 
-    char* p = static_cast<char*>(buffer);
-    size_t total = 0;
-
-    while (total < len) {
-        ssize_t n = ::recv(client_fd, p + total, len - total, 0);
-        if (n < 0) {
-            if (errno == EINTR) 
-                continue; 
-
-            cErr("recv() failed in receiveExact(): %s", strerror(errno));
-            return false;
-        }
-        if (n == 0) {
-            cErr("peer closed connection while receiving exact %zu bytes (got %zu)", len, total);
-            return false;
-        }
-        total += static_cast<size_t>(n);
+    errno = 0;
+    if (!in_.readExact(buffer, len)) {
+        if (errno != 0) cErr("recv() failed in receiveExact(): %s", strerror(errno));
+        else cErr("peer closed connection while receiving exact %zu bytes", len);
+        return false;
     }
 
     return true;
@@ -197,28 +204,17 @@ int clientSocket::receiveCString(char* buffer, size_t cap) {
         return -1;
     }
 
-    size_t i = 0;
-    while (i + 1 < cap) { 
-        char ch;
-        ssize_t n = ::recv(client_fd, &ch, 1, 0);
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            cErr("recv() failed in receiveCString(): %s", strerror(errno));
-            return -1;
-        }
-        if (n == 0) {
-            break;
-        }
-
-        buffer[i++] = ch;
-        if (ch == '\0') {
-            return (int)i;
-        }
+    bool truncated = false;
+    int n = in_.readUntil('\0', buffer, cap, false, &truncated);
+    if (n < 0) {
+        cErr("recv() failed in receiveCString(): %s", strerror(errno));
+        return -1;
     }
-
-    buffer[cap - 1] = '\0';
-    cWarn("receiveCString(): string exceeded cap=%zu (truncated)", cap);
-    return (int)cap;
+    if (truncated) {
+        cWarn("receiveCString(): string exceeded cap=%zu (truncated)", cap);
+        return (int)cap;
+    }
+    return n;
 }
 
 int clientSocket::receiveLine(char* buffer, size_t cap) {
@@ -231,41 +227,16 @@ int clientSocket::receiveLine(char* buffer, size_t cap) {
         return 0;
     }
 
-    size_t i = 0;
     bool truncated = false;
-
-    while (true) {
-        char ch;
-        ssize_t n = ::recv(client_fd, &ch, 1, 0);
-
-        if (n < 0) {
-            if (errno == EINTR) continue;
-            cErr("recv() failed in receiveLine(): %s", strerror(errno));
-            buffer[i < cap ? i : cap - 1] = '\0';
-            return 0;
-        }
-
-        if (n == 0) {
-            break;
-        }
-
-        if (!truncated) {
-            if (i + 1 < cap) {
-                buffer[i++] = ch;
-            } else {
-                truncated = true;
-            }
-        }
-
-        if (ch == '\n') break;
+    int n = in_.readUntil('\n', buffer, cap, true, &truncated);
+    if (n < 0) {
+        cErr("recv() failed in receiveLine(): %s", strerror(errno));
+        return 0;
     }
 
-    if (i >= cap) i = cap - 1;
-    buffer[i] = '\0';
-
     if (truncated) {
         cWarn("receiveLine(): line exceeded cap=%zu (drained to newline)", cap);
     }
 
-    return (int)i;
+    return n;
 }
@@ -0,0 +1,224 @@
+#include "../inc/connectionPool.h"
+#include "../inc/peerHealth.h"
+#include "../inc/logger2.h"
+
+#include <cerrno>
+#include <sys/socket.h>
+
+static const int MAX_PER_PEER     = 8;    // open connections per seeder
+static const int IDLE_TTL_SEC     = 30;   // idle connections older than this get reaped
+static const int ACQUIRE_WAIT_MS  = 2000; // how long to wait on a full peer
+
+ConnectionPool& ConnectionPool::instance() {
+    static ConnectionPool pool;
+    return pool;
+}
+
+ConnectionPool::ConnectionPool() : stopping_(false) {
+    reaper_ = std::thread(&ConnectionPool::reapLoop, this);
+}
+
+ConnectionPool::~ConnectionPool() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (reaper_.joinable()) reaper_.join();
+    closeAll();
+}
+
+// An idle connection must have nothing to read (buffered or not): EOF or stray bytes mean the
+// peer went away or the stream is out of sync.
+bool ConnectionPool::healthy(const clientSocket& cs) {
+    if (cs.fd() < 0 || cs.buffered() > 0) return false;
+    char c;
+    ssize_t n = ::recv(cs.fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+    return false;
+}
+
+std::unique_ptr<clientSocket> ConnectionPool::acquire(const Endpoint& peer) {
+    const std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(ACQUIRE_WAIT_MS);
+
+    std::unique_lock<std::mutex> lock(mu_);
+    while (true) {
+        Peer& p = peers_[peer];
+
+        // most recently used first, it is the least likely to have gone stale
+        while (!p.idle.empty()) {
+            std::unique_ptr<clientSocket> cs = std::move(p.idle.back().cs);
+            p.idle.pop_back();
+            if (healthy(*cs)) return cs;
+            --p.open;
+            cDbg("pool: dropped stale connection to %s", peer.str().c_str());
+        }
+
+        if (p.open < MAX_PER_PEER) {
+            // known to be down: don't even try until its breaker lets us
+            if (!PeerHealth::instance().allow(peer)) return nullptr;
+
+            ++p.open;
+            lock.unlock();
+
+            std::unique_ptr<clientSocket> cs(new clientSocket());
+            // connected says little; whoever uses it reports how its request went
+            if (cs->connectServer(peer)) return cs;
+            PeerHealth::instance().failure(peer);
+
+            lock.lock();
+            --peers_[peer].open;
+            cv_.notify_all();
+            return nullptr;
+        }
+
+        if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+            cWarn("pool: no free connection to %s (cap %d)", peer.str().c_str(), MAX_PER_PEER);
+            return nullptr;
+        }
+    }
+}
+
+std::unique_ptr<clientSocket> ConnectionPool::idle(const Endpoint& peer) {
+    std::lock_guard<std::mutex> lock(mu_);
+    Peer& p = peers_[peer];
+    while (!p.idle.empty()) {
+        std::unique_ptr<clientSocket> cs = std::move(p.idle.back().cs);
+        p.idle.pop_back();
+        if (healthy(*cs)) return cs;
+        --p.open;
+        cDbg("pool: dropped stale connection to %s", peer.str().c_str());
+    }
+    return nullptr;
+}
+
+void ConnectionPool::release(const Endpoint& peer, std::unique_ptr<clientSocket> cs, bool reuse) {
+    if (!cs) return;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        Peer& p = peers_[peer];
+        if (reuse && !stopping_ && cs->fd() >= 0) {
+            Idle idle;
+            idle.cs = std::move(cs);
+            idle.since = std::chrono::steady_clock::now();
+            p.idle.push_back(std::move(idle));
+        } else {
+            --p.open;
+        }
+    }
+    cv_.notify_all();
+    // cs (if still held) closes here, outside the lock
+}
+
+void ConnectionPool::adopt(const Endpoint& peer, std::unique_ptr<clientSocket> cs) {
+    if (!cs || cs->fd() < 0) return;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        Peer& p = peers_[peer];
+        if (stopping_ || p.open >= MAX_PER_PEER) return;   // cs closes on return
+        ++p.open;
+        Idle idle;
+        idle.cs = std::move(cs);
+        idle.since = std::chrono::steady_clock::now();
+        p.idle.push_back(std::move(idle));
+    }
+    cv_.notify_all();
+}
+
+std::vector<Endpoint> ConnectionPool::warm(const std::vector<Endpoint>& peers) {
+    std::mutex orderMu;
+    std::vector<Endpoint> order;
+    std::vector<std::thread> racers;
+
+    for (size_t i = 0; i < peers.size(); ++i) {
+        const Endpoint peer = peers[i];
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            Peer& p = peers_[peer];
+            if (!p.idle.empty()) {
+                std::lock_guard<std::mutex> olock(orderMu);
+                order.push_back(peer);   // already warm
+                continue;
+            }
+        }
+
+        racers.push_back(std::thread([this, peer, &orderMu, &order]() {
+            std::unique_ptr<clientSocket> cs = acquire(peer);
+            if (!cs) return;
+            {
+                std::lock_guard<std::mutex> lock(orderMu);
+                order.push_back(peer);
+            }
+            release(peer, std::move(cs), true);
+        }));
+    }
+
+    for (size_t i = 0; i < racers.size(); ++i) racers[i].join();
+    return order;
+}
+
+void ConnectionPool::closeAll() {
+    std::vector<std::unique_ptr<clientSocket> > doomed;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (std::map<Endpoint, Peer>::iterator it = peers_.begin(); it != peers_.end(); ++it) {
+            Peer& p = it->second;
+            while (!p.idle.empty()) {
+                doomed.push_back(std::move(p.idle.front().cs));
+                p.idle.pop_front();
+                --p.open;
+            }
+        }
+    }
+    cv_.notify_all();
+}
+
+void ConnectionPool::reapLoop() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!stopping_) {
+        cv_.wait_for(lock, std::chrono::seconds(1));
+        if (stopping_) break;
+
+        const std::chrono::steady_clock::time_point cutoff =
+            std::chrono::steady_clock::now() - std::chrono::seconds(IDLE_TTL_SEC);
+
+        std::vector<std::unique_ptr<clientSocket> > doomed;
+        for (std::map<Endpoint, Peer>::iterator it = peers_.begin(); it != peers_.end(); ++it) {
+            Peer& p = it->second;
+            // oldest sit at the front
+            while (!p.idle.empty() && p.idle.front().since < cutoff) {
+                doomed.push_back(std::move(p.idle.front().cs));
+                p.idle.pop_front();
+                --p.open;
+            }
+        }
+
+        if (!doomed.empty()) {
+            lock.unlock();
+            cDbg("pool: reaped %zu idle connection(s)", doomed.size());
+            doomed.clear();
+            lock.lock();
+        }
+    }
+}
+
+bool PooledConnection::open(const Endpoint& peer) {
+    release();
+    cs_ = ConnectionPool::instance().acquire(peer);
+    if (!cs_) return false;
+    peer_ = peer;
+    return true;
+}
+
+void PooledConnection::release() {
+    if (cs_) ConnectionPool::instance().release(peer_, std::move(cs_), true);
+    cs_.reset();
+    peer_ = Endpoint();
+}
+
+void PooledConnection::discard() {
+    if (cs_) ConnectionPool::instance().release(peer_, std::move(cs_), false);
+    cs_.reset();
+    peer_ = Endpoint();
+}
@@ -0,0 +1,160 @@
+#include "../inc/deltaSync.h"
+#include "../inc/sha256.h"
+#include "../inc/bufferPool.h"
+
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace DeltaSync {
+
+static const int    BLOCK_MIN   = 512;
+static const int    BLOCK_MAX   = 16 * 1024;
+static const size_t STRONG_HEX  = 32;          // 128 bits of sha256 is plenty per block
+static const size_t LITERAL_MAX = 64 * 1024;   // flush literals at least this often
+static const int    BUFFER_WAIT_MS = 5000;     // for a block buffer at the pool's cap
+
+// rsync's rule of thumb: about sqrt(size), so signature and delta stay small
+int blockSizeFor(long long fileSize) {
+    long long b = (long long)std::sqrt((double)(fileSize > 0 ? fileSize : 0));
+    b = (b + 7) & ~7LL;
+    if (b < BLOCK_MIN) b = BLOCK_MIN;
+    if (b > BLOCK_MAX) b = BLOCK_MAX;
+    return (int)b;
+}
+
+// a = sum of bytes, b = sum of running a, both mod 2^16 (rsync / adler style)
+uint32_t weakSum(const char* p, size_t len) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += (unsigned char)p[i];
+        b += (uint32_t)(len - i) * (unsigned char)p[i];
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+std::string strongSum(const char* p, size_t len) {
+    return Sha256::hex(p, len).substr(0, STRONG_HEX);
+}
+
+bool signature(const std::string& path, int blockSize, std::vector<BlockSig>& out) {
+    out.clear();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    BufferPool::Buffer buf = BufferPool::instance().get((size_t)blockSize, BufferPool::DELTA, BUFFER_WAIT_MS);
+    if (!buf) {
+        ::close(fd);
+        return false;
+    }
+    while (true) {
+        size_t got = 0;
+        while (got < buf.size()) {
+            ssize_t n = ::read(fd, buf.data() + got, buf.size() - got);
+            if (n < 0) {
+                ::close(fd);
+                return false;
+            }
+            if (n == 0) break;
+            got += (size_t)n;
+        }
+        if (got < buf.size()) break;       // tail goes over as literal
+
+        BlockSig s;
+        s.weak = weakSum(buf.data(), got);
+        s.strong = strongSum(buf.data(), got);
+        out.push_back(s);
+    }
+    ::close(fd);
+    return true;
+}
+
+bool generate(const char* data, size_t len, int blockSize,
+              const std::vector<BlockSig>& sigs,
+              const std::function<bool(const Op&)>& emit)
+{
+    const size_t B = (size_t)blockSize;
+
+    std::unordered_multimap<uint32_t, long long> byWeak;
+    byWeak.reserve(sigs.size());
+    for (size_t i = 0; i < sigs.size(); ++i) byWeak.insert(std::make_pair(sigs[i].weak, (long long)i));
+
+    size_t litStart = 0;      // start of pending literal bytes
+    long long runBlock = -1;  // pending run of consecutive copies
+    long long runCount = 0;
+
+    std::function<bool()> flushRun = [&]() {
+        if (runCount == 0) return true;
+        Op op = { true, runBlock, runCount, nullptr, 0 };
+        runBlock = -1;
+        runCount = 0;
+        return emit(op);
+    };
+    std::function<bool(size_t)> flushLiteral = [&](size_t end) {
+        while (litStart < end) {
+            const size_t n = std::min(LITERAL_MAX, end - litStart);
+            Op op = { false, 0, 0, data + litStart, n };
+            if (!emit(op)) return false;
+            litStart += n;
+        }
+        return true;
+    };
+
+    size_t pos = 0;
+    uint32_t a = 0, b = 0;
+    bool rolling = false;
+
+    while (!sigs.empty() && pos + B <= len) {
+        if (!rolling) {
+            const uint32_t w = weakSum(data + pos, B);
+            a = w & 0xffff;
+            b = w >> 16;
+            rolling = true;
+        }
+
+        const uint32_t weak = (a & 0xffff) | (b << 16);
+        long long hit = -1;
+        std::pair<std::unordered_multimap<uint32_t, long long>::const_iterator,
+                  std::unordered_multimap<uint32_t, long long>::const_iterator> range = byWeak.equal_range(weak);
+        if (range.first != range.second) {
+            const std::string strong = strongSum(data + pos, B);
+            // prefer continuing the current run
+            for (std::unordered_multimap<uint32_t, long long>::const_iterator it = range.first; it != range.second; ++it) {
+                if (sigs[(size_t)it->second].strong != strong) continue;
+                if (hit < 0 || it->second == runBlock + runCount) hit = it->second;
+            }
+        }
+
+        if (hit >= 0) {
+            if (litStart < pos) {
+                if (!flushRun() || !flushLiteral(pos)) return false;
+            }
+            if (runCount > 0 && hit != runBlock + runCount && !flushRun()) return false;
+            if (runCount == 0) runBlock = hit;
+            ++runCount;
+            pos += B;
+            litStart = pos;
+            rolling = false;
+            continue;
+        }
+
+        // slide one byte
+        if (pos + B < len) {
+            const uint32_t out = (unsigned char)data[pos];
+            const uint32_t in  = (unsigned char)data[pos + B];
+            a = (a - out + in) & 0xffff;
+            b = (b - (uint32_t)B * out + a) & 0xffff;
+        }
+        ++pos;
+        if (runCount > 0 && litStart < pos && !flushRun()) return false;
+        // keep data flowing on long unmatched stretches
+        if (pos - litStart >= LITERAL_MAX && !flushLiteral(pos)) return false;
+    }
+
+    if (!flushRun()) return false;
+    return flushLiteral(len);
+}
+
+}
@@ -0,0 +1,227 @@
+#include "../inc/downloadScheduler.h"
+#include "../inc/asyncIo.h"
+#include "../inc/logger2.h"
+
+static const int    POOL_THREADS = 16;     // shared by all jobs
+static const double SLICE_COST   = 512.0;  // bytes charged per slice, so idle polling isn't free
+
+JobControl::JobControl(int priority, int weight)
+    : state_(RUNNING), priority_(priority), weight_(weight < 1 ? 1 : weight) {}
+
+void JobControl::pause() {
+    int expect = RUNNING;
+    if (state_.compare_exchange_strong(expect, PAUSED)) DownloadScheduler::instance().wake();
+}
+
+void JobControl::resume() {
+    int expect = PAUSED;
+    if (state_.compare_exchange_strong(expect, RUNNING)) DownloadScheduler::instance().wake();
+}
+
+void JobControl::cancel() {
+    state_.store(CANCELLED);
+    DownloadScheduler::instance().wake();
+}
+
+void JobControl::setPriority(int p) {
+    priority_.store(p);
+    DownloadScheduler::instance().wake();
+}
+
+void JobControl::setWeight(int w) {
+    weight_.store(w < 1 ? 1 : w);
+}
+
+DownloadScheduler& DownloadScheduler::instance() {
+    static DownloadScheduler sched;
+    return sched;
+}
+
+DownloadScheduler::DownloadScheduler() : vtime_(0.0), stopping_(false) {
+    for (int i = 0; i < POOL_THREADS; ++i)
+        threads_.push_back(std::thread(&DownloadScheduler::workerLoop, this));
+}
+
+DownloadScheduler::~DownloadScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i) {
+        if (threads_[i].joinable()) threads_[i].join();
+    }
+}
+
+void DownloadScheduler::wake() {
+    cv_.notify_all();
+}
+
+DownloadScheduler::Run::Run(DownloadScheduler& s, JobControl& ctl, const std::vector<SchedTask*>& tasks)
+    : s_(s), job_(new Job())
+{
+    job_->ctl = &ctl;
+    job_->live = tasks.size();
+    job_->nextLane = 0;
+    job_->pass = 0.0;
+    job_->idle = false;
+    job_->interrupted = false;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        LaneSlot ls;
+        ls.task = tasks[i];
+        ls.running = false;
+        ls.parked = false;
+        ls.blocked = false;
+        ls.poked = false;
+        ls.finished = false;
+        job_->lanes.push_back(ls);
+    }
+}
+
+bool DownloadScheduler::Run::await_ready() const noexcept {
+    return job_->live == 0;
+}
+
+void DownloadScheduler::Run::await_suspend(std::coroutine_handle<> h) {
+    std::lock_guard<std::mutex> lock(s_.mu_);
+    job_->waiter = h;
+    job_->pass = s_.vtime_;               // join at the current virtual time
+    s_.jobs_.push_back(job_.get());
+    s_.cv_.notify_all();
+}
+
+DownloadScheduler::Run DownloadScheduler::runAsync(JobControl& ctl, const std::vector<SchedTask*>& tasks) {
+    return Run(*this, ctl, tasks);
+}
+
+static Async::Task<void> awaitRun(DownloadScheduler& s, JobControl& ctl, std::vector<SchedTask*> tasks) {
+    co_await s.runAsync(ctl, tasks);
+}
+
+void DownloadScheduler::run(JobControl& ctl, const std::vector<SchedTask*>& tasks) {
+    Async::syncWait(awaitRun(*this, ctl, tasks));
+}
+
+void DownloadScheduler::poke(SchedTask* task) {
+    std::lock_guard<std::mutex> lock(mu_);
+    for (std::list<Job*>::iterator it = jobs_.begin(); it != jobs_.end(); ++it) {
+        for (size_t k = 0; k < (*it)->lanes.size(); ++k) {
+            LaneSlot& ls = (*it)->lanes[k];
+            if (ls.task != task) continue;
+            if (ls.running) ls.poked = true;
+            ls.blocked = false;
+            cv_.notify_all();
+            return;
+        }
+    }
+}
+
+// free sockets of a cancelled job now instead of waiting for requests to time out
+void DownloadScheduler::interruptCancelledLocked() {
+    for (std::list<Job*>::iterator it = jobs_.begin(); it != jobs_.end(); ++it) {
+        Job* j = *it;
+        if (j->interrupted || !j->ctl->stopRequested()) continue;
+        j->interrupted = true;
+        for (size_t k = 0; k < j->lanes.size(); ++k) {
+            if (!j->lanes[k].finished) j->lanes[k].task->interrupt();
+        }
+    }
+}
+
+// Strict priority between jobs, lowest pass within a priority, round robin
+// between the lanes of the chosen job.
+bool DownloadScheduler::pickLocked(Job*& outJob, size_t& outLane, SchedTask::TimePoint& nextWake) {
+    const SchedTask::TimePoint now = std::chrono::steady_clock::now();
+    Job* best = nullptr;
+    size_t bestLane = 0;
+
+    for (std::list<Job*>::iterator it = jobs_.begin(); it != jobs_.end(); ++it) {
+        Job* j = *it;
+        const JobControl::State st = j->ctl->state();
+
+        if (st == JobControl::RUNNING && j->idle) {
+            // back from a pause: don't let it cash in the time it sat out
+            if (j->pass < vtime_) j->pass = vtime_;
+            j->idle = false;
+        }
+        if (st == JobControl::PAUSED) j->idle = true;
+
+        for (size_t k = 0; k < j->lanes.size(); ++k) {
+            const size_t li = (j->nextLane + k) % j->lanes.size();
+            LaneSlot& ls = j->lanes[li];
+            if (ls.running || ls.finished || ls.blocked) continue;
+
+            bool ready = false;
+            if (st == JobControl::CANCELLED) ready = true;                 // let it clean up
+            else if (st == JobControl::PAUSED) ready = !ls.parked;          // let it let go of its socket
+            else if (ls.wakeAt > now) {
+                if (nextWake == SchedTask::TimePoint() || ls.wakeAt < nextWake) nextWake = ls.wakeAt;
+            } else ready = true;
+            if (!ready) continue;
+
+            const bool better = !best ||
+                j->ctl->priority() > best->ctl->priority() ||
+                (j->ctl->priority() == best->ctl->priority() && j->pass < best->pass);
+            if (better) {
+                best = j;
+                bestLane = li;
+            }
+            break;
+        }
+    }
+
+    if (!best) return false;
+    outJob = best;
+    outLane = bestLane;
+    best->nextLane = (bestLane + 1) % best->lanes.size();
+    return true;
+}
+
+void DownloadScheduler::workerLoop() {
+    std::unique_lock<std::mutex> lock(mu_);
+    while (!stopping_) {
+        interruptCancelledLocked();
+
+        Job* job = nullptr;
+        size_t li = 0;
+        SchedTask::TimePoint nextWake;
+        if (!pickLocked(job, li, nextWake)) {
+            if (nextWake == SchedTask::TimePoint()) cv_.wait(lock);
+            else cv_.wait_until(lock, nextWake);
+            continue;
+        }
+
+        job->lanes[li].running = true;
+        job->lanes[li].parked = false;
+        job->lanes[li].poked = false;
+        SchedTask* task = job->lanes[li].task;
+        vtime_ = job->pass;
+        lock.unlock();
+
+        long long bytes = 0;
+        SchedTask::TimePoint wakeAt;
+        const SchedTask::Result r = task->step(bytes, wakeAt);
+
+        lock.lock();
+        LaneSlot& ls = job->lanes[li];
+        ls.running = false;
+        ls.wakeAt = SchedTask::TimePoint();
+        job->pass += ((double)bytes + SLICE_COST) / (double)job->ctl->weight();
+
+        if (r == SchedTask::WAIT) ls.wakeAt = wakeAt;
+        else if (r == SchedTask::PARKED) ls.parked = true;
+        else if (r == SchedTask::BLOCKED) ls.blocked = !ls.poked;
+        else if (r == SchedTask::FINISHED) {
+            ls.finished = true;
+            if (--job->live == 0) {
+                // last lane done: hand the job back to whoever awaits it
+                jobs_.remove(job);
+                const std::coroutine_handle<> waiter = job->waiter;
+                lock.unlock();
+                waiter.resume();
+                lock.lock();
+            }
+        }
+        cv_.notify_all();
+    }
+}
@@ -0,0 +1,116 @@
+#include "../inc/downloadSink.h"
+#include "../inc/logger2.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+FileSink::~FileSink() {
+    if (fd_ >= 0) end(false);
+}
+
+bool FileSink::begin(long long) {
+    const std::string tmp = path_ + ".part";
+    fd_ = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        logErr("FileSink: cannot create '%s': %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool FileSink::write(long long offset, const char* data, size_t n) {
+    size_t put = 0;
+    while (put < n) {
+        const ssize_t w = ::pwrite(fd_, data + put, n - put, (off_t)(offset + (long long)put));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) {
+            logErr("FileSink: write failed for '%s': %s", path_.c_str(), strerror(errno));
+            return false;
+        }
+        put += (size_t)w;
+    }
+    return true;
+}
+
+bool FileSink::end(bool ok) {
+    const std::string tmp = path_ + ".part";
+    if (fd_ >= 0 && ::close(fd_) != 0) ok = false;
+    fd_ = -1;
+    if (ok && std::rename(tmp.c_str(), path_.c_str()) == 0) return true;
+    std::remove(tmp.c_str());
+    return false;
+}
+
+bool MemorySink::begin(long long size) {
+    try {
+        data_.assign((size_t)size, '\0');
+    } catch (const std::bad_alloc&) {
+        logErr("MemorySink: no room for %lld bytes", size);
+        return false;
+    }
+    return true;
+}
+
+bool MemorySink::write(long long offset, const char* data, size_t n) {
+    if (offset < 0 || (size_t)offset > data_.size() || n > data_.size() - (size_t)offset) return false;
+    std::memcpy(&data_[(size_t)offset], data, n);
+    return true;
+}
+
+bool MemorySink::end(bool ok) {
+    if (!ok) std::string().swap(data_);
+    return ok;
+}
+
+FdSink::~FdSink() {
+    if (close_ && fd_ >= 0) ::close(fd_);
+}
+
+bool FdSink::begin(long long) {
+    sent_ = 0;
+    return fd_ >= 0;
+}
+
+bool FdSink::write(long long offset, const char* data, size_t n) {
+    if (offset != sent_) {
+        logErr("FdSink: got offset %lld, expected %lld", offset, sent_);
+        return false;
+    }
+
+    // a reader closing the pipe should fail the download, not end the process;
+    // the caller's thread gets its signal mask back afterwards
+    sigset_t pipeSet, old;
+    sigemptyset(&pipeSet);
+    sigaddset(&pipeSet, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeSet, &old);
+
+    size_t put = 0;
+    while (put < n) {
+        const ssize_t w = ::write(fd_, data + put, n - put);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        put += (size_t)w;
+    }
+    sent_ += (long long)put;
+
+    struct timespec zero = { 0, 0 };
+    while (sigtimedwait(&pipeSet, nullptr, &zero) > 0) {}
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+
+    if (put < n) logWarn("FdSink: reader went away after %lld bytes", sent_);
+    return put == n;
+}
+
+bool FdSink::end(bool ok) {
+    if (close_ && fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    return ok;
+}
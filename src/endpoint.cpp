@@ -0,0 +1,113 @@
+#include "../inc/endpoint.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <ifaddrs.h>
+
+std::string Endpoint::str() const {
+    char out[96];
+    if (host.empty()) std::snprintf(out, sizeof(out), "*:%d", port);
+    else if (host.find(':') != std::string::npos) std::snprintf(out, sizeof(out), "[%s]:%d", host.c_str(), port);
+    else std::snprintf(out, sizeof(out), "%s:%d", host.c_str(), port);
+    return out;
+}
+
+// text form as inet_ntop prints it, so "::0001" and "::1" compare equal
+static std::string canonical(const std::string& host) {
+    unsigned char buf[sizeof(in6_addr)];
+    char out[INET6_ADDRSTRLEN];
+    if (::inet_pton(AF_INET, host.c_str(), buf) == 1) return ::inet_ntop(AF_INET, buf, out, sizeof(out));
+    if (::inet_pton(AF_INET6, host.c_str(), buf) == 1) return ::inet_ntop(AF_INET6, buf, out, sizeof(out));
+    return host;
+}
+
+bool Endpoint::validHost(const std::string& host) {
+    unsigned char buf[sizeof(in6_addr)];
+    return ::inet_pton(AF_INET, host.c_str(), buf) == 1 || ::inet_pton(AF_INET6, host.c_str(), buf) == 1;
+}
+
+bool Endpoint::parse(const std::string& text, Endpoint& out, const std::string& defaultHost) {
+    std::string host = defaultHost;
+    std::string port = text;
+
+    if (!text.empty() && text[0] == '[') {
+        const size_t close = text.find("]:");
+        if (close == std::string::npos) return false;
+        host = text.substr(1, close - 1);
+        port = text.substr(close + 2);
+    } else {
+        const size_t colon = text.rfind(':');
+        if (colon != std::string::npos) {
+            // a bare IPv6 address has more than one colon and no port
+            if (text.find(':') != colon) return false;
+            host = text.substr(0, colon);
+            port = text.substr(colon + 1);
+        }
+    }
+
+    char* end = nullptr;
+    const long p = std::strtol(port.c_str(), &end, 10);
+    if (port.empty() || *end != '\0' || p <= 0 || p > 65535) return false;
+    if (!validHost(host)) return false;
+
+    out.host = canonical(host);
+    out.port = (int)p;
+    return true;
+}
+
+bool Endpoint::toSockaddr(sockaddr_storage& out, socklen_t& len) const {
+    std::memset(&out, 0, sizeof(out));
+    const std::string h = host.empty() ? "127.0.0.1" : host;
+
+    sockaddr_in* v4 = (sockaddr_in*)&out;
+    if (::inet_pton(AF_INET, h.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons((uint16_t)port);
+        len = sizeof(sockaddr_in);
+        return true;
+    }
+    sockaddr_in6* v6 = (sockaddr_in6*)&out;
+    if (::inet_pton(AF_INET6, h.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons((uint16_t)port);
+        len = sizeof(sockaddr_in6);
+        return true;
+    }
+    return false;
+}
+
+bool Endpoint::covers(const Endpoint& other) const {
+    if (port != other.port) return false;
+    if (host == other.host) return true;
+    return host.empty() && isLocalAddress(other.host);
+}
+
+bool isLocalAddress(const std::string& host) {
+    static std::once_flag once;
+    static std::set<std::string> local;
+    std::call_once(once, []() {
+        ifaddrs* list = nullptr;
+        if (::getifaddrs(&list) != 0) return;
+        char out[INET6_ADDRSTRLEN];
+        for (ifaddrs* it = list; it; it = it->ifa_next) {
+            if (!it->ifa_addr) continue;
+            if (it->ifa_addr->sa_family == AF_INET) {
+                ::inet_ntop(AF_INET, &((sockaddr_in*)it->ifa_addr)->sin_addr, out, sizeof(out));
+                local.insert(out);
+            } else if (it->ifa_addr->sa_family == AF_INET6) {
+                ::inet_ntop(AF_INET6, &((sockaddr_in6*)it->ifa_addr)->sin6_addr, out, sizeof(out));
+                local.insert(out);
+            }
+        }
+        ::freeifaddrs(list);
+    });
+
+    const std::string h = canonical(host);
+    if (h.compare(0, 4, "127.") == 0 || h == "::1") return true;   // all of 127/8 is ours
+    return local.count(h) > 0;
+}
@@ -1,14 +1,30 @@
     #include "../inc/fileScanner.h"
     #include "../inc/clientsocket.h"
+    #include "../inc/connectionPool.h"
+    #include "../inc/peerHealth.h"
+    #include "../inc/peerTable.h"
     #include "../inc/logger2.h"
     #include <sys/stat.h>
     #include <cstdio>
     #include <cstring>
     #include <vector>
     #include <string>
+    #include <memory>
+    #include <chrono>
+    #include <cerrno>
+    #include <cstdlib>
+    #include <random>
+    #include <algorithm>
+    #include <unistd.h>
+    #include <arpa/inet.h>
+    #include <sys/socket.h>
+    #include <sys/epoll.h>
      
     FileScanner::FileScanner(int startPort, int endPort)
-    : startPort_(startPort), endPort_(endPort) {}
+    : startPort_(startPort), endPort_(endPort), peers_(nullptr), sweepHosts_(1, "127.0.0.1"),
+      refreshed_(false), stopRefresh_(true) {}
+     
+    FileScanner::~FileScanner() { stopRefresh(); }
      
     std::string FileScanner::portDirectory(int port) const {
         char path[256];
@@ -28,92 +44,482 @@
         return stat(full.c_str(), &st) == 0;
     }
      
-    static void stripNewlines(char* s) {
-        if (!s) return;
-        size_t L = strlen(s);
-        while (L > 0 && (s[L - 1] == '\n' || s[L - 1] == '\r')) {
-            s[L - 1] = '\0';
-            --L;
+    static const int SCAN_CONNECT_MS = 300;    // per-peer connect deadline
+    static const int SCAN_LIST_MS    = 1500;   // per-peer deadline for the whole LIST reply
+
+    typedef std::chrono::steady_clock ScanClock;
+
+    struct ScanPeer {
+        Endpoint peer;
+        int fd;
+        bool connected;
+        int phase;                        // SCAN_* below
+        std::string buf;
+        std::vector<std::string> names;
+        std::vector<Endpoint> learned;    // peers it told us about
+        ScanClock::time_point deadline;
+    };
+
+    enum { SCAN_PEERS_HEAD = 0, SCAN_PEERS_BODY, SCAN_LIST_HEAD, SCAN_LIST_BODY };
+     
+    // Consume complete lines of the PEERS + LIST replies.
+    // 1 = saw the final <END>, 0 = need more, -1 = bad reply
+    static int parseListing(ScanPeer& p) {
+        size_t pos = 0;
+        while (true) {
+            size_t nl = p.buf.find('\n', pos);
+            if (nl == std::string::npos) break;
+     
+            std::string line = p.buf.substr(pos, nl - pos);
+            pos = nl + 1;
+            while (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+     
+            if (p.phase == SCAN_PEERS_HEAD) {
+                // a peer without gossip support answers PEERS with <BAD_REQUEST>
+                if (line == "<PEERS>") p.phase = SCAN_PEERS_BODY;
+                else if (line == "<BAD_REQUEST>") p.phase = SCAN_LIST_HEAD;
+                else {
+                    logWarn("PEERS: unexpected first line from %s: '%s'", p.peer.str().c_str(), line.c_str());
+                    return -1;
+                }
+                continue;
+            }
+            if (p.phase == SCAN_PEERS_BODY) {
+                if (line == "<END>") p.phase = SCAN_LIST_HEAD;
+                else if (line.compare(0, 5, "PEER ") == 0) {
+                    // older peers send bare ports: same host as theirs
+                    Endpoint e;
+                    if (Endpoint::parse(line.substr(5), e, p.peer.host)) p.learned.push_back(e);
+                }
+                continue;
+            }
+            if (p.phase == SCAN_LIST_HEAD) {
+                if (line != "<LIST>") {
+                    logWarn("LIST: unexpected first line from %s: '%s'", p.peer.str().c_str(), line.c_str());
+                    return -1;
+                }
+                p.phase = SCAN_LIST_BODY;
+                continue;
+            }
+            if (line == "<END>") {
+                p.buf.erase(0, pos);
+                return p.buf.empty() ? 1 : -1;       // trailing bytes: stream out of sync
+            }
+            if (line.compare(0, 5, "FILE ") == 0 && line.size() > 5) {
+                p.names.push_back(line.substr(5));
+            }
         }
+        p.buf.erase(0, pos);
+        return 0;
     }
      
-    static bool listFilesFromPort(int port, std::vector<std::string>& outNames) {
-        outNames.clear();
+    // Both requests go out in one segment: gossip our endpoint, then list files.
+    // Listening on every address we only send the port; the peer fills in
+    // the address it sees us coming from.
+    static bool sendRequests(int fd, const Endpoint& self) {
+        char req[128];
+        int len = self.anyAddress()
+            ? snprintf(req, sizeof(req), "PEERS %d\nLIST\n", self.port)
+            : snprintf(req, sizeof(req), "PEERS %s\nLIST\n", self.str().c_str());
+        ssize_t n = ::send(fd, req, (size_t)len, MSG_NOSIGNAL);
+        return n == (ssize_t)len;
+    }
      
-        clientSocket cs;
-        if (!cs.connectServer("127.0.0.1", port)) {
-            return false;
-        }
+    // Fire a non-blocking connect + PEERS/LIST at every target at once and report
+    // the replies as they come in. A dead or hung peer only costs its own
+    // deadline. Returns the peers that answered.
+    std::vector<Endpoint> FileScanner::scanPeers(const std::vector<Endpoint>& targets, const Endpoint& self,
+                                                 const ListingFn& onListing) const {
+        std::vector<Endpoint> answered;
      
-        if (!cs.sendData("LIST\n")) {
-            return false;
+        int ep = ::epoll_create1(EPOLL_CLOEXEC);
+        if (ep < 0) {
+            logErr("scan: epoll_create1 failed: %s", strerror(errno));
+            return answered;
         }
      
-        char line[512];
+        std::vector<ScanPeer> peers;
+        peers.reserve(targets.size());
+        const ScanClock::time_point start = ScanClock::now();
      
-        int n = cs.receiveLine(line, sizeof(line));
-        if (n <= 0) return false;
-        stripNewlines(line);
+        for (size_t t = 0; t < targets.size(); ++t) {
+            const Endpoint& peer = targets[t];
+            if (self.covers(peer)) continue;
+            if (!PeerHealth::instance().allow(peer)) continue;     // known down, backing off
      
-        if (strcmp(line, "<LIST>") != 0) {
-            logWarn("LIST: unexpected first line from port %d: '%s'", port, line);
-            return false;
+            sockaddr_storage addr;
+            socklen_t addrLen = 0;
+            if (!peer.toSockaddr(addr, addrLen)) continue;
+     
+            int fd = ::socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) continue;
+     
+            // from the address we gossip, or the peer won't take it
+            sockaddr_storage local;
+            socklen_t localLen = 0;
+            if (!self.anyAddress() && Endpoint(self.host, 0).toSockaddr(local, localLen) &&
+                local.ss_family == addr.ss_family && ::bind(fd, (sockaddr*)&local, localLen) != 0) {
+                logDbg("scan: cannot send from %s: %s", self.host.c_str(), strerror(errno));
+            }
+     
+            int rc = ::connect(fd, (sockaddr*)&addr, addrLen);
+            if (rc < 0 && errno != EINPROGRESS) {
+                ::close(fd);          // refused: port not active
+                PeerHealth::instance().failure(peer);
+                continue;
+            }
+     
+            ScanPeer p;
+            p.peer = peer;
+            p.fd = fd;
+            p.connected = (rc == 0);
+            p.phase = SCAN_PEERS_HEAD;
+            p.deadline = start + std::chrono::milliseconds(p.connected ? SCAN_LIST_MS : SCAN_CONNECT_MS);
+            if (p.connected && !sendRequests(fd, self)) {
+                ::close(fd);
+                continue;
+            }
+            peers.push_back(std::move(p));
         }
      
-        while (true) {
-            n = cs.receiveLine(line, sizeof(line));
-            if (n <= 0) return false;
-            stripNewlines(line);
+        for (size_t i = 0; i < peers.size(); ++i) {
+            epoll_event ev{};
+            ev.events = peers[i].connected ? EPOLLIN : EPOLLOUT;
+            ev.data.u32 = (uint32_t)i;
+            ::epoll_ctl(ep, EPOLL_CTL_ADD, peers[i].fd, &ev);
+        }
+     
+        size_t live = peers.size();
+        auto drop = [&](ScanPeer& p, const char* why) {
+            if (why) logDbg("scan: %s dropped (%s)", p.peer.str().c_str(), why);
+            ::epoll_ctl(ep, EPOLL_CTL_DEL, p.fd, nullptr);
+            ::close(p.fd);
+            p.fd = -1;
+            --live;
+        };
+     
+        epoll_event events[32];
+        while (live > 0) {
+            const ScanClock::time_point now = ScanClock::now();
+            long long waitMs = -1;
+            for (size_t i = 0; i < peers.size(); ++i) {
+                if (peers[i].fd < 0) continue;
+                if (peers[i].deadline <= now) {
+                    PeerHealth::instance().failure(peers[i].peer);
+                    drop(peers[i], "deadline");
+                    continue;
+                }
+                long long left = std::chrono::duration_cast<std::chrono::milliseconds>(peers[i].deadline - now).count() + 1;
+                if (waitMs < 0 || left < waitMs) waitMs = left;
+            }
+            if (live == 0) break;
+     
+            int n = ::epoll_wait(ep, events, 32, (int)waitMs);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                logErr("scan: epoll_wait failed: %s", strerror(errno));
+                break;
+            }
+     
+            for (int e = 0; e < n; ++e) {
+                ScanPeer& p = peers[events[e].data.u32];
+                if (p.fd < 0) continue;
+     
+                if (!p.connected) {
+                    int err = 0;
+                    socklen_t len = sizeof(err);
+                    ::getsockopt(p.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                    if (err != 0) {
+                        PeerHealth::instance().failure(p.peer);
+                        drop(p, nullptr);
+                        continue;
+                    }
+                    if (!sendRequests(p.fd, self)) { drop(p, nullptr); continue; }
+     
+                    p.connected = true;
+                    p.deadline = ScanClock::now() + std::chrono::milliseconds(SCAN_LIST_MS);
+                    epoll_event ev{};
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = events[e].data.u32;
+                    ::epoll_ctl(ep, EPOLL_CTL_MOD, p.fd, &ev);
+                    continue;
+                }
+     
+                char chunk[4096];
+                int state = 0;
+                while (true) {
+                    ssize_t r = ::recv(p.fd, chunk, sizeof(chunk), 0);
+                    if (r > 0) { p.buf.append(chunk, (size_t)r); continue; }
+                    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                    if (r < 0 && errno == EINTR) continue;
+                    state = -1;           // EOF or error before <END>
+                    break;
+                }
+                const int parsed = parseListing(p);
+                if (parsed < 0 || (parsed == 0 && state < 0)) {
+                    PeerHealth::instance().failure(p.peer);
+                    drop(p, "bad or truncated LIST");
+                    continue;
+                }
+                if (parsed == 0) continue;
      
-            if (strcmp(line, "<END>") == 0) break;
+                PeerHealth::instance().success(p.peer);
+                answered.push_back(p.peer);
+                onListing(p.peer, p.names, p.learned);
      
-            if (strncmp(line, "FILE ", 5) == 0) {
-                const char* name = line + 5;
-                if (*name) outNames.push_back(std::string(name));
+                // the connection is clean and idle now, let downloads reuse it
+                ::epoll_ctl(ep, EPOLL_CTL_DEL, p.fd, nullptr);
+                std::unique_ptr<clientSocket> cs(new clientSocket());
+                if (cs->adopt(p.fd)) ConnectionPool::instance().adopt(p.peer, std::move(cs));
+                else ::close(p.fd);
+                p.fd = -1;
+                --live;
             }
         }
      
-        return true;
+        for (size_t i = 0; i < peers.size(); ++i) {
+            if (peers[i].fd >= 0) ::close(peers[i].fd);
+        }
+        ::close(ep);
+        return answered;
     }
      
-    std::vector<FileEntry> FileScanner::scanOtherPorts(int myPort) const {
-        std::vector<FileEntry> out;
+    // ---- catalog ----
      
-        for (int port = startPort_; port <= endPort_; ++port) {
-            if (port == myPort) continue;
+    static const int CATALOG_TTL_SEC   = 20;    // background refresh period
+    static const int CATALOG_JITTER_PC = 25;    // +/- percent, so peers don't rescan in lockstep
+    static const int GOSSIP_FAST_MS    = 1500;  // next round while gossip is still turning up peers
+    static const int BOOTSTRAP_PORTS   = 5;     // start of the range, tried while we know no one
      
-            //if port inactive or unsupported list
-            std::vector<std::string> names;
-            if (!listFilesFromPort(port, names)) {
-                continue; 
-            }
+    // Diff this peer's new listing against the previous one; only changed names
+    // touch the index. Caller holds catMu_.
+    void FileScanner::applyListing(const Endpoint& peer, const std::vector<std::string>& names) {
+        std::unordered_set<std::string> fresh(names.begin(), names.end());
+        std::unordered_set<std::string>& old = listings_[peer];
+     
+        for (std::unordered_set<std::string>::const_iterator it = old.begin(); it != old.end(); ++it) {
+            if (fresh.count(*it)) continue;
+            std::unordered_map<std::string, FileEntry>::iterator fe = files_.find(*it);
+            if (fe == files_.end()) continue;
+            std::vector<Endpoint>& s = fe->second.seeders;
+            s.erase(std::remove(s.begin(), s.end(), peer), s.end());
+            if (s.empty()) files_.erase(fe);
+        }
      
-            for (size_t k = 0; k < names.size(); ++k) {
-                const std::string& fname = names[k];
+        for (std::unordered_set<std::string>::const_iterator it = fresh.begin(); it != fresh.end(); ++it) {
+            if (old.count(*it)) continue;
+            FileEntry& fe = files_[*it];
+            fe.filename = *it;
+            fe.seeders.push_back(peer);
+        }
+     
+        if (fresh.empty()) listings_.erase(peer);
+        else old.swap(fresh);
+    }
      
-                int idx = -1;
-                for (int i = 0; i < (int)out.size(); ++i) {
-                    if (out[i].filename == fname) { idx = i; break; }
+    // Who to contact this round: the known peers, or the first few ports of the
+    // range (claimed first by new instances) on each sweep host until gossip
+    // has found someone.
+    std::vector<Endpoint> FileScanner::scanTargets(const Endpoint& self) const {
+        std::vector<Endpoint> targets;
+        if (peers_) targets = peers_->all();
+        if (targets.empty()) {
+            const int last = peers_ ? std::min(endPort_, startPort_ + BOOTSTRAP_PORTS - 1) : endPort_;
+            for (size_t h = 0; h < sweepHosts_.size(); ++h) {
+                for (int port = startPort_; port <= last; ++port) {
+                    const Endpoint e(sweepHosts_[h], port);
+                    if (!self.covers(e)) targets.push_back(e);
                 }
+            }
+        }
+        return targets;
+    }
+     
+    size_t FileScanner::scanRound(const Endpoint& self, const ScanProgressFn& onPeer) {
+        std::lock_guard<std::mutex> scanLock(scanMu_);
      
-                if (idx >= 0) {
-                    bool already = false;
-                    for (size_t j = 0; j < out[idx].seeders.size(); ++j) {
-                        if (out[idx].seeders[j] == port) { already = true; break; }
+        size_t newPeers = 0;
+        const std::vector<Endpoint> targets = scanTargets(self);
+        const std::vector<Endpoint> answered = scanPeers(targets, self,
+            [this, &onPeer, &newPeers](const Endpoint& peer, const std::vector<std::string>& names,
+                                        const std::vector<Endpoint>& learned) {
+                {
+                    std::lock_guard<std::mutex> lock(catMu_);
+                    applyListing(peer, names);
+                }
+                if (peers_) {
+                    peers_->add(peer);
+                    for (size_t k = 0; k < learned.size(); ++k) {
+                        if (peers_->add(learned[k])) ++newPeers;
                     }
-                    if (!already) out[idx].seeders.push_back(port);
-                } else {
-                    FileEntry fe;
-                    fe.filename = fname;
-                    fe.seeders.push_back(port);
-                    out.push_back(fe);
                 }
+                if (onPeer) onPeer(peer, names);
+            });
+     
+        {
+            std::lock_guard<std::mutex> lock(catMu_);
+            // whoever did not answer this round is gone
+            std::vector<Endpoint> gone;
+            for (std::unordered_map<Endpoint, std::unordered_set<std::string> >::const_iterator it = listings_.begin();
+                 it != listings_.end(); ++it) {
+                if (std::find(answered.begin(), answered.end(), it->first) == answered.end())
+                    gone.push_back(it->first);
+            }
+            for (size_t i = 0; i < gone.size(); ++i) applyListing(gone[i], std::vector<std::string>());
+     
+            refreshedAt_ = std::chrono::steady_clock::now();
+            refreshed_ = true;
+        }
+        if (peers_) {
+            // only forget peers we actually tried; fresh gossip gets its chance next round
+            for (size_t i = 0; i < targets.size(); ++i) {
+                if (std::find(answered.begin(), answered.end(), targets[i]) == answered.end())
+                    peers_->remove(targets[i]);
             }
         }
      
+        saveSnapshot(self.port);
+        if (newPeers > 0) logInfo("gossip: learned %zu new peer(s), table=%zu", newPeers, peers_->size());
+        return newPeers;
+    }
+     
+    std::vector<FileEntry> FileScanner::scanOtherPorts(const Endpoint& self, const ScanProgressFn& onPeer) {
+        scanRound(self, onPeer);
+        return catalog();
+    }
+     
+    std::vector<FileEntry> FileScanner::catalog() const {
+        std::vector<FileEntry> out;
+        {
+            std::lock_guard<std::mutex> lock(catMu_);
+            out.reserve(files_.size());
+            for (std::unordered_map<std::string, FileEntry>::const_iterator it = files_.begin(); it != files_.end(); ++it)
+                out.push_back(it->second);
+        }
+        std::sort(out.begin(), out.end(), [](const FileEntry& a, const FileEntry& b) {
+            return a.filename < b.filename;
+        });
+        for (size_t i = 0; i < out.size(); ++i) std::sort(out[i].seeders.begin(), out[i].seeders.end());
         return out;
     }
      
+    long long FileScanner::catalogAgeSec() const {
+        std::lock_guard<std::mutex> lock(catMu_);
+        if (!refreshed_) return -1;
+        return (long long)std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - refreshedAt_).count();
+    }
+     
+    std::string FileScanner::snapshotPath(int myPort) const {
+        char path[256];
+        snprintf(path, sizeof(path), "bin/ports/catalog_%d.txt", myPort);
+        return std::string(path);
+    }
+     
+    // One line per file: "<host:port>,<host:port>...\t<filename>"
+    bool FileScanner::saveSnapshot(int myPort) const {
+        const std::string path = snapshotPath(myPort);
+        const std::string tmp = path + ".tmp";
+     
+        FILE* fp = fopen(tmp.c_str(), "wb");
+        if (!fp) {
+            logWarn("catalog: cannot write snapshot '%s'", tmp.c_str());
+            return false;
+        }
+     
+        const std::vector<FileEntry> snap = catalog();
+        for (size_t i = 0; i < snap.size(); ++i) {
+            for (size_t j = 0; j < snap[i].seeders.size(); ++j)
+                fprintf(fp, j ? ",%s" : "%s", snap[i].seeders[j].str().c_str());
+            fprintf(fp, "\t%s\n", snap[i].filename.c_str());
+        }
+        fclose(fp);
+     
+        return rename(tmp.c_str(), path.c_str()) == 0;
+    }
+     
+    bool FileScanner::loadSnapshot(const Endpoint& self) {
+        FILE* fp = fopen(snapshotPath(self.port).c_str(), "rb");
+        if (!fp) return false;
+     
+        std::unordered_map<Endpoint, std::vector<std::string> > byPeer;
+        char line[1024];
+        while (fgets(line, sizeof(line), fp)) {
+            size_t L = strlen(line);
+            while (L > 0 && (line[L - 1] == '\n' || line[L - 1] == '\r')) line[--L] = '\0';
+     
+            char* tab = strchr(line, '\t');
+            if (!tab || !tab[1]) continue;
+            *tab = '\0';
+     
+            const std::string name(tab + 1);
+            char* save = nullptr;
+            for (char* tok = strtok_r(line, ",", &save); tok; tok = strtok_r(nullptr, ",", &save)) {
+                // older snapshots hold bare ports. Gossip-learned peers and
+                // other hosts count too, not just our own port range
+                Endpoint peer;
+                if (!Endpoint::parse(tok, peer) || self.covers(peer)) continue;
+                byPeer[peer].push_back(name);
+                if (peers_) peers_->add(peer);
+            }
+        }
+        fclose(fp);
+     
+        std::lock_guard<std::mutex> lock(catMu_);
+        for (std::unordered_map<Endpoint, std::vector<std::string> >::const_iterator it = byPeer.begin(); it != byPeer.end(); ++it)
+            applyListing(it->first, it->second);
+     
+        logInfo("catalog: loaded %zu file(s) from snapshot", files_.size());
+        return true;
+    }
+     
+    void FileScanner::startRefresh(const Endpoint& self) {
+        stopRefresh();
+        {
+            std::lock_guard<std::mutex> lock(refreshMu_);
+            stopRefresh_ = false;
+        }
+        refresher_ = std::thread(&FileScanner::refreshLoop, this, self);
+    }
+     
+    void FileScanner::stopRefresh() {
+        {
+            std::lock_guard<std::mutex> lock(refreshMu_);
+            stopRefresh_ = true;
+        }
+        refreshCv_.notify_all();
+        if (refresher_.joinable()) refresher_.join();
+    }
+     
+    void FileScanner::refreshLoop(Endpoint self) {
+        std::mt19937 rng((unsigned)std::random_device()() ^ (unsigned)self.port);
+        const int spread = CATALOG_TTL_SEC * 1000 * CATALOG_JITTER_PC / 100;
+        std::uniform_int_distribution<int> jitter(-spread, spread);
+     
+        // first refresh right away (well, within a second) so the snapshot gets corrected
+        int waitMs = std::uniform_int_distribution<int>(0, 1000)(rng);
+     
+        unsigned long seen = peers_ ? peers_->version() : 0;
+     
+        std::unique_lock<std::mutex> lock(refreshMu_);
+        while (!stopRefresh_) {
+            refreshCv_.wait_for(lock, std::chrono::milliseconds(waitMs));
+            if (stopRefresh_) break;
+     
+            lock.unlock();
+            scanRound(self, ScanProgressFn());
+            logDbg("catalog: background refresh done");
+            lock.lock();
+     
+            // keep gossiping quickly while the table is still growing, whether we
+            // learned peers from replies or from callers announcing themselves
+            const unsigned long now = peers_ ? peers_->version() : 0;
+            if (now != seen) waitMs = GOSSIP_FAST_MS + jitter(rng) / 10;
+            else             waitMs = CATALOG_TTL_SEC * 1000 + jitter(rng);
+            seen = now;
+        }
+    }
+     
     long long FileScanner::localSize(int myPort, const std::string& filename) const {
         std::string full = portDirectory(myPort) + "/" + filename;
         struct stat st;
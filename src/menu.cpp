@@ -2,7 +2,7 @@
 #include "../inc/logger2.h"
 
 #define START_PORT   9000
-#define END_PORT     9004
+#define END_PORT     9499
 #define BUFFER_SIZE  32
 
 int main() {
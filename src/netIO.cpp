@@ -1,6 +1,8 @@
 #include "../inc/netIO.h"
 #include <sys/socket.h>
 #include <errno.h>
+#include <string.h>
+#include <algorithm>
 
 namespace NetIo {
 
@@ -41,7 +43,7 @@ bool sendAll(int fd, const void* buf, size_t len) {
     const char* p = (const char*)buf;
     size_t sent = 0;
     while (sent < len) {
-        ssize_t n = ::send(fd, p + sent, len - sent, 0);
+        ssize_t n = ::send(fd, p + sent, len - sent, MSG_NOSIGNAL);
         if (n < 0) {
             if (errno == EINTR) continue;
             return false;
@@ -51,4 +53,91 @@ bool sendAll(int fd, const void* buf, size_t len) {
     return true;
 }
 
-}
\ No newline at end of file
+Reader::Reader(int fd) : fd_(fd), pos_(0), end_(0) {}
+
+void Reader::reset(int fd) {
+    fd_ = fd;
+    pos_ = end_ = 0;
+}
+
+long Reader::fill() {
+    if (buf_.empty()) buf_.resize(READ_BUF);
+    pos_ = end_ = 0;
+    while (true) {
+        ssize_t n = ::recv(fd_, buf_.data(), buf_.size(), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) end_ = (size_t)n;
+        return (long)n;
+    }
+}
+
+int Reader::readUntil(char delim, char* out, size_t cap, bool drain, bool* truncated) {
+    if (truncated) *truncated = false;
+    if (!out || cap == 0) return -1;
+
+    size_t i = 0;
+    while (true) {
+        if (pos_ == end_) {
+            const long n = fill();
+            if (n < 0) {
+                out[i] = '\0';
+                return -1;
+            }
+            if (n == 0) break;
+        }
+
+        const char* p = buf_.data() + pos_;
+        const size_t avail = end_ - pos_;
+        const char* hit = (const char*)memchr(p, delim, avail);
+        const size_t span = hit ? (size_t)(hit - p) + 1 : avail;
+        const size_t keep = std::min(span, cap - 1 - i);
+
+        memcpy(out + i, p, keep);
+        i += keep;
+        if (keep < span) {
+            if (truncated) *truncated = true;
+            if (!drain) {
+                pos_ += keep;
+                break;
+            }
+        }
+        pos_ += span;
+        if (hit) break;
+    }
+    out[i] = '\0';
+    return (int)i;
+}
+
+bool Reader::readExact(void* out, size_t len) {
+    char* p = (char*)out;
+    const size_t have = std::min(len, end_ - pos_);
+    if (have > 0) {
+        memcpy(p, buf_.data() + pos_, have);
+        pos_ += have;
+    }
+    // the rest goes straight into the caller's buffer, nothing past len is read
+    return recvAll(fd_, p + have, len - have);
+}
+
+long Reader::readSome(void* out, size_t len) {
+    if (pos_ < end_) {
+        const size_t n = std::min(len, end_ - pos_);
+        memcpy(out, buf_.data() + pos_, n);
+        pos_ += n;
+        return (long)n;
+    }
+    while (true) {
+        ssize_t n = ::recv(fd_, out, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        return (long)n;
+    }
+}
+
+std::string Reader::take() {
+    std::string out;
+    if (pos_ < end_) out.assign(buf_.data() + pos_, end_ - pos_);
+    pos_ = end_ = 0;
+    return out;
+}
+
+}
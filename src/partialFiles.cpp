@@ -0,0 +1,117 @@
+#include "../inc/partialFiles.h"
+#include "../inc/logger2.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+PartialFile::PartialFile(long long size, int chunkSize)
+    : size_(size), chunkSize_(chunkSize),
+      chunks_((size + chunkSize - 1) / chunkSize)
+{
+}
+
+PartialFile::~PartialFile() {
+    for (size_t i = 0; i < fds_.size(); ++i) ::close(fds_[i]);
+}
+
+bool PartialFile::addPart(const std::string& path, long long firstChunk) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        logWarn("Partial: cannot open '%s' for seeding: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    firstChunk_.push_back(firstChunk);
+    fds_.push_back(fd);
+    return true;
+}
+
+void PartialFile::mark(long long first, long long end) {
+    first = std::max(first, 0LL);
+    end = std::min(end, chunks_);
+    if (first >= end) return;
+    have_.add(first, end);
+    if (waiters_.load() > 0) {
+        std::lock_guard<std::mutex> lock(waitMu_);
+        waitCv_.notify_all();
+    }
+}
+
+bool PartialFile::has(long long chunk) const {
+    if (chunk < 0 || chunk >= chunks_) return false;
+    return have_.has(chunk);
+}
+
+bool PartialFile::waitFor(long long chunk, int ms) {
+    if (chunk < 0 || chunk >= chunks_) return false;
+
+    waiters_.fetch_add(1);
+    {
+        std::unique_lock<std::mutex> lock(waitMu_);
+        waitCv_.wait_for(lock, std::chrono::milliseconds(ms), [&]() { return finished_ || has(chunk); });
+    }
+    waiters_.fetch_sub(1);
+    return has(chunk);
+}
+
+void PartialFile::finish() {
+    {
+        std::lock_guard<std::mutex> lock(waitMu_);
+        finished_ = true;
+    }
+    waitCv_.notify_all();
+}
+
+std::vector<std::pair<long long, long long> > PartialFile::runs() const {
+    return have_.runsIn(0, chunks_);
+}
+
+std::string PartialFile::bitmap() const {
+    return have_.bitmap(chunks_);
+}
+
+long long PartialFile::read(long long chunk, char* out) const {
+    if (!has(chunk) || fds_.empty()) return -1;
+
+    size_t p = 0;
+    while (p + 1 < firstChunk_.size() && firstChunk_[p + 1] <= chunk) ++p;
+
+    const long long want = std::min((long long)chunkSize_, size_ - (long long)chunk * chunkSize_);
+    const off_t off = (off_t)(chunk - firstChunk_[p]) * (off_t)chunkSize_;
+    long long got = 0;
+    while (got < want) {
+        const ssize_t n = ::pread(fds_[p], out + got, (size_t)(want - got), off + (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += n;
+    }
+    return got;
+}
+
+void PartialFiles::publish(const std::string& name, const std::shared_ptr<PartialFile>& file) {
+    std::lock_guard<std::mutex> lock(mu_);
+    files_[name] = file;
+}
+
+void PartialFiles::withdraw(const std::string& name, const std::shared_ptr<PartialFile>& file) {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<std::string, std::shared_ptr<PartialFile> >::iterator it = files_.find(name);
+    if (it != files_.end() && it->second == file) files_.erase(it);
+}
+
+std::shared_ptr<PartialFile> PartialFiles::find(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<std::string, std::shared_ptr<PartialFile> >::const_iterator it = files_.find(name);
+    return it == files_.end() ? std::shared_ptr<PartialFile>() : it->second;
+}
+
+std::vector<std::string> PartialFiles::names() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<std::string> out;
+    for (std::map<std::string, std::shared_ptr<PartialFile> >::const_iterator it = files_.begin(); it != files_.end(); ++it)
+        out.push_back(it->first);
+    return out;
+}
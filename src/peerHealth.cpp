@@ -0,0 +1,89 @@
+#include "../inc/peerHealth.h"
+#include "../inc/logger2.h"
+
+#include <algorithm>
+#include <random>
+
+static const int FAILS_TO_OPEN   = 3;      // failures in a row that open a breaker
+static const int OPEN_BASE_MS    = 250;    // first backoff of an open breaker
+static const int OPEN_MAX_MS     = 30000;  // backoff never grows past this
+static const int PROBE_MS        = 5000;   // a probe that never reports back expires
+
+PeerHealth& PeerHealth::instance() {
+    static PeerHealth health;
+    return health;
+}
+
+// 50-100% of the capped exponential, so callers that failed together
+// don't all come back at once
+std::chrono::milliseconds PeerHealth::backoff(int attempt, int baseMs, int capMs) {
+    static thread_local std::mt19937 rng(std::random_device{}());
+    const long long full = std::min((long long)capMs, (long long)baseMs << std::min(std::max(attempt, 0), 20));
+    std::uniform_int_distribution<long long> jitter(full / 2, std::max(full / 2, full));
+    return std::chrono::milliseconds(jitter(rng));
+}
+
+bool PeerHealth::usableLocked(const Breaker& b, Clock::time_point now) const {
+    if (b.state == CLOSED) return true;
+    // OPEN past its backoff, or a probe that never reported back
+    return now >= b.retryAt;
+}
+
+bool PeerHealth::allow(const Endpoint& peer) {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<Endpoint, Breaker>::iterator it = peers_.find(peer);
+    if (it == peers_.end() || it->second.state == CLOSED) return true;
+
+    Breaker& b = it->second;
+    const Clock::time_point now = Clock::now();
+    if (!usableLocked(b, now)) return false;
+
+    b.state = HALF_OPEN;
+    b.retryAt = now + std::chrono::milliseconds(PROBE_MS);
+    logDbg("health: probing %s", peer.str().c_str());
+    return true;
+}
+
+// called for every answered request, so nothing to do is the common case
+void PeerHealth::success(const Endpoint& peer) {
+    if (tracked_.load(std::memory_order_relaxed) == 0) return;
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<Endpoint, Breaker>::iterator it = peers_.find(peer);
+    if (it == peers_.end()) return;
+    if (it->second.state != CLOSED) logInfo("health: %s is back", peer.str().c_str());
+    peers_.erase(it);
+    tracked_.store(peers_.size(), std::memory_order_relaxed);
+}
+
+void PeerHealth::failure(const Endpoint& peer) {
+    std::lock_guard<std::mutex> lock(mu_);
+    Breaker& b = peers_[peer];
+    tracked_.store(peers_.size(), std::memory_order_relaxed);
+    ++b.fails;
+    // open already: stragglers that connected before it opened don't count
+    if (b.state == OPEN || (b.state == CLOSED && b.fails < FAILS_TO_OPEN)) return;
+
+    // failed probe, or the last straw: (re)open with the next backoff
+    const std::chrono::milliseconds wait = backoff(b.trips, OPEN_BASE_MS, OPEN_MAX_MS);
+    if (b.state == CLOSED) {
+        logWarn("health: %s failed %d times in a row, skipping it for %lld ms",
+                peer.str().c_str(), b.fails, (long long)wait.count());
+    } else {
+        logDbg("health: %s still down, next probe in %lld ms", peer.str().c_str(), (long long)wait.count());
+    }
+    b.state = OPEN;
+    b.retryAt = Clock::now() + wait;
+    ++b.trips;
+}
+
+bool PeerHealth::usable(const Endpoint& peer) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<Endpoint, Breaker>::const_iterator it = peers_.find(peer);
+    return it == peers_.end() || usableLocked(it->second, Clock::now());
+}
+
+PeerHealth::State PeerHealth::state(const Endpoint& peer) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::map<Endpoint, Breaker>::const_iterator it = peers_.find(peer);
+    return it == peers_.end() ? CLOSED : it->second.state;
+}
@@ -0,0 +1,63 @@
+#include "../inc/peerTable.h"
+#include <algorithm>
+
+PeerTable::PeerTable(size_t capacity)
+    : capacity_(capacity), version_(0), rng_(std::random_device()()) {}
+
+void PeerTable::setSelf(const Endpoint& self) {
+    std::lock_guard<std::mutex> lock(mu_);
+    self_ = self;
+    peers_.erase(std::remove_if(peers_.begin(), peers_.end(),
+                                [&self](const Endpoint& e) { return self.covers(e); }), peers_.end());
+}
+
+bool PeerTable::add(const Endpoint& peer) {
+    if (!peer.valid() || peer.anyAddress()) return false;
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (self_.covers(peer)) return false;
+    if (std::find(peers_.begin(), peers_.end(), peer) != peers_.end()) return false;
+
+    if (peers_.size() < capacity_) {
+        peers_.push_back(peer);
+        ++version_;
+        return true;
+    }
+
+    if (std::uniform_int_distribution<int>(0, 1)(rng_) == 0) return false;
+    peers_[std::uniform_int_distribution<size_t>(0, peers_.size() - 1)(rng_)] = peer;
+    ++version_;
+    return true;
+}
+
+void PeerTable::remove(const Endpoint& peer) {
+    std::lock_guard<std::mutex> lock(mu_);
+    peers_.erase(std::remove(peers_.begin(), peers_.end(), peer), peers_.end());
+}
+
+std::vector<Endpoint> PeerTable::sample(size_t n, const Endpoint& exclude) const {
+    std::lock_guard<std::mutex> lock(mu_);
+    std::vector<Endpoint> out;
+    out.reserve(peers_.size());
+    for (size_t i = 0; i < peers_.size(); ++i) {
+        if (peers_[i] != exclude) out.push_back(peers_[i]);
+    }
+    std::shuffle(out.begin(), out.end(), rng_);
+    if (out.size() > n) out.resize(n);
+    return out;
+}
+
+std::vector<Endpoint> PeerTable::all() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return peers_;
+}
+
+unsigned long PeerTable::version() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return version_;
+}
+
+size_t PeerTable::size() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return peers_.size();
+}
@@ -1,9 +1,12 @@
 #include "../inc/portAllocator.h"
+#include "../inc/endpoint.h"
 #include "../inc/logger2.h"
 #include <sys/socket.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <cstring>
+#include <cerrno>
+#include <netinet/in.h>
 
 PortAllocator::PortAllocator() : port_(-1), listenFd_(-1) {}
 PortAllocator::~PortAllocator() { release(); }
@@ -14,27 +17,77 @@ int PortAllocator::takeFd() {
     return fd;
 }
 
-bool PortAllocator::claim(int startPort, int endPort) {
-    for (int p = startPort; p <= endPort; ++p) {
-        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
-        if (fd < 0) continue;
+// bind a fresh socket to addr; fd or -1
+static int bindTo(const sockaddr* addr, socklen_t len, bool dualStack = false) {
+    int fd = ::socket(addr->sa_family, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    int opt = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (dualStack) {
+        int v6only = 0;
+        ::setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+    if (::bind(fd, addr, len) != 0) {
+        const int err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
 
-        int opt = 1;
-        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+// every address of both families: taken by anyone on this machine = taken.
+// Machines without IPv6 only get the IPv4 check.
+static bool portFree(int port) {
+    sockaddr_in6 any6;
+    std::memset(&any6, 0, sizeof(any6));
+    any6.sin6_family = AF_INET6;
+    any6.sin6_port = htons(port);
+    any6.sin6_addr = in6addr_any;
+    int fd = bindTo((sockaddr*)&any6, sizeof(any6), true);
+    if (fd < 0 && errno == EADDRINUSE) return false;
 
-        sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(p);
+    if (fd < 0) {
+        sockaddr_in any4;
+        std::memset(&any4, 0, sizeof(any4));
+        any4.sin_family = AF_INET;
+        any4.sin_port = htons(port);
+        any4.sin_addr.s_addr = htonl(INADDR_ANY);
+        fd = bindTo((sockaddr*)&any4, sizeof(any4));
+        if (fd < 0) return false;
+    }
+    ::close(fd);
+    return true;
+}
 
-        if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+bool PortAllocator::claim(int startPort, int endPort, const std::string& host) {
+    for (int p = startPort; p <= endPort; ++p) {
+        sockaddr_storage addr;
+        socklen_t len = 0;
+        if (host.empty()) {
+            // listen on every IPv4 address, as always
+            sockaddr_in* a4 = (sockaddr_in*)&addr;
+            std::memset(&addr, 0, sizeof(addr));
+            a4->sin_family = AF_INET;
+            a4->sin_port = htons(p);
+            a4->sin_addr.s_addr = htonl(INADDR_ANY);
+            len = sizeof(sockaddr_in);
+        } else if (!Endpoint(host, p).toSockaddr(addr, len)) {
+            logErr("claim: invalid address '%s'", host.c_str());
+            return false;
+        }
+
+        if (!portFree(p)) continue;
+        int fd = bindTo((sockaddr*)&addr, len);
+
+        if (fd >= 0) {
             port_ = p;
             listenFd_ = fd;
             Logger::setPort(port_);
-            logInfo("claimed port %d (fd=%d)", port_, listenFd_);
+            logInfo("claimed port %d on %s (fd=%d)", port_, host.empty() ? "all addresses" : host.c_str(), listenFd_);
             return true;
         }
-        ::close(fd);
     }
 
     logWarn("no available port");
@@ -0,0 +1,54 @@
+#include "../inc/rateLimiter.h"
+
+static const double BURST_SEC = 0.25;    // bucket holds this much time worth of tokens
+
+RateLimiter::RateLimiter(long long bytesPerSec)
+    : rate_(bytesPerSec < 0 ? 0 : bytesPerSec), tokens_(0.0),
+      last_(std::chrono::steady_clock::now()) {}
+
+RateLimiter& RateLimiter::global() {
+    static RateLimiter limiter;
+    return limiter;
+}
+
+void RateLimiter::refillLocked(std::chrono::steady_clock::time_point now) {
+    const double dt = std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+    if (rate_ <= 0) return;
+
+    const double burst = (double)rate_ * BURST_SEC;
+    tokens_ += dt * (double)rate_;
+    if (tokens_ > burst) tokens_ = burst;
+}
+
+void RateLimiter::setRate(long long bytesPerSec) {
+    std::lock_guard<std::mutex> lock(mu_);
+    refillLocked(std::chrono::steady_clock::now());
+    rate_ = bytesPerSec < 0 ? 0 : bytesPerSec;
+    // old debt was priced at the old rate, don't carry it over
+    if (tokens_ < 0 || rate_ == 0) tokens_ = 0;
+}
+
+long long RateLimiter::rate() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return rate_;
+}
+
+std::chrono::microseconds RateLimiter::reserve(long long bytes) {
+    std::lock_guard<std::mutex> lock(mu_);
+    refillLocked(std::chrono::steady_clock::now());
+    if (rate_ <= 0) return std::chrono::microseconds(0);
+
+    tokens_ -= (double)bytes;
+    if (tokens_ >= 0) return std::chrono::microseconds(0);
+    return std::chrono::microseconds((long long)(-tokens_ * 1e6 / (double)rate_));
+}
+
+void RateLimiter::refund(long long bytes) {
+    if (bytes <= 0) return;
+    std::lock_guard<std::mutex> lock(mu_);
+    if (rate_ <= 0) return;
+    tokens_ += (double)bytes;
+    const double burst = (double)rate_ * BURST_SEC;
+    if (tokens_ > burst) tokens_ = burst;
+}
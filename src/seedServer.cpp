@@ -1,18 +1,35 @@
 #include "../inc/seedServer.h"
 #include "../inc/netIO.h"
+#include "../inc/udpTransfer.h"
 #include "../inc/serversocket.h"
+#include "../inc/peerTable.h"
+#include "../inc/chunkStore.h"
+#include "../inc/partialFiles.h"
+#include "../inc/deltaSync.h"
+#include "../inc/sha256.h"
+#include "../inc/bufferPool.h"
 #include "../inc/logger2.h"
 
 #include <cstdio>
 #include <cstring>
+#include <cerrno>
 #include <string>
+#include <vector>
+#include <set>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 SeedServer::SeedServer(int chunkSize)
-: running_(false), chunkSize_(chunkSize), listenFd_(-1) {}
+: running_(false), chunkSize_(chunkSize), listenFd_(-1), peers_(nullptr), store_(nullptr),
+  partials_(nullptr) {}
 
 SeedServer::~SeedServer() { stop(); }
 
@@ -52,6 +69,7 @@ bool SeedServer::handleList(int clientFd, int port) {
     char dirPath[256];
     snprintf(dirPath, sizeof(dirPath), "bin/ports/%d", port);
 
+    std::set<std::string> listed;
     DIR* dir = opendir(dirPath);
     if (dir) {
         struct dirent* entry;
@@ -78,15 +96,315 @@ bool SeedServer::handleList(int clientFd, int port) {
             closedir(dir);
             return false;
         }
+        listed.insert(name);
     }
         closedir(dir);
     }
 
+    // downloads in progress are offered too; HAVE tells which chunks
+    if (partials_) {
+        const std::vector<std::string> names = partials_->names();
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (listed.count(names[i])) continue;
+            const std::string row = "FILE " + names[i] + "\n";
+            if (!NetIo::sendAll(clientFd, row.data(), row.size())) return false;
+        }
+    }
+
     const char* end = "<END>\n";
     return NetIo::sendAll(clientFd, end, strlen(end));
 }
 
-bool SeedServer::handleMeta(int clientFd, int port, const char* filename) {
+// address the caller connected from (a bare "PEERS <port>" means that one)
+static std::string remoteHost(int fd) {
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    char out[INET6_ADDRSTRLEN] = "";
+    if (::getpeername(fd, (sockaddr*)&addr, &len) != 0) return "127.0.0.1";
+    if (addr.ss_family == AF_INET6) {
+        const sockaddr_in6* v6 = (const sockaddr_in6*)&addr;
+        // IPv4 caller on a dual-stack socket
+        if (IN6_IS_ADDR_V4MAPPED(&v6->sin6_addr)) ::inet_ntop(AF_INET, &v6->sin6_addr.s6_addr[12], out, sizeof(out));
+        else ::inet_ntop(AF_INET6, &v6->sin6_addr, out, sizeof(out));
+    } else {
+        ::inet_ntop(AF_INET, &((const sockaddr_in*)&addr)->sin_addr, out, sizeof(out));
+    }
+    return out;
+}
+
+// same address, however it was written ("::1" and "0::1")
+static bool sameHost(const std::string& a, const std::string& b) {
+    sockaddr_storage sa, sb;
+    socklen_t la = 0, lb = 0;
+    if (!Endpoint(a, 0).toSockaddr(sa, la) || !Endpoint(b, 0).toSockaddr(sb, lb)) return false;
+    return la == lb && std::memcmp(&sa, &sb, la) == 0;
+}
+
+// "PEERS [<port>|<host:port>]": reply with a random sample of the peer table.
+// A port in the request is the caller's own listen port, so it gets learned in
+// passing (push-pull gossip). A host has to be the one the caller connects
+// from: nobody gets to put somebody else in our table.
+bool SeedServer::handlePeers(int clientFd, const char* line) {
+    static const size_t PEERS_REPLY_MAX = 16;
+
+    Endpoint caller;
+    if (line[5] == ' ') {
+        const std::string from = remoteHost(clientFd);
+        if (!Endpoint::parse(line + 6, caller, from) || !sameHost(caller.host, from)) {
+            const char* bad = "<BAD_REQUEST>\n";
+            NetIo::sendAll(clientFd, bad, strlen(bad));
+            return false;
+        }
+        if (peers_) peers_->add(caller);
+    }
+
+    std::string reply = "<PEERS>\n";
+    if (peers_) {
+        const std::vector<Endpoint> some = peers_->sample(PEERS_REPLY_MAX, caller);
+        for (size_t i = 0; i < some.size(); ++i) reply += "PEER " + some[i].str() + "\n";
+    }
+    reply += "<END>\n";
+    return NetIo::sendAll(clientFd, reply.data(), reply.size());
+}
+
+// "HASHES <file>": content-defined chunk list of a file so downloaders can
+// reuse what they already have.  <HASHES> n, then "offset length sha256" x n, <END>
+bool SeedServer::handleHashes(int clientFd, const char* filename) {
+    if (!store_ || std::strstr(filename, ".part") != nullptr || std::strchr(filename, '/') != nullptr) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, std::strlen(bad));
+        return false;
+    }
+
+    std::vector<CdcChunk> chunks;
+    if ((partials_ && partials_->find(filename)) || !store_->manifest(filename, chunks)) {
+        const char* nf = "<FILE_NOT_FOUND>\n";
+        NetIo::sendAll(clientFd, nf, strlen(nf));
+        return false;
+    }
+
+    char row[128];
+    snprintf(row, sizeof(row), "<HASHES> %zu\n", chunks.size());
+    std::string reply = row;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        snprintf(row, sizeof(row), "%lld %lld %s\n",
+                 chunks[i].offset, chunks[i].length, chunks[i].hash.c_str());
+        reply += row;
+    }
+    reply += "<END>\n";
+    return NetIo::sendAll(clientFd, reply.data(), reply.size());
+}
+
+// "DELTA <file> <blockSize> <count>" followed by count "<weak-hex> <strong>" lines
+// (signatures of the caller's old copy). Reply:
+//   <DELTA> <size> <sha256 of the whole file>
+//   COPY <block> <count> | DATA <len>\n<bytes>   ...
+//   <END>
+bool SeedServer::handleDelta(NetIo::Reader& in, int clientFd, int port, const char* line) {
+    static const long long MAX_BLOCKS = 4 * 1024 * 1024;
+
+    const char* payload = line + 6;
+    const char* sp2 = strrchr(payload, ' ');
+    const char* sp1 = nullptr;
+    for (const char* q = sp2 ? sp2 - 1 : nullptr; q && q > payload; --q) {
+        if (*q == ' ') { sp1 = q; break; }
+    }
+
+    long long blockSize = -1, count = -1;
+    if (sp1 && sp2) {
+        char* endp = nullptr;
+        blockSize = strtoll(sp1 + 1, &endp, 10);
+        if (endp != sp2) blockSize = -1;
+        count = strtoll(sp2 + 1, &endp, 10);
+        if (*endp != '\0') count = -1;
+    }
+    if (blockSize < 64 || blockSize > 1024 * 1024 || count < 0 || count > MAX_BLOCKS) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, strlen(bad));
+        return false;
+    }
+
+    // signatures come first, whatever we answer
+    std::vector<DeltaSync::BlockSig> sigs;
+    sigs.reserve((size_t)count);
+    bool sigsOk = true;
+    char row[128];
+    for (long long i = 0; i < count; ++i) {
+        bool longRow = false;
+        if (in.readUntil('\n', row, sizeof(row), true, &longRow) <= 0) return false;
+        unsigned int weak = 0;
+        char strong[64];
+        if (longRow || sscanf(row, "%x %63s", &weak, strong) != 2) sigsOk = false;
+        DeltaSync::BlockSig sig;
+        sig.weak = weak;
+        sig.strong = strong;
+        sigs.push_back(sig);
+    }
+
+    const std::string filename(payload, (size_t)(sp1 - payload));
+    if (!sigsOk || filename.empty() || filename.find(".part") != std::string::npos ||
+        filename.find('/') != std::string::npos) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, strlen(bad));
+        return false;
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "bin/ports/%d/%s", port, filename.c_str());
+
+    // still downloading here: no whole file to diff against
+    int fd = (partials_ && partials_->find(filename)) ? -1 : ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) ::close(fd);
+        const char* nf = "<FILE_NOT_FOUND>\n";
+        NetIo::sendAll(clientFd, nf, strlen(nf));
+        return false;
+    }
+
+    const size_t len = (size_t)st.st_size;
+    const char* data = nullptr;
+    void* map = MAP_FAILED;
+    if (len > 0) {
+        map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ::close(fd);
+            const char* nf = "<FILE_NOT_FOUND>\n";
+            NetIo::sendAll(clientFd, nf, strlen(nf));
+            return false;
+        }
+        data = (const char*)map;
+    }
+    ::close(fd);
+
+    snprintf(row, sizeof(row), "<DELTA> %lld %s\n", (long long)len, Sha256::hex(data, len).c_str());
+    bool ok = NetIo::sendAll(clientFd, row, strlen(row));
+
+    long long literal = 0;
+    if (ok) {
+        ok = DeltaSync::generate(data, len, (int)blockSize, sigs, [&](const DeltaSync::Op& op) {
+            char head[64];
+            if (op.copy) {
+                snprintf(head, sizeof(head), "COPY %lld %lld\n", op.block, op.count);
+                return NetIo::sendAll(clientFd, head, strlen(head));
+            }
+            literal += (long long)op.len;
+            snprintf(head, sizeof(head), "DATA %zu\n", op.len);
+            return NetIo::sendAll(clientFd, head, strlen(head)) &&
+                   NetIo::sendAll(clientFd, op.data, op.len);
+        });
+    }
+    if (map != MAP_FAILED) munmap(map, len);
+
+    if (ok) {
+        const char* end = "<END>\n";
+        ok = NetIo::sendAll(clientFd, end, strlen(end));
+    }
+    sInfo("delta '%s': %lld of %zu bytes sent as literals (%lld blocks offered)",
+          filename.c_str(), literal, len, count);
+    return ok;
+}
+
+// "HAVE <file>": which chunks we can serve.
+//   <HAVE> <chunks> ALL                  whole file here
+//   <HAVE> <chunks> RUNS <k>\n           still downloading: k lines "<first> <end>"
+//   <HAVE> <chunks> <n>\n<n bitmap bytes>  same, when the runs would take more,
+//                                        bit 7 of byte 0 = chunk 0
+bool SeedServer::handleHave(int clientFd, int port, const char* filename) {
+    if (std::strstr(filename, ".part") != nullptr || std::strchr(filename, '/') != nullptr) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, std::strlen(bad));
+        return false;
+    }
+
+    char head[128];
+    const std::shared_ptr<PartialFile> partial = partials_ ? partials_->find(filename) : nullptr;
+    if (partial) {
+        // a few runs while chunks land in order, the bitmap once they are scattered
+        const std::vector<std::pair<long long, long long> > runs = partial->runs();
+        const size_t bitmapBytes = (size_t)((partial->chunks() + 7) / 8);
+        std::string body;
+        for (size_t i = 0; i < runs.size() && body.size() < bitmapBytes; ++i) {
+            snprintf(head, sizeof(head), "%lld %lld\n", runs[i].first, runs[i].second);
+            body += head;
+        }
+        if (body.size() < bitmapBytes) {
+            snprintf(head, sizeof(head), "<HAVE> %lld RUNS %zu\n", partial->chunks(), runs.size());
+        } else {
+            body = partial->bitmap();
+            snprintf(head, sizeof(head), "<HAVE> %lld %zu\n", partial->chunks(), body.size());
+        }
+        const std::string reply = head + body;    // one write, or Nagle holds the rest back
+        return NetIo::sendAll(clientFd, reply.data(), reply.size());
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "bin/ports/%d/%s", port, filename);
+    const long long sz = getFileSizeBytes(path);
+    if (sz < 0) {
+        const char* nf = "<FILE_NOT_FOUND>\n";
+        NetIo::sendAll(clientFd, nf, strlen(nf));
+        return false;
+    }
+
+    snprintf(head, sizeof(head), "<HAVE> %lld ALL\n", (sz + chunkSize_ - 1) / chunkSize_);
+    return NetIo::sendAll(clientFd, head, strlen(head));
+}
+
+static const int PARTIAL_HOLD_MS = 2000;   // GET of a chunk still on its way to us
+static const int BUFFER_WAIT_MS = 100;     // GET waits this long for a buffer at the pool's cap
+
+// out of buffers (BufferPool cap): the client backs off and asks again on the same connection
+static bool sendBusy(int clientFd) {
+    const char* busy = "<BUSY>\n";
+    NetIo::sendAll(clientFd, busy, strlen(busy));
+    return false;
+}
+
+// GET of a file we are still downloading: only chunks already on disk
+static bool sendPartialChunk(int clientFd, const PartialFile& partial, long long chunkIndex, int chunkSize) {
+    if (chunkIndex >= partial.chunks()) {
+        const char* re = "<RANGE_ERROR>\n";
+        NetIo::sendAll(clientFd, re, strlen(re));
+        return false;
+    }
+
+    // header and payload in one write: a relay hop shouldn't wait on Nagle
+    char header[128];
+    BufferPool::Buffer reply = BufferPool::instance().get((size_t)chunkSize + sizeof(header),
+                                                          BufferPool::SERVER, BUFFER_WAIT_MS);
+    if (!reply) return sendBusy(clientFd);
+    const long long rd = partial.read(chunkIndex, reply.data() + sizeof(header));
+    if (rd < 0) {
+        const char* nh = "<NOT_HAVE>\n";
+        NetIo::sendAll(clientFd, nh, strlen(nh));
+        return false;
+    }
+
+    const int hn = snprintf(header, sizeof(header), "<CHUNK> %lld %lld\n", chunkIndex, rd);
+    std::memcpy(reply.data() + sizeof(header) - (size_t)hn, header, (size_t)hn);
+    return NetIo::sendAll(clientFd, reply.data() + sizeof(header) - hn, (size_t)hn + (size_t)rd);
+}
+
+static const long long INLINE_MAX = 64 * 1024;   // META+ / BUNDLE: files up to this come whole
+static const int BUNDLE_MAX_FILES = 4096;
+static const size_t BUNDLE_FLUSH = 256 * 1024;   // reply bytes we gather before a write
+
+// a whole (small) file into out; false if it isn't size bytes any more
+static bool readWhole(const char* path, long long size, std::string& out) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) return false;
+    out.assign((size_t)size, '\0');
+    const size_t rd = size > 0 ? fread(&out[0], 1, (size_t)size, fp) : 0;
+    const bool atEnd = fgetc(fp) == EOF;
+    fclose(fp);
+    return rd == (size_t)size && atEnd;
+}
+
+// "META <file>":  <META> <size>
+// "META+ <file>": the same, or for a file up to INLINE_MAX the file itself:
+//   <INLINE> <size>\n<size bytes>
+bool SeedServer::handleMeta(int clientFd, int port, const char* filename, bool inlineOk) {
 
     size_t len = std::strlen(filename);
     if (std::strstr(filename, ".part") != nullptr) {
@@ -99,18 +417,81 @@ bool SeedServer::handleMeta(int clientFd, int port, const char* filename) {
     char path[256];
     snprintf(path, sizeof(path), "bin/ports/%d/%s", port, filename);
 
-    long long sz = getFileSizeBytes(path);
+    const std::shared_ptr<PartialFile> partial = partials_ ? partials_->find(filename) : nullptr;
+    long long sz = partial ? partial->size() : getFileSizeBytes(path);
     if (sz < 0) {
         const char* nf = "<FILE_NOT_FOUND>\n";
         NetIo::sendAll(clientFd, nf, strlen(nf));
         return false;
     }
 
+    std::string data;
+    if (inlineOk && !partial && sz <= INLINE_MAX && readWhole(path, sz, data)) {
+        char head[64];
+        snprintf(head, sizeof(head), "<INLINE> %lld\n", sz);
+        const std::string reply = head + data;     // one write
+        return NetIo::sendAll(clientFd, reply.data(), reply.size());
+    }
+
     char reply[128];
     snprintf(reply, sizeof(reply), "<META> %lld\n", sz);
     return NetIo::sendAll(clientFd, reply, strlen(reply));
 }
 
+// "BUNDLE <n>" and then n file names, one a line: each small file whole, in
+// order, so a share of tiny files takes one round trip instead of a download
+// each. Per name:
+//   <FILE> <size>\n<size bytes>
+//   <SKIP> <size>          bigger than INLINE_MAX or still downloading: GET it
+//   <FILE_NOT_FOUND>
+//   <BAD_REQUEST>          a name longer than any we serve
+bool SeedServer::handleBundle(NetIo::Reader& in, int clientFd, int port, const char* args) {
+    char* endp = nullptr;
+    const long n = strtol(args, &endp, 10);
+    if (*endp != '\0' || n <= 0 || n > BUNDLE_MAX_FILES) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, strlen(bad));
+        return false;
+    }
+
+    std::string out;
+    std::string data;
+    char name[256];
+    for (long i = 0; i < n; ++i) {
+        // a name too long to be ours: skip the rest of it, keep in step
+        bool longName = false;
+        if (in.readUntil('\n', name, sizeof(name), true, &longName) <= 0) return false;
+        if (longName) {
+            out += "<BAD_REQUEST>\n";
+            continue;
+        }
+        name[strcspn(name, "\r\n")] = '\0';
+
+        char path[512];
+        snprintf(path, sizeof(path), "bin/ports/%d/%s", port, name);
+        const bool bad = name[0] == '\0' || strstr(name, ".part") != nullptr || strchr(name, '/') != nullptr;
+        const long long sz = bad ? -1 : getFileSizeBytes(path);
+
+        char head[64];
+        if (sz < 0) {
+            out += "<FILE_NOT_FOUND>\n";
+        } else if (sz > INLINE_MAX || (partials_ && partials_->find(name)) || !readWhole(path, sz, data)) {
+            snprintf(head, sizeof(head), "<SKIP> %lld\n", sz);
+            out += head;
+        } else {
+            snprintf(head, sizeof(head), "<FILE> %lld\n", sz);
+            out += head;
+            out += data;
+        }
+
+        if (out.size() >= BUNDLE_FLUSH) {
+            if (!NetIo::sendAll(clientFd, out.data(), out.size())) return false;
+            out.clear();
+        }
+    }
+    return NetIo::sendAll(clientFd, out.data(), out.size());
+}
+
 
 
 // bool SeedServer::handleGet(int clientFd, int port, const char* line) {
@@ -147,7 +528,7 @@ bool SeedServer::handleMeta(int clientFd, int port, const char* filename) {
 //         return false;
 //     }
 
-//     fseek(fp, offset, SEEK_SET);
+//     fseeko(fp, (off_t)(chunkIndex * chunkSize_), SEEK_SET);
 
 //     std::string buf(chunkSize_, '\0');
 //     size_t rd = fread(&buf[0], 1, (size_t)chunkSize_, fp);
@@ -176,13 +557,13 @@ bool SeedServer::handleGet(int clientFd, int port, const char* line) {
     }
 
     char* endp = nullptr;
-    long idx = strtol(lastSpace + 1, &endp, 10);
-    if (!endp || *endp != '\0' || idx < 0) {
+    errno = 0;
+    const long long chunkIndex = strtoll(lastSpace + 1, &endp, 10);
+    if (!endp || *endp != '\0' || chunkIndex < 0 || errno == ERANGE) {
         const char* bad = "<BAD_REQUEST>\n";
         NetIo::sendAll(clientFd, bad, strlen(bad));
         return false;
     }
-    int chunkIndex = (int)idx;
 
     std::string filename(payload, (size_t)(lastSpace - payload));
     if (filename.empty()) {
@@ -200,6 +581,14 @@ bool SeedServer::handleGet(int clientFd, int port, const char* line) {
     char path[256];
     snprintf(path, sizeof(path), "bin/ports/%d/%s", port, filename.c_str());
 
+    const std::shared_ptr<PartialFile> partial = partials_ ? partials_->find(filename) : nullptr;
+    if (partial) {
+        // a relay chain asks for the chunk right behind what we have: hold the
+        // request until our own download lands it instead of <NOT_HAVE>
+        if (!partial->has(chunkIndex)) partial->waitFor(chunkIndex, PARTIAL_HOLD_MS);
+        return sendPartialChunk(clientFd, *partial, chunkIndex, chunkSize_);
+    }
+
     long long sz = getFileSizeBytes(path);
     if (sz < 0) {
         const char* nf = "<FILE_NOT_FOUND>\n";
@@ -207,8 +596,8 @@ bool SeedServer::handleGet(int clientFd, int port, const char* line) {
         return false;
     }
 
-    long long offset = (long long)chunkIndex * (long long)chunkSize_;
-    if (offset >= sz) {
+    // compare in chunks: a huge index times the chunk size would overflow
+    if (chunkIndex >= (sz + chunkSize_ - 1) / chunkSize_) {
         const char* re = "<RANGE_ERROR>\n";
         NetIo::sendAll(clientFd, re, strlen(re));
         return false;
@@ -221,18 +610,174 @@ bool SeedServer::handleGet(int clientFd, int port, const char* line) {
         return false;
     }
 
-    fseek(fp, offset, SEEK_SET);
+    BufferPool::Buffer buf = BufferPool::instance().get((size_t)chunkSize_, BufferPool::SERVER, BUFFER_WAIT_MS);
+    if (!buf) {
+        fclose(fp);
+        return sendBusy(clientFd);
+    }
 
-    std::string buf(chunkSize_, '\0');
-    size_t rd = fread(&buf[0], 1, (size_t)chunkSize_, fp);
+    fseeko(fp, (off_t)(chunkIndex * chunkSize_), SEEK_SET);
+    size_t rd = fread(buf.data(), 1, (size_t)chunkSize_, fp);
     fclose(fp);
 
     char header[128];
-    snprintf(header, sizeof(header), "<CHUNK> %d %zu\n", chunkIndex, rd);
+    snprintf(header, sizeof(header), "<CHUNK> %lld %zu\n", chunkIndex, rd);
     if (!NetIo::sendAll(clientFd, header, strlen(header))) return false;
     return NetIo::sendAll(clientFd, buf.data(), rd);
 }
 
+// UDPGET <first> <count> <udpPort> <file>: the range as datagrams, see
+// udpTransfer.h. Whole files only; partial ones and anything odd get a
+// refusal the client answers by going back to GET.
+bool SeedServer::handleUdpGet(int clientFd, int port, const char* args, Udp::Sender& udp) {
+    static const long long MAX_UDP_RANGE = 64LL * 1024 * 1024;
+
+    long long first = -1;
+    int count = -1, udpPort = -1, off = 0;
+    if (sscanf(args, "%lld %d %d %n", &first, &count, &udpPort, &off) < 3 || off == 0 ||
+        first < 0 || count <= 0 || udpPort <= 0 || udpPort > 65535 ||
+        (long long)count * chunkSize_ > MAX_UDP_RANGE) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, strlen(bad));
+        return false;
+    }
+    const std::string filename(args + off);
+    if (filename.empty() || filename.find(".part") != std::string::npos ||
+        (partials_ && partials_->find(filename))) {
+        const char* no = "<NO_UDP>\n";
+        NetIo::sendAll(clientFd, no, strlen(no));
+        return false;
+    }
+
+    char path[256];
+    snprintf(path, sizeof(path), "bin/ports/%d/%s", port, filename.c_str());
+    const int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        const char* nf = "<FILE_NOT_FOUND>\n";
+        NetIo::sendAll(clientFd, nf, strlen(nf));
+        return false;
+    }
+
+    if (first >= ((long long)st.st_size + chunkSize_ - 1) / chunkSize_) {
+        ::close(fd);
+        const char* re = "<RANGE_ERROR>\n";
+        NetIo::sendAll(clientFd, re, strlen(re));
+        return false;
+    }
+    if (!udp.open(clientFd, udpPort)) {
+        ::close(fd);
+        const char* no = "<NO_UDP>\n";
+        NetIo::sendAll(clientFd, no, strlen(no));
+        return false;
+    }
+
+    static thread_local std::mt19937 rng(std::random_device{}());
+    const uint32_t token = (uint32_t)rng();
+    const long long offset = first * chunkSize_;
+    const long long bytes = std::min((long long)count * chunkSize_, (long long)st.st_size - offset);
+    const long long packets = (bytes + (long long)Udp::PAYLOAD - 1) / (long long)Udp::PAYLOAD;
+
+    char reply[128];
+    snprintf(reply, sizeof(reply), "<UDP> %d %u %lld %lld\n", udp.port(), token, packets, bytes);
+    if (!NetIo::sendAll(clientFd, reply, strlen(reply))) {
+        ::close(fd);
+        return false;
+    }
+
+    const long long sentBefore = udp.sent(), resentBefore = udp.resent();
+    const bool ok = udp.send(clientFd, fd, offset, bytes, token);
+    ::close(fd);
+
+    if (!ok) {
+        const char* failed = "<UDP_FAILED>\n";
+        NetIo::sendAll(clientFd, failed, strlen(failed));
+        return false;
+    }
+    snprintf(reply, sizeof(reply), "<UDP_DONE> %lld %lld\n", udp.sent() - sentBefore, udp.resent() - resentBefore);
+    return NetIo::sendAll(clientFd, reply, strlen(reply));
+}
+
+// "CHAIN <file> <port|host:port> [<lost>]": join the relay chain of a file we
+// have whole, so its downloaders pull from each other instead of all from us.
+//   <CHAIN> HEAD          you are first, pull from us
+//   <CHAIN> <host:port>   pull from the member that joined before you
+// lost = a member the caller couldn't reach any more; it drops out and the
+// chain closes up around it. Members keep their place when they ask again.
+// "CHAIN <file> <me> LEAVE" when a member is done (<CHAIN> LEFT); a chain
+// nobody is left in is forgotten.
+bool SeedServer::handleChain(int clientFd, int port, const char* args) {
+    static const size_t CHAIN_MAX = 256;
+
+    char name[200], who[80], lost[80];
+    const int got = sscanf(args, "%199s %79s %79s", name, who, lost);
+    const bool leave = got == 3 && std::strcmp(lost, "LEAVE") == 0;
+    Endpoint member, gone;
+    if (got < 2 || std::strstr(name, ".part") != nullptr || std::strchr(name, '/') != nullptr ||
+        !Endpoint::parse(who, member, remoteHost(clientFd)) ||
+        (got == 3 && !leave && !Endpoint::parse(lost, gone, remoteHost(clientFd)))) {
+        const char* bad = "<BAD_REQUEST>\n";
+        NetIo::sendAll(clientFd, bad, strlen(bad));
+        return false;
+    }
+
+    if (leave) {
+        {
+            std::lock_guard<std::mutex> lock(chainsMu_);
+            std::map<std::string, std::vector<Endpoint> >::iterator c = chains_.find(name);
+            if (c != chains_.end()) {
+                c->second.erase(std::remove(c->second.begin(), c->second.end(), member), c->second.end());
+                if (c->second.empty()) chains_.erase(c);
+            }
+        }
+        sInfo("chain '%s': %s left", name, member.str().c_str());
+        const char* left = "<CHAIN> LEFT\n";
+        return NetIo::sendAll(clientFd, left, strlen(left));
+    }
+
+    // only a whole copy can head a chain
+    if (partials_ && partials_->find(name)) {
+        const char* nh = "<NOT_HAVE>\n";
+        NetIo::sendAll(clientFd, nh, strlen(nh));
+        return false;
+    }
+    char path[256];
+    snprintf(path, sizeof(path), "bin/ports/%d/%s", port, name);
+    if (getFileSizeBytes(path) < 0) {
+        {
+            std::lock_guard<std::mutex> lock(chainsMu_);
+            chains_.erase(name);
+        }
+        const char* nf = "<FILE_NOT_FOUND>\n";
+        NetIo::sendAll(clientFd, nf, strlen(nf));
+        return false;
+    }
+
+    Endpoint upstream;
+    size_t place = 0;
+    {
+        std::lock_guard<std::mutex> lock(chainsMu_);
+        std::vector<Endpoint>& chain = chains_[name];
+        if (gone.valid() && gone != member) chain.erase(std::remove(chain.begin(), chain.end(), gone), chain.end());
+
+        std::vector<Endpoint>::iterator it = std::find(chain.begin(), chain.end(), member);
+        if (it == chain.end()) {
+            if (chain.size() >= CHAIN_MAX) chain.erase(chain.begin());
+            it = chain.insert(chain.end(), member);
+        }
+        place = (size_t)(it - chain.begin());
+        if (place > 0) upstream = chain[place - 1];
+    }
+
+    sInfo("chain '%s': %s is #%zu, pulls from %s%s%s", name, member.str().c_str(), place + 1,
+          upstream.valid() ? upstream.str().c_str() : "us",
+          gone.valid() ? ", lost " : "", gone.valid() ? gone.str().c_str() : "");
+
+    const std::string reply = "<CHAIN> " + (upstream.valid() ? upstream.str() : std::string("HEAD")) + "\n";
+    return NetIo::sendAll(clientFd, reply.data(), reply.size());
+}
+
 // void SeedServer::handleClient(int clientFd, int port) {
 //     char line[256];
 //     int n = NetIo::recvLine(clientFd, line, sizeof(line));
@@ -268,11 +813,21 @@ bool SeedServer::handleGet(int clientFd, int port, const char* line) {
 void SeedServer::handleClient(int clientFd, int port)
 {
     char line[256];
+    NetIo::Reader in(clientFd);    // pipelined requests come out of one recv
+    Udp::Sender udp;               // UDPGET: socket + congestion state, opened on first use
 
     while (true)
     {
-        int n = NetIo::recvLine(clientFd, line, sizeof(line));
+        // an over-long line is dropped whole, or its tail would be read as
+        // the next request
+        bool tooLong = false;
+        int n = in.readUntil('\n', line, sizeof(line), true, &tooLong);
         if (n <= 0) break;
+        if (tooLong) {
+            const char* bad = "<BAD_REQUEST>\n";
+            NetIo::sendAll(clientFd, bad, std::strlen(bad));
+            continue;
+        }
 
         // strip \r\n
         size_t L = std::strlen(line);
@@ -286,9 +841,24 @@ void SeedServer::handleClient(int clientFd, int port)
             handleList(clientFd, port);
             continue;
         }
+        if (std::strcmp(line, "PEERS") == 0 || std::strncmp(line, "PEERS ", 6) == 0)
+        {
+            handlePeers(clientFd, line);
+            continue;
+        }
         if (std::strncmp(line, "META ", 5) == 0)
         {
-            handleMeta(clientFd, port, line + 5);
+            handleMeta(clientFd, port, line + 5, false);
+            continue;
+        }
+        if (std::strncmp(line, "META+ ", 6) == 0)
+        {
+            handleMeta(clientFd, port, line + 6, true);
+            continue;
+        }
+        if (std::strncmp(line, "BUNDLE ", 7) == 0)
+        {
+            handleBundle(in, clientFd, port, line + 7);
             continue;
         }
         if (std::strncmp(line, "GET ", 4) == 0)
@@ -296,6 +866,31 @@ void SeedServer::handleClient(int clientFd, int port)
             handleGet(clientFd, port, line);
             continue;
         }
+        if (std::strncmp(line, "DELTA ", 6) == 0)
+        {
+            handleDelta(in, clientFd, port, line);
+            continue;
+        }
+        if (std::strncmp(line, "HASHES ", 7) == 0)
+        {
+            handleHashes(clientFd, line + 7);
+            continue;
+        }
+        if (std::strncmp(line, "HAVE ", 5) == 0)
+        {
+            handleHave(clientFd, port, line + 5);
+            continue;
+        }
+        if (std::strncmp(line, "UDPGET ", 7) == 0)
+        {
+            handleUdpGet(clientFd, port, line + 7, udp);
+            continue;
+        }
+        if (std::strncmp(line, "CHAIN ", 6) == 0)
+        {
+            handleChain(clientFd, port, line + 6);
+            continue;
+        }
 
         const char* bad = "<BAD_REQUEST>\n";
         NetIo::sendAll(clientFd, bad, std::strlen(bad));
@@ -318,10 +913,10 @@ void SeedServer::serveLoop(int port, int listenFd) {
 
     logInfo("SeedServer listening on port %d", port);
 
-    sockaddr_in addr{};
-    socklen_t addrlen = sizeof(addr);
+    sockaddr_storage addr{};
 
     while (running_) {
+        socklen_t addrlen = sizeof(addr);
         int clientFd = ss.accept(addr, addrlen);
 
         if (clientFd < 0) {
@@ -1,4 +1,8 @@
 #include "../inc/seedApp.h"
+#include "../inc/connectionPool.h"
+#include "../inc/bufferPool.h"
+#include "../inc/downloadSink.h"
+#include "../inc/logger2.h"
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -7,6 +11,13 @@
 #include <sys/select.h>
 #include <cerrno>
 #include <cstdlib>
+#include <set>
+#include <algorithm>
+#include <fnmatch.h>
+#include <fcntl.h>
+
+// how often the chunk store looks for files that changed in our directory
+static const int STORE_REFRESH_MS = 5000;
 
 
 static std::string dQuote(const std::string& s) {
@@ -70,6 +81,14 @@ static std::string fmtBar(double pct, int width = 30) {
     return bar;
 }
 
+static std::string fmtBytes(long long n) {
+    char out[32];
+    if (n < 1024) snprintf(out, sizeof(out), "%lld B", n);
+    else if (n < 1024 * 1024) snprintf(out, sizeof(out), "%.1f KB", n / 1024.0);
+    else snprintf(out, sizeof(out), "%.1f MB", n / (1024.0 * 1024.0));
+    return out;
+}
+
 static double safePct(long long done, long long total) {
     if (total <= 0) return 0.0;
     return (100.0 * (double)done / (double)total);
@@ -160,11 +179,134 @@ int SeedApp::readInt(bool* eof) const {
     return static_cast<int>(v);
 }
 
+std::string SeedApp::readLine(bool* eof) const {
+    char buf[512];
+    for (;;) {
+        errno = 0;
+        if (fgets(buf, sizeof(buf), stdin)) break;
+        if (errno == EINTR) {
+            clearerr(stdin);
+            continue;
+        }
+        if (eof) *eof = feof(stdin) != 0;
+        return std::string();
+    }
+    if (eof) *eof = false;
+
+    std::string line(buf);
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r' || line.back() == ' '))
+        line.pop_back();
+    size_t lead = line.find_first_not_of(' ');
+    return lead == std::string::npos ? std::string() : line.substr(lead);
+}
+
+// "*" = everything, a pattern with * ? [ = glob on the name, else IDs: "1,3-5"
+static std::vector<size_t> pickFiles(const std::vector<FileEntry>& files, const std::string& spec) {
+    std::vector<size_t> out;
+    if (spec.find_first_of("*?[") != std::string::npos) {
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (fnmatch(spec.c_str(), files[i].filename.c_str(), 0) == 0) out.push_back(i);
+        }
+        return out;
+    }
+
+    std::set<size_t> seen;
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t comma = spec.find(',', pos);
+        if (comma == std::string::npos) comma = spec.size();
+        const std::string part = spec.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        int lo = 0, hi = 0;
+        char extra = 0;
+        if (std::sscanf(part.c_str(), " %d - %d %c", &lo, &hi, &extra) == 2) {
+        } else if (std::sscanf(part.c_str(), " %d %c", &lo, &extra) == 1) {
+            hi = lo;
+        } else {
+            return std::vector<size_t>();
+        }
+        // only what is on the list, however wide the range typed
+        lo = std::max(lo, 1);
+        hi = std::min(hi, (int)files.size());
+        for (int k = lo; k <= hi; ++k) {
+            if (seen.insert((size_t)k - 1).second) out.push_back((size_t)k - 1);
+        }
+    }
+    return out;
+}
+
+void SeedApp::batchFlow() {
+    std::vector<FileEntry> files = availableFiles();
+    if (files.empty()) return;
+
+    printf("Available files (from other ports):\n");
+    for (size_t i = 0; i < files.size(); ++i) {
+        printf("[%zu] %s (%zu seeder%s)\n", i + 1, files[i].filename.c_str(),
+               files[i].seeders.size(), files[i].seeders.size() > 1 ? "s" : "");
+    }
+    printf("\nFiles to get (e.g. 1,3-5  or  *.log  or  * for all, empty = back): ");
+    fflush(stdout);
+
+    bool eof = false;
+    const std::string spec = readLine(&eof);
+    if (eof || spec.empty()) {
+        printf("\nBack to menu.\n\n");
+        return;
+    }
+
+    const std::vector<size_t> picked = pickFiles(files, spec);
+    if (picked.empty()) {
+        printf("\nNothing matched '%s'.\n\n", spec.c_str());
+        return;
+    }
+
+    std::vector<BatchItem> items;
+    for (size_t i = 0; i < picked.size(); ++i) {
+        BatchItem it;
+        it.filename = files[picked[i]].filename;
+        it.seeders = files[picked[i]].seeders;
+        items.push_back(it);
+    }
+
+    std::unique_ptr<DownloadJob> job(new DownloadJob());
+    char title[64];
+    snprintf(title, sizeof(title), "batch of %zu file%s", items.size(), items.size() > 1 ? "s" : "");
+    job->filename = title;
+    job->isBatch = true;
+    job->start = std::chrono::steady_clock::now();
+    job->end = job->start;
+    job->lastTick = job->start;
+    job->progress.reset();
+    job->progress.active.store(true);
+    job->progress.pending.store(true);
+
+    DownloadJob* j = job.get();
+    job->worker = std::thread([this, j, items] {
+        downloader_.downloadBatch(items, myPort_, &j->progress, j->control, &j->batch);
+        j->end = std::chrono::steady_clock::now();
+        j->finished.store(true);
+    });
+    job->worker.detach();
+
+    {
+        std::lock_guard<std::mutex> lock(jobsMu_);
+        jobs_.push_back(std::move(job));
+    }
+
+    printf("\nBatch of %zu file%s started in background (smallest first).\n\n",
+           items.size(), items.size() > 1 ? "s" : "");
+}
+
 void SeedApp::showMenu() const {
-    printf("Seed App - Port %d\n", myPort_);
+    if (self_.anyAddress()) printf("Seed App - Port %d\n", myPort_);
+    else                    printf("Seed App - %s\n", self_.str().c_str());
     printf("[1] Download file.\n");
     printf("[2] Download status.\n");
-    printf("[3] Exit.\n\n");
+    printf("[3] Bandwidth limit.\n");
+    printf("[4] Stream file (readable while downloading).\n");
+    printf("[5] Batch download (list, glob or everything).\n");
+    printf("[6] Exit.\n\n");
     printf("? ");
     fflush(stdout);
 }
@@ -172,23 +314,127 @@ void SeedApp::showMenu() const {
 bool SeedApp::boot() {
     printf("Finding available ports...\n");
 
-    if (!allocator_.claim(startPort_, endPort_)) {
+    // SEED_HOST=addr listens on that address only (e.g. 127.0.0.2 or ::1) and
+    // is what we tell peers; unset listens everywhere
+    std::string host;
+    if (const char* h = std::getenv("SEED_HOST")) {
+        host = h;
+        if (!host.empty() && !Endpoint::validHost(host)) {
+            printf("SEED_HOST '%s' is not a numeric IPv4/IPv6 address.\n", h);
+            return false;
+        }
+    }
+
+    if (!allocator_.claim(startPort_, endPort_, host)) {
         printf("Connection full, no ports available.\n");
         printf("All ports (%d-%d) are occupied.\n", startPort_, endPort_);
         return false;
     }
 
     myPort_ = allocator_.port();
+    self_ = Endpoint(host, myPort_);
     printf("Found port %d.\n", myPort_);
-    printf("Listening at port %d.\n\n", myPort_);
+    printf("Listening at %s.\n\n", self_.str().c_str());
+
+    // SEED_RATE_KBPS=n caps all downloads from the start (menu [3] changes it)
+    if (const char* rate = std::getenv("SEED_RATE_KBPS")) {
+        RateLimiter::global().setRate(std::atoll(rate) * 1024);
+    }
+
+    // SEED_UDP=1 moves bulk chunk ranges to UDP (falls back to GET per seeder)
+    if (const char* udp = std::getenv("SEED_UDP")) {
+        udp_ = std::atoi(udp) != 0;
+    }
+
+    // SEED_BUF_CAP_MB=n caps the pooled I/O buffers (0 = no cap), SEED_HUGEPAGES=1
+    // backs the big ones with huge pages
+    if (const char* cap = std::getenv("SEED_BUF_CAP_MB")) {
+        BufferPool::instance().setCap(std::atoll(cap) * 1024 * 1024);
+    }
+    if (const char* huge = std::getenv("SEED_HUGEPAGES")) {
+        BufferPool::instance().setHugePages(std::atoi(huge) != 0);
+    }
+
+    // SEED_CHAIN=1: downloads of the same file line up behind each other, each
+    // peer relaying to the next, instead of all pulling from the seeders
+    if (const char* chain = std::getenv("SEED_CHAIN")) {
+        chain_ = std::atoi(chain) != 0;
+    }
+
+    // gossip: the server answers PEERS from this table, the scanner contacts it
+    peers_.setSelf(self_);
+    server_.setPeerTable(&peers_);
+    scanner_.setPeerTable(&peers_);
+
+    // dedup: seeders advertise chunk hashes, downloads reuse local chunks
+    char storeDir[64];
+    snprintf(storeDir, sizeof(storeDir), "bin/ports/%d", myPort_);
+    store_.setDirectory(storeDir);
+    store_.startRefresh(STORE_REFRESH_MS);
+    server_.setChunkStore(&store_);
+    downloader_.setChunkStore(&store_);
+    server_.setPartialFiles(&partials_);
+    downloader_.setPartialFiles(&partials_);
+
+    // SEED_BOOTSTRAP=entry[,entry...] names known peers outside the default
+    // window: "port" (on 127.0.0.1), "host:port", "[v6]:port", or a bare
+    // host to sweep the first ports of the range on
+    if (const char* boot = std::getenv("SEED_BOOTSTRAP")) {
+        std::string list(boot);
+        std::vector<std::string> sweep(1, "127.0.0.1");
+        size_t pos = 0;
+        while (pos <= list.size()) {
+            size_t comma = list.find(',', pos);
+            if (comma == std::string::npos) comma = list.size();
+            const std::string entry = list.substr(pos, comma - pos);
+            Endpoint ep;
+            if (Endpoint::validHost(entry)) {
+                if (std::find(sweep.begin(), sweep.end(), entry) == sweep.end()) sweep.push_back(entry);
+            } else if (Endpoint::parse(entry, ep)) {
+                peers_.add(ep);
+            } else if (!entry.empty()) {
+                printf("SEED_BOOTSTRAP: ignoring '%s'\n", entry.c_str());
+            }
+            pos = comma + 1;
+        }
+        scanner_.setSweepHosts(sweep);
+    }
 
     int listenFd = allocator_.takeFd();
     server_.start(myPort_, listenFd);
 
+    scanner_.loadSnapshot(self_);
+    scanner_.startRefresh(self_);
+
     return true;
 }
 
 void SeedApp::shutdown() {
+    // download threads are detached and point into jobs_: stop them first
+    bool waiting = false;
+    {
+        std::lock_guard<std::mutex> lock(jobsMu_);
+        for (size_t i = 0; i < jobs_.size(); ++i) {
+            if (jobs_[i]->finished.load()) continue;
+            jobs_[i]->control.cancel();
+            waiting = true;
+        }
+    }
+    if (waiting) printf("Cancelling running downloads...\n");
+    while (waiting) {
+        waiting = false;
+        {
+            std::lock_guard<std::mutex> lock(jobsMu_);
+            for (size_t i = 0; i < jobs_.size(); ++i) {
+                if (!jobs_[i]->finished.load()) waiting = true;
+            }
+        }
+        if (waiting) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    scanner_.stopRefresh();
+    store_.stopRefresh();
+    ConnectionPool::instance().closeAll();
     server_.stop();
     allocator_.release();
 }
@@ -197,11 +443,13 @@ void SeedApp::shutdown() {
 void SeedApp::statusFlow() {
     enableRawMode();
 
+    size_t selected = 0;
 
     while (true) {
         clearScreen();
         printf("Download Status\n");
-        printf("Press [0] to return to menu\n\n");
+        printf("Press [0] to return to menu\n");
+        printf("[1-9] select job  [p] pause/resume  [c] cancel  [+/-] priority\n\n");
 
         {
             std::lock_guard<std::mutex> lock(jobsMu_);
@@ -212,9 +460,9 @@ void SeedApp::statusFlow() {
                     auto& j = jobs_[i];
 
                     long long total   = j->progress.totalBytes.load();
-                    long long done    = j->progress.doneBytes.load();
-                    int tChunks       = j->progress.totalChunks.load();
-                    int dChunks       = j->progress.doneChunks.load();
+                    long long done    = j->progress.doneBytes();
+                    long long tChunks = j->progress.totalChunks.load();
+                    long long dChunks = j->progress.doneChunks();
 
                     double pct = safePct(done, total);
                     std::string bar = fmtBar(pct, 30);
@@ -230,20 +478,40 @@ void SeedApp::statusFlow() {
 
            
 
-                    printf("[%zu] %s\n", i + 1, j->filename.c_str());
+                    printf("%s[%zu] %s\n", (i == selected) ? ">" : " ", i + 1, j->filename.c_str());
                     printf(" %s  %6.2f%%\n", bar.c_str(), pct);
-                    printf(" Chunks   : %d / %d\n", dChunks, tChunks);
+                    printf(" Chunks   : %lld / %lld\n", dChunks, tChunks);
+                    const std::vector<SeederTally> rows = j->progress.bySeeder();
+                    for (size_t k = 0; k < rows.size(); ++k) {
+                        const std::string who = rows[k].peer.valid() ? rows[k].peer.str() : "local";
+                        printf(" %s %-15s %10s  %5lld chunks  %d errors\n", k == 0 ? "Seeders  :" : "          ",
+                               who.c_str(), fmtBytes(rows[k].bytes).c_str(), rows[k].chunks, rows[k].errors);
+                    }
                     printf(" Speed    : %.2f KB/s\n", speed);
                     if (j->finished.load()) {
                         printf(" Time Completed    : %s\n", fmtElapsed(elapsed).c_str());
                     } else {
                         printf(" Time Elapsed  : %s\n", fmtElapsed(elapsed).c_str());
                     }
+                    printf(" Priority : %d\n", j->control.priority());
+                    if (j->isBatch) {
+                        printf(" Files    : %d done, %d failed, %d already here (of %d)\n",
+                               j->batch.doneFiles.load(), j->batch.failedFiles.load(),
+                               j->batch.skippedFiles.load(), j->batch.totalFiles.load());
+                    }
+                    if (j->streaming && !j->finished.load()) {
+                        printf(" Ready    : %lld / %lld bytes\n",
+                               j->progress.readyBytes.load(), total);
+                    }
 
                     if (j->progress.success)
                         printf(" State    : COMPLETED\n");
+                    else if (j->control.stopRequested())
+                        printf(" State    : CANCELLED\n");
                     else if (j->progress.failed)
                         printf(" State    : FAILED\n");
+                    else if (j->control.paused())
+                        printf(" State    : PAUSED\n");
                     else if (j->progress.pending)
                         printf(" State    : LOOKING FOR SEEDERS...\n");
                     else if (j->progress.active)
@@ -254,29 +522,101 @@ void SeedApp::statusFlow() {
             }
         }
 
+        {
+            BufferPool& pool = BufferPool::instance();
+            printf("Buffers  :");
+            for (int k = 0; k < BufferPool::OWNERS; ++k) {
+                const BufferPool::Usage u = pool.usage((BufferPool::Owner)k);
+                printf(" %s %s", BufferPool::name((BufferPool::Owner)k), fmtBytes(u.inUse).c_str());
+                if (u.denied > 0) printf(" (%lld denied)", u.denied);
+            }
+            const long long cap = pool.cap();
+            printf("\n           %s held of %s\n\n", fmtBytes(pool.held()).c_str(),
+                   cap > 0 ? fmtBytes(cap).c_str() : "no cap");
+        }
+
         fflush(stdout);
 
         for (int i = 0; i < 30; ++i) {
             char c;
-            if (keyPressed(c) && c == '0') {
+            if (!keyPressed(c)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            if (c == '0') {
                 disableRawMode();
                 clearScreen();
                 fflush(stdout);
                 return;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            std::lock_guard<std::mutex> lock(jobsMu_);
+            if (c >= '1' && c <= '9') {
+                if ((size_t)(c - '1') < jobs_.size()) selected = (size_t)(c - '1');
+            } else if (selected < jobs_.size() && !jobs_[selected]->finished.load()) {
+                JobControl& ctl = jobs_[selected]->control;
+                if (c == 'p' || c == 'P') {
+                    if (ctl.paused()) ctl.resume();
+                    else ctl.pause();
+                } else if (c == 'c' || c == 'C') {
+                    ctl.cancel();
+                } else if (c == '+') {
+                    ctl.setPriority(ctl.priority() + 1);
+                } else if (c == '-') {
+                    ctl.setPriority(ctl.priority() - 1);
+                }
+            }
+            break;   // redraw right away
         }
     }
 }
 
-void SeedApp::downloadFlow() {
+std::vector<FileEntry> SeedApp::availableFiles() {
     printf("\nScanning for available files...\n\n");
 
-    std::vector<FileEntry> files = scanner_.scanOtherPorts(myPort_);
-    if (files.empty()) {
-        printf("No files available from other ports.\n\n");
-        return;
+    // cached catalog first (kept fresh in the background); scan only if it is empty
+    std::vector<FileEntry> files = scanner_.catalog();
+    if (!files.empty()) {
+        long long age = scanner_.catalogAgeSec();
+        if (age >= 0) printf("Using cached list (refreshed %llds ago).\n\n", age);
+        else          printf("Using saved list (refresh in progress).\n\n");
+    } else {
+        // print files as each peer answers
+        std::set<std::string> shown;
+        files = scanner_.scanOtherPorts(self_,
+            [&shown](const Endpoint& peer, const std::vector<std::string>& names) {
+                printf("  %s answered.\n", peer.str().c_str());
+                for (size_t k = 0; k < names.size(); ++k) {
+                    if (shown.insert(names[k]).second)
+                        printf("    found %s\n", names[k].c_str());
+                }
+                fflush(stdout);
+            });
+        if (!shown.empty()) printf("\n");
+    }
+
+    if (files.empty()) printf("No files available from other ports.\n\n");
+    return files;
+}
+
+// Where a stream also goes. A FIFO only opens once somebody reads from it:
+// poll for that instead of blocking, so the job can still be cancelled
+static int openStreamOut(const std::string& path, const JobControl& control) {
+    while (!control.stopRequested()) {
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0644);
+        if (fd >= 0) {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+            return fd;
+        }
+        if (errno != ENXIO) return -1;      // FIFO without a reader yet
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+    return -1;
+}
+
+void SeedApp::downloadFlow(bool streaming) {
+    std::vector<FileEntry> files = availableFiles();
+    if (files.empty()) return;
 
     printf("Available files (from other ports):\n");
     for (int i = 0; i < static_cast<int>(files.size()); ++i) {
@@ -318,6 +658,7 @@ void SeedApp::downloadFlow() {
         remoteSize
     );
 
+    bool delta = false;
     if (scanner_.existsLocal(myPort_, selected.filename)) {
         if (metaOk && remoteSize >= 0) {
             long long localSz = scanner_.localSize(myPort_, selected.filename);
@@ -328,11 +669,12 @@ void SeedApp::downloadFlow() {
             }
 
             printf(
-                "\nFile exists but incomplete/corrupt "
-                "(local=%lld, remote=%lld). Re-downloading...\n\n",
+                "\nFile exists but differs "
+                "(local=%lld, remote=%lld). Syncing changes only...\n\n",
                 localSz,
                 remoteSize
             );
+            delta = !streaming;
         } else {
             printf("\nThe file already exists.\n\n");
             return;
@@ -345,6 +687,18 @@ void SeedApp::downloadFlow() {
         selected.seeders.size() > 1 ? "s" : ""
     );
 
+    // streaming can also feed the in-order bytes to a FIFO (or plain file)
+    std::string pipePath;
+    if (streaming) {
+        printf("Also stream to (FIFO or file path, empty = none): ");
+        fflush(stdout);
+        pipePath = readLine(&eof);
+        if (eof) {
+            printf("\nEOF detected. Back to menu.\n\n");
+            return;
+        }
+    }
+
     // auto job = std::make_unique<DownloadJob>();
     // job->filename = selected.filename;
     // job->seeders  = selected.seeders;
@@ -385,16 +739,47 @@ void SeedApp::downloadFlow() {
         job->lastTick = job->start;
         job->progress.reset();
         job->progress.active.store(true);
+        job->streaming = streaming;
 
         DownloadJob* j = job.get();
 
-        job->worker = std::thread([this, j] {
-            bool ok = downloader_.download(
-                j->filename,
-                j->seeders,
-                myPort_,
-                &j->progress
-            );
+        DownloadOptions opts;
+        opts.streaming = streaming;
+        opts.udp = udp_;
+        opts.chain = chain_;
+        opts.self = self_;
+        // asked already: the download doesn't have to (small files it fetches whole)
+        if (metaOk && remoteSize >= 0) opts.knownSize = remoteSize;
+
+        job->worker = std::thread([this, j, opts, delta, pipePath] {
+            DownloadOptions o = opts;
+            std::unique_ptr<FdSink> out;
+            if (!pipePath.empty()) {
+                const int fd = openStreamOut(pipePath, j->control);
+                if (fd >= 0) {
+                    out.reset(new FdSink(fd));
+                    o.streamTo = out.get();
+                } else {
+                    logWarn("stream: cannot open '%s' for writing", pipePath.c_str());
+                }
+            }
+
+            // old copy on disk: try a delta first, full download if that fails
+            bool ok = false;
+            if (delta) {
+                ok = downloader_.syncDelta(j->filename, j->seeders, myPort_,
+                                           &j->progress, j->control);
+            }
+            if (!ok && !j->control.stopRequested()) {
+                ok = downloader_.download(
+                    j->filename,
+                    j->seeders,
+                    myPort_,
+                    &j->progress,
+                    j->control,
+                    o
+                );
+            }
 
             // Always update state flags
             j->progress.active.store(false);
@@ -420,9 +805,72 @@ void SeedApp::downloadFlow() {
         jobs_.push_back(std::move(job));
     }
 
+    if (streaming) {
+        printf("\nStreaming in background into bin/ports/%d/%s.part\n"
+               "(readable up to the Ready mark in Download status).\n",
+               myPort_, selected.filename.c_str());
+        if (!pipePath.empty()) printf("Copying it to %s as it arrives.\n", pipePath.c_str());
+        printf("\n");
+        return;
+    }
     printf("\nDownload started in background.\n\n");
 }
 
+static void printRate(long long bps) {
+    if (bps <= 0) printf("unlimited");
+    else printf("%lld KB/s", bps / 1024);
+}
+
+void SeedApp::limitFlow() {
+    bool eof = false;
+
+    printf("\nGlobal download limit: ");
+    printRate(RateLimiter::global().rate());
+    printf("\nNew limit in KB/s (0 = unlimited, -1 = keep): ");
+    fflush(stdout);
+    int kb = readInt(&eof);
+    if (eof) return;
+    if (kb >= 0) RateLimiter::global().setRate((long long)kb * 1024);
+
+    // the list as it is now; jobs_ stays unlocked while we wait for the user
+    // (jobs are only ever appended, so the numbers stay valid)
+    size_t count = 0;
+    bool any = false;
+    {
+        std::lock_guard<std::mutex> lock(jobsMu_);
+        count = jobs_.size();
+        for (size_t i = 0; i < count; ++i) {
+            if (jobs_[i]->finished.load()) continue;
+            if (!any) printf("\nRunning downloads:\n");
+            any = true;
+            printf("[%zu] %s  (", i + 1, jobs_[i]->filename.c_str());
+            printRate(jobs_[i]->control.limiter().rate());
+            printf(")\n");
+        }
+    }
+    if (!any) {
+        printf("\n");
+        return;
+    }
+
+    printf("Job to limit (0 = none): ");
+    fflush(stdout);
+    int sel = readInt(&eof);
+    if (eof || sel < 1 || sel > (int)count) {
+        printf("\n");
+        return;
+    }
+
+    printf("Limit in KB/s (0 = unlimited): ");
+    fflush(stdout);
+    kb = readInt(&eof);
+    if (!eof && kb >= 0) {
+        std::lock_guard<std::mutex> lock(jobsMu_);
+        jobs_[(size_t)sel - 1]->control.limiter().setRate((long long)kb * 1024);
+    }
+    printf("\n");
+}
+
 int SeedApp::run() {
         if (!boot()) return 1;
 
@@ -442,9 +890,15 @@ int SeedApp::run() {
         else if (choice == 2)
             statusFlow();
         else if (choice == 3)
+            limitFlow();
+        else if (choice == 4)
+            downloadFlow(true);
+        else if (choice == 5)
+            batchFlow();
+        else if (choice == 6)
             break;
         else
-            printf("\nInvalid option. Please enter 1, 2, or 3.\n\n");
+            printf("\nInvalid option. Please enter 1 to 6.\n\n");
     }
 
     printf("\nExiting...\n");
@@ -3,6 +3,7 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <cerrno>
@@ -51,13 +52,20 @@ int serversocket::bind_listen() {
     return 0;
 }
 
-int serversocket::accept(struct sockaddr_in& addr, socklen_t& addrlen) {
+int serversocket::accept(struct sockaddr_storage& addr, socklen_t& addrlen) {
     int s = ::accept(server_fd_, reinterpret_cast<sockaddr*>(&addr), &addrlen);
     if (s < 0) {
         sErr("accept() failed: %s", strerror(errno));
         return -1;
     }
 
+    // replies go out as a header and a payload each; pipelined GETs would
+    // otherwise sit behind Nagle waiting for the client's delayed ACK
+    int one = 1;
+    if (::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+        sWarn("setsockopt(TCP_NODELAY) failed (fd=%d): %s", s, strerror(errno));
+    }
+
     //super
     //sTrace("accepted client fd=%d", s);
     return s;
@@ -0,0 +1,559 @@
+#include "../inc/udpTransfer.h"
+#include "../inc/logger2.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace Udp {
+
+static const uint32_t MAGIC  = 0x53445031;   // "SDP1"
+static const unsigned char DATA = 1;
+static const unsigned char ACK  = 2;
+static const size_t HEADER    = 24;          // magic type flags len token seq/cum sendUs/echoUs
+static const size_t MAX_SACKS = 32;
+static const int    ACK_EVERY = 2;           // in-order packets per ack
+
+static const double TARGET_MS  = 25.0;       // queuing delay we are willing to add
+static const double GAIN       = 1.0;        // window growth per RTT at zero queue
+static const double INIT_CWND  = 10.0;
+static const double MIN_CWND   = 2.0;
+static const double MAX_CWND   = 4096.0;
+static const double RTO_MIN_MS = 30.0;
+static const double RTO_MAX_MS = 2000.0;
+static const long long REORDER = 3;          // later sends acked before one counts as lost
+static const long long BASE_INTERVAL_US = 10LL * 1000 * 1000;
+
+static long long nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void put32(char* p, uint32_t v) { v = htonl(v); std::memcpy(p, &v, 4); }
+static uint32_t get32(const char* p)   { uint32_t v; std::memcpy(&v, p, 4); return ntohl(v); }
+static void put64(char* p, uint64_t v) { put32(p, (uint32_t)(v >> 32)); put32(p + 4, (uint32_t)v); }
+static uint64_t get64(const char* p)   { return ((uint64_t)get32(p) << 32) | get32(p + 4); }
+
+static void putHeader(char* p, unsigned char type, unsigned char flags, uint16_t len,
+                      uint32_t token, uint32_t seq, uint64_t us) {
+    put32(p, MAGIC);
+    p[4] = (char)type;
+    p[5] = (char)flags;
+    const uint16_t l = htons(len);
+    std::memcpy(p + 6, &l, 2);
+    put32(p + 8, token);
+    put32(p + 12, seq);
+    put64(p + 16, us);
+}
+
+// ---- loss/delay shim ----
+
+struct Shim {
+    double loss = 0;        // fraction of datagrams dropped
+    long long delayUs = 0;  // added to every datagram
+};
+
+static const Shim& shim() {
+    static const Shim s = []() {
+        Shim c;
+        if (const char* v = std::getenv("SEED_UDP_LOSS"))     c.loss = std::atof(v) / 100.0;
+        if (const char* v = std::getenv("SEED_UDP_DELAY_MS")) c.delayUs = std::atoll(v) * 1000;
+        if (c.loss > 0 || c.delayUs > 0)
+            logInfo("UDP shim: %.1f%% loss, %lld ms delay", c.loss * 100.0, c.delayUs / 1000);
+        return c;
+    }();
+    return s;
+}
+
+void Link::reset(int fd) {
+    fd_ = fd;
+    held_.clear();
+}
+
+void Link::put(const void* data, size_t len) {
+    // a full socket buffer is just another lost packet
+    ::send(fd_, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void Link::send(const void* data, size_t len) {
+    const Shim& s = shim();
+    if (s.loss > 0) {
+        thread_local std::mt19937 rng(std::random_device{}());
+        if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < s.loss) return;
+    }
+    if (s.delayUs <= 0) {
+        put(data, len);
+        return;
+    }
+    held_.push_back(Held{ nowUs() + s.delayUs, std::string((const char*)data, len) });
+}
+
+void Link::flush() {
+    const long long now = nowUs();
+    while (!held_.empty() && held_.front().dueUs <= now) {
+        put(held_.front().bytes.data(), held_.front().bytes.size());
+        held_.pop_front();
+    }
+}
+
+long long Link::nextDueUs() const {
+    return held_.empty() ? -1 : held_.front().dueUs;
+}
+
+// ---- sender ----
+
+Sender::Sender()
+    : fd_(-1), port_(-1),
+      cwnd_(INIT_CWND), ssthresh_(MAX_CWND), srtt_(-1), rttvar_(0), rto_(200.0), lastRtt_(-1),
+      baseRtt_(-1), curMin_(-1), prevMin_(-1), minResetUs_(0),
+      sent_(0), resent_(0) {}
+
+Sender::~Sender() {
+    if (fd_ >= 0) ::close(fd_);
+}
+
+bool Sender::open(int ctlFd, int clientUdpPort) {
+    sockaddr_storage local, peer;
+    socklen_t localLen = sizeof(local), peerLen = sizeof(peer);
+    if (::getsockname(ctlFd, (sockaddr*)&local, &localLen) != 0) return false;
+    if (::getpeername(ctlFd, (sockaddr*)&peer, &peerLen) != 0) return false;
+
+    if (peer.ss_family == AF_INET) ((sockaddr_in*)&peer)->sin_port = htons((uint16_t)clientUdpPort);
+    else                           ((sockaddr_in6*)&peer)->sin6_port = htons((uint16_t)clientUdpPort);
+
+    if (fd_ < 0) {
+        if (local.ss_family == AF_INET) ((sockaddr_in*)&local)->sin_port = 0;
+        else                            ((sockaddr_in6*)&local)->sin6_port = 0;
+
+        fd_ = ::socket(local.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd_ < 0) return false;
+        int sndbuf = 4 * 1024 * 1024;
+        ::setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        if (::bind(fd_, (sockaddr*)&local, localLen) != 0 ||
+            ::getsockname(fd_, (sockaddr*)&local, &localLen) != 0) {
+            ::close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        port_ = ntohs(local.ss_family == AF_INET ? ((sockaddr_in*)&local)->sin_port
+                                                 : ((sockaddr_in6*)&local)->sin6_port);
+    }
+
+    // (re)aim at whatever port the client uses for this range
+    if (::connect(fd_, (sockaddr*)&peer, peerLen) != 0) return false;
+    link_.reset(fd_);
+    return true;
+}
+
+void Sender::onRtt(double ms) {
+    if (ms <= 0) ms = 0.01;
+    lastRtt_ = ms;
+    if (srtt_ < 0) {
+        srtt_ = ms;
+        rttvar_ = ms / 2;
+    } else {
+        rttvar_ = 0.75 * rttvar_ + 0.25 * std::fabs(srtt_ - ms);
+        srtt_ = 0.875 * srtt_ + 0.125 * ms;
+    }
+    rto_ = std::min(std::max(srtt_ + 4 * rttvar_, RTO_MIN_MS), RTO_MAX_MS);
+
+    // base delay: the lowest RTT of the last interval or two, so a route
+    // change (or a long queue at the start) doesn't pin it forever
+    const long long now = nowUs();
+    if (now - minResetUs_ > BASE_INTERVAL_US) {
+        prevMin_ = curMin_;
+        curMin_ = -1;
+        minResetUs_ = now;
+    }
+    if (curMin_ < 0 || ms < curMin_) curMin_ = ms;
+    baseRtt_ = prevMin_ < 0 ? curMin_ : std::min(prevMin_, curMin_);
+}
+
+bool Sender::send(int ctlFd, int fileFd, long long offset, long long bytes, uint32_t token) {
+    const uint32_t packets = (uint32_t)((bytes + (long long)PAYLOAD - 1) / (long long)PAYLOAD);
+
+    std::vector<unsigned char> acked(packets, 0);
+    std::vector<unsigned char> lost(packets, 0);
+    std::vector<long long> txOrder(packets, -1);    // when it last went out, in sends
+    std::vector<long long> txUs(packets, 0);
+    std::deque<uint32_t> resend;
+
+    uint32_t next = 0;           // first packet never sent
+    uint32_t cumPos = 0;         // first packet not acked
+    uint32_t ackedCount = 0;
+    long long inflight = 0;      // sent, neither acked nor given up on
+    long long tx = 0;
+    long long highestAckedTx = -1;
+    long long recoverTx = -1;    // one window cut per round trip
+    long long lastAckUs = nowUs();
+    long long nextSendUs = lastAckUs;
+
+    char pkt[HEADER + PAYLOAD];
+    char in[HEADER + 8 + MAX_SACKS * 8];
+
+    const auto outstanding = [&](uint32_t s) { return txOrder[s] >= 0 && !acked[s] && !lost[s]; };
+    const auto giveUp = [&](uint32_t s) {
+        lost[s] = 1;
+        --inflight;
+        resend.push_back(s);
+    };
+
+    while (ackedCount < packets) {
+        long long now = nowUs();
+        link_.flush();
+
+        if (now - lastAckUs > (long long)IDLE_TIMEOUT_MS * 1000) {
+            logWarn("UDP: no ack for %d ms, giving up (%u of %u packets acked)",
+                    IDLE_TIMEOUT_MS, ackedCount, packets);
+            return false;
+        }
+
+        uint32_t oldest = cumPos;
+        while (oldest < next && !outstanding(oldest)) ++oldest;
+
+        // retransmission timeout on the oldest packet: everything out there is lost
+        if (oldest < next && (double)(now - txUs[oldest]) / 1000.0 > rto_) {
+            for (uint32_t s = cumPos; s < next; ++s) {
+                if (outstanding(s)) giveUp(s);
+            }
+            ssthresh_ = std::max(cwnd_ / 2, MIN_CWND);
+            cwnd_ = MIN_CWND;
+            rto_ = std::min(rto_ * 2, RTO_MAX_MS);
+            recoverTx = tx;
+            nextSendUs = now;
+        }
+
+        // paced sends while the window has room
+        const double rtt = srtt_ > 0 ? srtt_ : 10.0;
+        const long long interval = std::max(1LL, (long long)(rtt * 1000.0 / cwnd_));
+        while (inflight < (long long)cwnd_ && now >= nextSendUs) {
+            while (!resend.empty() && acked[resend.front()]) resend.pop_front();
+
+            uint32_t seq;
+            bool again = false;
+            if (!resend.empty()) {
+                seq = resend.front();
+                resend.pop_front();
+                lost[seq] = 0;
+                again = true;
+            } else if (next < packets) {
+                seq = next++;
+            } else {
+                break;
+            }
+
+            const size_t len = (size_t)std::min((long long)PAYLOAD, bytes - (long long)seq * (long long)PAYLOAD);
+            const ssize_t rd = ::pread(fileFd, pkt + HEADER, len, (off_t)(offset + (long long)seq * (long long)PAYLOAD));
+            if (rd != (ssize_t)len) {
+                logErr("UDP: read of packet %u failed: %s", seq, rd < 0 ? strerror(errno) : "short read");
+                return false;
+            }
+            putHeader(pkt, DATA, again ? 1 : 0, (uint16_t)len, token, seq, (uint64_t)now);
+            link_.send(pkt, HEADER + len);
+
+            txOrder[seq] = tx++;
+            txUs[seq] = now;
+            ++inflight;
+            ++sent_;
+            if (again) ++resent_;
+            nextSendUs = std::max(nextSendUs + interval, now - 2 * interval);
+        }
+
+        // sleep until an ack, the next send slot, the RTO or a held datagram
+        long long wake = now + 100 * 1000;
+        if (inflight < (long long)cwnd_ && (next < packets || !resend.empty())) wake = std::min(wake, nextSendUs);
+        while (oldest < next && !outstanding(oldest)) ++oldest;
+        if (oldest < next) wake = std::min(wake, txUs[oldest] + (long long)(rto_ * 1000.0));
+        if (link_.nextDueUs() >= 0) wake = std::min(wake, link_.nextDueUs());
+        const long long waitUs = std::max(0LL, wake - now);
+
+        pollfd fds[2];
+        fds[0].fd = fd_;
+        fds[0].events = POLLIN;
+        fds[1].fd = ctlFd;
+        fds[1].events = POLLRDHUP;
+        timespec ts;
+        ts.tv_sec = (time_t)(waitUs / 1000000);
+        ts.tv_nsec = (long)(waitUs % 1000000) * 1000;
+        const int pr = ::ppoll(fds, 2, &ts, nullptr);
+        if (pr < 0 && errno != EINTR) return false;
+        if (pr > 0 && (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR))) {
+            logInfo("UDP: client closed the control connection");
+            return false;
+        }
+        if (pr <= 0 || !(fds[0].revents & POLLIN)) continue;
+
+        now = nowUs();
+        ssize_t n;
+        while ((n = ::recv(fd_, in, sizeof(in), MSG_DONTWAIT)) >= (ssize_t)HEADER) {
+            if (get32(in) != MAGIC || (unsigned char)in[4] != ACK || get32(in + 8) != token) continue;
+            const uint32_t cum = std::min(get32(in + 12), packets);
+            const uint64_t echoUs = get64(in + 16);
+            const size_t sacks = std::min((size_t)(unsigned char)in[5], ((size_t)n - HEADER) / 8);
+
+            long long newly = 0;
+            long long hiTx = -1;
+            const auto mark = [&](uint32_t s) {
+                if (acked[s]) return;
+                acked[s] = 1;
+                ++ackedCount;
+                ++newly;
+                if (!lost[s] && txOrder[s] >= 0) --inflight;
+                hiTx = std::max(hiTx, txOrder[s]);
+            };
+            for (uint32_t s = cumPos; s < cum; ++s) mark(s);
+            for (size_t k = 0; k < sacks; ++k) {
+                const uint32_t a = std::min(get32(in + HEADER + k * 8), packets);
+                const uint32_t b = std::min(get32(in + HEADER + k * 8 + 4), packets);
+                for (uint32_t s = std::max(a, cumPos); s < b; ++s) mark(s);
+            }
+            while (cumPos < packets && acked[cumPos]) ++cumPos;
+            lastAckUs = now;
+            if (echoUs > 0 && (long long)echoUs <= now) onRtt((double)(now - (long long)echoUs) / 1000.0);
+            highestAckedTx = std::max(highestAckedTx, hiTx);
+
+            // anything sent REORDER sends before something that got through is gone
+            bool cut = false;
+            for (uint32_t s = cumPos; s < next; ++s) {
+                if (!outstanding(s) || txOrder[s] + REORDER > highestAckedTx) continue;
+                if (txOrder[s] > recoverTx) cut = true;
+                giveUp(s);
+            }
+            if (cut) {
+                cwnd_ = std::max(cwnd_ / 2, MIN_CWND);
+                ssthresh_ = cwnd_;
+                recoverTx = tx;
+            }
+
+            // delay based growth: +GAIN per RTT with an empty queue, shrinking
+            // as the queue we add approaches TARGET_MS and negative past it
+            if (newly > 0 && lastRtt_ > 0) {
+                const double queued = std::max(0.0, lastRtt_ - baseRtt_);
+                if (cwnd_ < ssthresh_ && queued < TARGET_MS / 2) {
+                    cwnd_ += (double)newly;
+                } else {
+                    if (cwnd_ < ssthresh_) ssthresh_ = cwnd_;    // queue is building: done probing
+                    const double off = std::max(-1.0, (TARGET_MS - queued) / TARGET_MS);
+                    cwnd_ += GAIN * off * (double)newly / cwnd_;
+                }
+                cwnd_ = std::min(std::max(cwnd_, MIN_CWND), MAX_CWND);
+            }
+        }
+    }
+
+    logDbg("UDP: %u packets acked, %lld resent, cwnd %.1f srtt %.2f ms base %.2f ms",
+           packets, resent_, cwnd_, srtt_, baseRtt_);
+    return true;
+}
+
+// ---- receiver ----
+
+Receiver::Receiver()
+    : fd_(-1), token_(0), first_(0), count_(0), chunkSize_(0), packets_(0), bytes_(0),
+      cum_(0), highest_(0), lastUs_(0) {}
+
+Receiver::~Receiver() { close(); }
+
+void Receiver::close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    link_.reset(-1);
+    packets_ = 0;
+    cum_ = 0;
+    highest_ = 0;
+    data_.release();
+    have_.clear();
+    missing_.clear();
+}
+
+int Receiver::prepare(int ctlFd, const Endpoint& peer, const std::string& filename,
+                      long long first, int count, int chunkSize, std::string& request) {
+    close();
+
+    // the range lands here whole; at the pool's cap it comes by GET instead
+    data_ = BufferPool::instance().get((size_t)count * (size_t)chunkSize, BufferPool::DOWNLOAD);
+    if (!data_) return 6;
+
+    sockaddr_storage local, server;
+    socklen_t localLen = sizeof(local), serverLen = 0;
+    if (!peer.toSockaddr(server, serverLen)) return 5;
+    // same address as the control connection, that's where the server aims
+    if (::getsockname(ctlFd, (sockaddr*)&local, &localLen) != 0) return 1;
+    if (local.ss_family == AF_INET) ((sockaddr_in*)&local)->sin_port = 0;
+    else                            ((sockaddr_in6*)&local)->sin6_port = 0;
+
+    fd_ = ::socket(local.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) return 5;
+    int rcvbuf = 4 * 1024 * 1024;
+    ::setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (::bind(fd_, (sockaddr*)&local, localLen) != 0 ||
+        ::getsockname(fd_, (sockaddr*)&local, &localLen) != 0) {
+        close();
+        return 5;
+    }
+    const int myPort = ntohs(local.ss_family == AF_INET ? ((sockaddr_in*)&local)->sin_port
+                                                        : ((sockaddr_in6*)&local)->sin6_port);
+
+    char req[64];
+    std::snprintf(req, sizeof(req), "UDPGET %lld %d %d ", first, count, myPort);
+    request = std::string(req) + filename + "\n";
+    peer_ = peer;
+    first_ = first;
+    count_ = count;
+    chunkSize_ = chunkSize;
+    return 0;
+}
+
+int Receiver::start(const std::string& reply) {
+    int serverPort = -1;
+    unsigned token = 0, packets = 0;
+    long long bytes = -1;
+    if (std::sscanf(reply.c_str(), "<UDP> %d %u %u %lld", &serverPort, &token, &packets, &bytes) != 4) {
+        close();
+        if (reply == "<FILE_NOT_FOUND>") return 2;
+        if (reply == "<RANGE_ERROR>") return 3;
+        return 5;    // <BAD_REQUEST> from older peers, <NO_UDP>
+    }
+    if (bytes <= 0 || bytes > (long long)count_ * chunkSize_ ||
+        packets != (unsigned)((bytes + (long long)PAYLOAD - 1) / (long long)PAYLOAD) ||
+        serverPort <= 0 || serverPort > 65535) {
+        // it'll still send its closing line; the stream is out of step
+        close();
+        return 1;
+    }
+
+    sockaddr_storage server;
+    socklen_t serverLen = 0;
+    if (fd_ < 0 || !peer_.toSockaddr(server, serverLen)) {
+        close();
+        return 1;
+    }
+    if (server.ss_family == AF_INET) ((sockaddr_in*)&server)->sin_port = htons((uint16_t)serverPort);
+    else                             ((sockaddr_in6*)&server)->sin6_port = htons((uint16_t)serverPort);
+    if (::connect(fd_, (sockaddr*)&server, serverLen) != 0) {
+        close();
+        return 1;
+    }
+
+    link_.reset(fd_);
+    token_ = token;
+    packets_ = packets;
+    bytes_ = bytes;
+    cum_ = 0;
+    highest_ = 0;
+    lastUs_ = nowUs();
+    have_.assign(packets, 0);
+
+    const int chunks = (int)((bytes + chunkSize_ - 1) / chunkSize_);
+    missing_.assign((size_t)chunks, 0);
+    for (int c = 0; c < chunks; ++c) {
+        const long long from = (long long)c * chunkSize_;
+        const long long to = std::min(from + (long long)chunkSize_, bytes) - 1;
+        missing_[(size_t)c] = (int)(to / (long long)PAYLOAD - from / (long long)PAYLOAD + 1);
+    }
+    return 0;
+}
+
+void Receiver::ack(uint64_t echoUs) {
+    char out[HEADER + MAX_SACKS * 8];
+    size_t sacks = 0;
+    // runs we hold above the first gap
+    uint32_t s = cum_;
+    while (s <= highest_ && s < packets_ && sacks < MAX_SACKS) {
+        while (s <= highest_ && s < packets_ && !have_[s]) ++s;
+        if (s > highest_ || s >= packets_) break;
+        const uint32_t a = s;
+        while (s < packets_ && have_[s]) ++s;
+        put32(out + HEADER + sacks * 8, a);
+        put32(out + HEADER + sacks * 8 + 4, s);
+        ++sacks;
+    }
+    putHeader(out, ACK, (unsigned char)sacks, 0, token_, cum_, echoUs);
+    link_.send(out, HEADER + sacks * 8);
+}
+
+bool Receiver::pump(const std::function<bool(int, const char*, size_t)>& onChunk) {
+    if (fd_ < 0) return false;
+    link_.flush();
+
+    char pkt[HEADER + PAYLOAD];
+    uint64_t echo = 0;
+    int unacked = 0;
+    ssize_t n;
+    while ((n = ::recv(fd_, pkt, sizeof(pkt), MSG_DONTWAIT)) >= 0 || errno == EINTR) {
+        if (n < (ssize_t)HEADER) continue;
+        if (get32(pkt) != MAGIC || (unsigned char)pkt[4] != DATA || get32(pkt + 8) != token_) continue;
+
+        uint16_t len;
+        std::memcpy(&len, pkt + 6, 2);
+        len = ntohs(len);
+        const uint32_t seq = get32(pkt + 12);
+        if (seq >= packets_ || (size_t)n != HEADER + len) continue;
+        const long long at = (long long)seq * (long long)PAYLOAD;
+        if ((long long)len != std::min((long long)PAYLOAD, bytes_ - at)) continue;
+
+        lastUs_ = nowUs();
+        echo = get64(pkt + 16);
+        if (have_[seq]) {
+            // our ack got lost; say it again now
+            unacked = ACK_EVERY;
+        } else {
+            const bool inOrder = seq == cum_;
+            have_[seq] = 1;
+            std::memcpy(data_.data() + at, pkt + HEADER, len);
+            highest_ = std::max(highest_, seq);
+            while (cum_ < packets_ && have_[cum_]) ++cum_;
+            unacked = inOrder ? unacked + 1 : ACK_EVERY;   // gaps get reported right away
+
+            const int c0 = (int)(at / chunkSize_);
+            const int c1 = (int)((at + len - 1) / chunkSize_);
+            for (int c = c0; c <= c1; ++c) {
+                if (--missing_[(size_t)c] != 0) continue;
+                const long long from = (long long)c * chunkSize_;
+                const size_t size = (size_t)std::min((long long)chunkSize_, bytes_ - from);
+                if (!onChunk(c, data_.data() + from, size)) return false;
+            }
+        }
+        if (unacked >= ACK_EVERY) {
+            ack(echo);
+            unacked = 0;
+        }
+    }
+    if (unacked > 0) ack(echo);
+
+    return done() || nowUs() - lastUs_ <= (long long)IDLE_TIMEOUT_MS * 1000;
+}
+
+long long Receiver::wakeUs() const {
+    long long at = lastUs_ + (long long)IDLE_TIMEOUT_MS * 1000;
+    if (link_.nextDueUs() >= 0) at = std::min(at, link_.nextDueUs());
+    return at;
+}
+
+// Waiting for the server's closing line: answer any retransmission (our
+// last ack may not have made it) and send what the shim held back
+void Receiver::reack() {
+    link_.flush();
+    char pkt[HEADER + PAYLOAD];
+    ssize_t n;
+    uint64_t echo = 0;
+    while ((n = ::recv(fd_, pkt, sizeof(pkt), MSG_DONTWAIT)) >= (ssize_t)HEADER) {
+        if (get32(pkt) == MAGIC && (unsigned char)pkt[4] == DATA && get32(pkt + 8) == token_)
+            echo = get64(pkt + 16);
+    }
+    if (echo) ack(echo);
+}
+
+} // namespace Udp
@@ -0,0 +1,161 @@
+#include "../inc/bufferPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } \
+} while (0)
+
+static const size_t KB = 1024;
+static const size_t MB = 1024 * 1024;
+
+static BufferPool& pool() { return BufferPool::instance(); }
+
+static long long inUse() { return pool().usage(BufferPool::DOWNLOAD).inUse; }
+static long long denied() { return pool().usage(BufferPool::DOWNLOAD).denied; }
+
+static long long msSince(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// a get() that can't fit frees the shared lists and our own cache: what is
+// held afterwards sits in other threads' caches (or is in use). Too big to
+// pool, or it might just be handed a cached one
+static void drain() {
+    pool().setCap(1);
+    CHECK(!pool().get(8 * MB, BufferPool::DOWNLOAD));
+}
+
+static void testClasses() {
+    {
+        BufferPool::Buffer b = pool().get(1, BufferPool::DOWNLOAD);
+        CHECK(b && b.size() == 1);
+        CHECK((uintptr_t)b.data() % BufferPool::PAGE == 0);
+        CHECK(inUse() == 4 * KB);
+    }
+    CHECK(inUse() == 0);
+
+    {
+        BufferPool::Buffer b = pool().get(4 * KB + 1, BufferPool::DOWNLOAD);
+        CHECK(inUse() == 8 * KB);
+        BufferPool::Buffer c = pool().get(4 * MB, BufferPool::DOWNLOAD);
+        CHECK(inUse() == 8 * KB + 4 * MB);
+    }
+
+    // past the biggest class: whole huge pages, not pooled
+    const long long before = pool().held();
+    {
+        BufferPool::Buffer b = pool().get(4 * MB + 1, BufferPool::DOWNLOAD);
+        CHECK(b && b.size() == 4 * MB + 1);
+        CHECK(inUse() == 6 * (long long)MB);
+        CHECK(pool().held() == before + 6 * (long long)MB);
+    }
+    CHECK(pool().held() == before);
+
+    // handed back and taken again: no trip to the system
+    char* first;
+    {
+        BufferPool::Buffer b = pool().get(16 * KB, BufferPool::DOWNLOAD);
+        first = b.data();
+    }
+    const long long fresh = pool().usage(BufferPool::DOWNLOAD).fresh;
+    BufferPool::Buffer again = pool().get(16 * KB, BufferPool::DOWNLOAD);
+    CHECK(again.data() == first);
+    CHECK(pool().usage(BufferPool::DOWNLOAD).fresh == fresh);
+}
+
+static void testCap() {
+    drain();
+    CHECK(pool().held() == 0);
+
+    pool().setCap(1 * MB);
+    BufferPool::Buffer big = pool().get(512 * KB, BufferPool::DOWNLOAD);
+    BufferPool::Buffer half = pool().get(256 * KB, BufferPool::DOWNLOAD);
+    CHECK(big && half);
+
+    const long long was = denied();
+    CHECK(!pool().get(512 * KB, BufferPool::DOWNLOAD));
+    CHECK(denied() == was + 1);
+
+    // what's cached doesn't count as taken: it goes back to make room
+    half.release();
+    CHECK(pool().get(512 * KB, BufferPool::DOWNLOAD));
+    CHECK(pool().held() <= (long long)MB);
+}
+
+static void testWait() {
+    drain();
+    pool().setCap(1 * MB);
+    BufferPool::Buffer all = pool().get(1 * MB, BufferPool::DOWNLOAD);
+    CHECK(all);
+
+    // nobody hands anything back: empty once waitMs is up
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    CHECK(!pool().get(4 * KB, BufferPool::DOWNLOAD, 50));
+    CHECK(msSince(t0) >= 50);
+
+    // somebody does: the waiter gets its buffer then, not at the deadline
+    std::thread holder([&all]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        all.release();
+    });
+    t0 = std::chrono::steady_clock::now();
+    BufferPool::Buffer got = pool().get(4 * KB, BufferPool::DOWNLOAD, 5000);
+    const long long waited = msSince(t0);
+    holder.join();
+    CHECK(got);
+    CHECK(waited >= 90 && waited < 5000);
+}
+
+// other threads' caches are out of trim()'s reach: together they keep at most
+// an eighth of the cap, and nothing once held is that close to it
+static void testThreadCaches() {
+    drain();
+    pool().setCap(1 * MB);
+
+    for (int round = 0; round < 2; ++round) {
+        const int count = round == 0 ? 4 : 16;     // 256 KiB, then the whole cap
+        std::atomic<int> stage{0};
+        std::thread other([&stage, count]() {
+            std::vector<BufferPool::Buffer> bufs;
+            for (int i = 0; i < count; ++i) bufs.push_back(pool().get(64 * KB, BufferPool::DOWNLOAD));
+            for (size_t i = 0; i < bufs.size(); ++i) CHECK(bufs[i]);
+            bufs.clear();
+            stage.store(1);
+            while (stage.load() != 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        });
+        while (stage.load() != 1) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+        CHECK(!pool().get(2 * MB, BufferPool::DOWNLOAD));
+        CHECK(pool().held() == (round == 0 ? 128 * (long long)KB : 0));
+
+        stage.store(2);
+        other.join();
+        pool().setCap(1 * MB);
+    }
+
+    // a thread that ends hands its cache back
+    drain();
+    CHECK(pool().held() == 0);
+}
+
+int main() {
+    testClasses();
+    testCap();
+    testWait();
+    testThreadCaches();
+    pool().setCap(BufferPool::DEFAULT_CAP);
+    if (failures) {
+        std::fprintf(stderr, "bufferPoolTest: %d failed\n", failures);
+        return 1;
+    }
+    std::printf("bufferPoolTest: ok\n");
+    return 0;
+}
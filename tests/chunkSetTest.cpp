@@ -0,0 +1,145 @@
+#include "../inc/chunkSet.h"
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); ++failures; } \
+} while (0)
+
+typedef std::vector<std::pair<long long, long long> > RunList;
+
+static RunList runs(const ChunkSet& s, long long from = 0, long long end = 1LL << 40) {
+    return s.runsIn(from, end);
+}
+
+static RunList list(std::initializer_list<std::pair<long long, long long> > r) { return RunList(r); }
+
+// far enough apart to land in other stripes and shards
+static const long long FAR = 1LL << 20;
+
+static void testMerge() {
+    ChunkSet s;
+    CHECK(s.add(5));
+    CHECK(!s.add(5));
+    CHECK(s.add(7));
+    CHECK(runs(s) == list({{5, 6}, {7, 8}}));
+
+    // touching on both sides closes the gap
+    CHECK(s.add(6));
+    CHECK(runs(s) == list({{5, 8}}));
+
+    // overlapping and swallowing
+    s.add(10, 20);
+    s.add(15, 30);
+    s.add(2, 4);
+    CHECK(runs(s) == list({{2, 4}, {5, 8}, {10, 30}}));
+    s.add(0, 40);
+    CHECK(runs(s) == list({{0, 40}}));
+    s.add(40, 41);
+    CHECK(runs(s) == list({{0, 41}}));
+}
+
+static void testSplit() {
+    ChunkSet s;
+    s.add(0, 100);
+    CHECK(s.remove(50));
+    CHECK(!s.remove(50));
+    CHECK(runs(s) == list({{0, 50}, {51, 100}}));
+
+    s.remove(10, 20);
+    CHECK(runs(s) == list({{0, 10}, {20, 50}, {51, 100}}));
+
+    // across runs and the gaps between them
+    s.remove(5, 60);
+    CHECK(runs(s) == list({{0, 5}, {60, 100}}));
+    s.remove(0, 5);
+    s.remove(99, 200);
+    CHECK(runs(s) == list({{60, 99}}));
+    CHECK(!s.has(99));
+    CHECK(s.has(60));
+}
+
+// runs over stripe ends are kept in pieces, but nobody outside sees that
+static void testStripes() {
+    ChunkSet s;
+    s.add(FAR - 10, 3 * FAR + 10);
+    CHECK(runs(s) == list({{FAR - 10, 3 * FAR + 10}}));
+    CHECK(s.has(FAR) && s.has(2 * FAR) && s.has(3 * FAR + 9) && !s.has(3 * FAR + 10));
+
+    CHECK(s.nextOut(FAR - 10, 4 * FAR) == 3 * FAR + 10);
+    CHECK(s.nextOut(FAR, 2 * FAR) == 2 * FAR);
+    CHECK(s.nextIn(0, 4 * FAR) == FAR - 10);
+    CHECK(s.nextIn(3 * FAR + 10, 4 * FAR) == 4 * FAR);
+    CHECK(s.prevOut(0, 3 * FAR) == FAR - 11);
+    CHECK(s.prevOut(FAR - 10, 3 * FAR) == FAR - 11);   // none: from - 1
+
+    // a hole in the middle splits it again
+    s.remove(2 * FAR - 1, 2 * FAR + 1);
+    CHECK(runs(s) == list({{FAR - 10, 2 * FAR - 1}, {2 * FAR + 1, 3 * FAR + 10}}));
+    CHECK(s.nextOut(FAR, 4 * FAR) == 2 * FAR - 1);
+    CHECK(s.nextIn(2 * FAR - 1, 4 * FAR) == 2 * FAR + 1);
+    CHECK(s.prevOut(0, 3 * FAR) == 2 * FAR);
+
+    // clipped to what was asked for
+    CHECK(runs(s, FAR, FAR + 5) == list({{FAR, FAR + 5}}));
+    CHECK(runs(s, 2 * FAR - 1, 2 * FAR + 1).empty());
+
+    // far apart, nothing between
+    ChunkSet sparse;
+    sparse.add(5);
+    sparse.add(1000 * FAR);
+    CHECK(runs(sparse) == list({{5, 6}, {1000 * FAR, 1000 * FAR + 1}}));
+    CHECK(sparse.nextIn(6, 1LL << 40) == 1000 * FAR);
+    CHECK(sparse.nextIn(6, FAR) == FAR);
+}
+
+static void testBitmap() {
+    ChunkSet s;
+    s.add(0);
+    s.add(3, 20);
+    s.add(30);
+    const std::string bits = s.bitmap(33);
+    CHECK(bits.size() == 5);
+    CHECK((unsigned char)bits[0] == 0x9F);
+    CHECK((unsigned char)bits[1] == 0xFF);
+    CHECK((unsigned char)bits[2] == 0xF0);
+    CHECK((unsigned char)bits[3] == 0x02);
+
+    ChunkSet back;
+    back.addBitmap(bits, 33);
+    CHECK(runs(back) == runs(s));
+}
+
+// lanes add their own ranges side by side; nothing may get lost
+static void testThreads() {
+    ChunkSet s;
+    const int lanes = 8;
+    const long long each = 50000;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < lanes; ++i) {
+        threads.push_back(std::thread([&s, i, each]() {
+            for (long long c = i * each; c < (i + 1) * each; ++c) s.add(c);
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i) threads[i].join();
+    CHECK(runs(s) == list({{0, lanes * each}}));
+    CHECK(s.nextOut(0, 1LL << 40) == lanes * each);
+}
+
+int main() {
+    testMerge();
+    testSplit();
+    testStripes();
+    testBitmap();
+    testThreads();
+    if (failures) {
+        std::fprintf(stderr, "chunkSetTest: %d failed\n", failures);
+        return 1;
+    }
+    std::printf("chunkSetTest: ok\n");
+    return 0;
+}